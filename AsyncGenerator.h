@@ -0,0 +1,275 @@
+//
+// Created by benny on 2022/4/13.
+//
+
+#ifndef CPPCOROUTINES_TASKS_04_TASK_ASYNCGENERATOR_H_
+#define CPPCOROUTINES_TASKS_04_TASK_ASYNCGENERATOR_H_
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "FramePool.h"
+#include "SleepAwaiter.h"
+#include "TaskAwaiter.h"
+
+template<typename ValueType>
+class AsyncGenerator;
+
+template<typename ValueType>
+struct AsyncGeneratorPromise : public PooledFramePromise {
+  using ValuePointer = std::add_pointer_t<ValueType>;
+
+  // the yielded value, in the generator's frame until it is resumed.
+  ValuePointer current = nullptr;
+  // whether current was yielded as an rvalue, next() only moves out of those.
+  bool is_current_movable = false;
+  std::exception_ptr exception;
+  // the coroutine that asked for the next value and its executor, which runs the generator's awaits.
+  std::coroutine_handle<> consumer;
+  AbstractExecutor *executor = nullptr;
+  TaskPriority priority = TaskPriority::kNormal;
+
+  // whether the consumer is still inside its call to resume the generator, see AsyncGeneratorAwaiter.
+  enum Handoff : int { kResuming, kConsumerSuspended, kYielded };
+  std::atomic<int> handoff{kYielded};
+
+  // hands control back to the consumer: by returning from its resume call if it is still in it,
+  // otherwise by symmetric transfer once an await of the generator has let the consumer suspend.
+  struct YieldAwaiter {
+    bool await_ready() const noexcept { return false; }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<AsyncGeneratorPromise> handle) noexcept {
+      auto &promise = handle.promise();
+      int expected = kResuming;
+      if (promise.handoff.compare_exchange_strong(expected, kYielded, std::memory_order_acq_rel)) {
+        return std::noop_coroutine();
+      }
+      return promise.consumer;
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  AsyncGenerator<ValueType> get_return_object() {
+    return AsyncGenerator<ValueType>{std::coroutine_handle<AsyncGeneratorPromise>::from_promise(*this)};
+  }
+
+  // runs only once the consumer asks for a value.
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  YieldAwaiter final_suspend() noexcept {
+    current = nullptr;
+    return {};
+  }
+
+  // co_yield of a variable of the generator, next() copies it.
+  YieldAwaiter yield_value(std::remove_reference_t<ValueType> &value) noexcept {
+    current = std::addressof(value);
+    is_current_movable = false;
+    return {};
+  }
+
+  YieldAwaiter yield_value(std::remove_reference_t<ValueType> &&value) noexcept {
+    current = std::addressof(value);
+    is_current_movable = true;
+    return {};
+  }
+
+  template<typename _ResultType, typename _Executor>
+  TaskAwaiter<_ResultType, _Executor> await_transform(Task<_ResultType, _Executor> &&task) {
+    return await_transform(TaskAwaiter<_ResultType, _Executor>(std::move(task)));
+  }
+
+  template<typename _Rep, typename _Period>
+  SleepAwaiter await_transform(std::chrono::duration<_Rep, _Period> &&duration) {
+    return await_transform(SleepAwaiter(std::move(duration)));
+  }
+
+  // awaits resume the generator on the consumer's executor.
+  template<typename AwaiterImpl>
+  requires std::is_base_of_v<Awaiter<typename std::remove_cvref_t<AwaiterImpl>::ResultType>, std::remove_cvref_t<AwaiterImpl>>
+  AwaiterImpl &&await_transform(AwaiterImpl &&awaiter) {
+    awaiter.install_executor(executor, priority);
+    return std::forward<AwaiterImpl>(awaiter);
+  }
+
+  void unhandled_exception() {
+    exception = std::current_exception();
+  }
+
+  void return_void() {}
+
+  void rethrow_if_failed() {
+    if (exception) {
+      std::rethrow_exception(std::exchange(exception, nullptr));
+    }
+  }
+};
+
+/**
+ * Resumes the generator from the awaiting coroutine, it runs on the consumer's thread until it
+ * yields, completes or suspends on an await of its own. A value yielded right away needs no
+ * suspension of the consumer, so a long stream does not depend on tail calls to keep the stack
+ * flat; only the first yield after such an await resumes the consumer.
+ */
+template<typename ValueType, typename R>
+class AsyncGeneratorAwaiter : public Awaiter<R> {
+ public:
+  using Handle = std::coroutine_handle<AsyncGeneratorPromise<ValueType>>;
+
+  explicit AsyncGeneratorAwaiter(Handle generator) : generator(generator) {}
+
+  AsyncGeneratorAwaiter(AsyncGeneratorAwaiter &&other) noexcept
+      : Awaiter<R>(std::move(other)), generator(other.generator) {}
+
+  bool await_ready() const {
+    return generator.done();
+  }
+
+  bool await_suspend(std::coroutine_handle<> handle) {
+    using Promise = AsyncGeneratorPromise<ValueType>;
+    auto &promise = generator.promise();
+    promise.consumer = handle;
+    promise.executor = this->installed_executor();
+    promise.priority = this->installed_priority();
+    promise.handoff.store(Promise::kResuming, std::memory_order_relaxed);
+    generator.resume();
+    // fails if the generator has yielded, on this thread or on the executor of one of its awaits.
+    int expected = Promise::kResuming;
+    return promise.handoff.compare_exchange_strong(expected, Promise::kConsumerSuspended, std::memory_order_acq_rel);
+  }
+
+ protected:
+  Handle generator;
+};
+
+/**
+ * A coroutine that produces values with co_yield for one consumer, which pulls them with
+ * co_await next(), or with an iterator:
+ *
+ *   for (auto it = co_await generator.begin(); it != generator.end(); co_await ++it) { ... *it ... }
+ *
+ * Nothing is queued or locked: the consumer resumes the generator directly, it runs only while
+ * the consumer waits for its next value, and next() moves each yielded temporary straight out of
+ * its frame; yielded variables are copied. An exception thrown by the generator is rethrown to the
+ * consumer.
+ *
+ * The generator may co_await tasks, durations and awaiters, they resume it on the executor of the
+ * consumer. It must not be destroyed while it is suspended on one of them.
+ */
+template<typename ValueType>
+class AsyncGenerator {
+ public:
+  using promise_type = AsyncGeneratorPromise<ValueType>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  class Iterator {
+   public:
+    Iterator() = default;
+
+    explicit Iterator(Handle generator) : generator(generator) {}
+
+    std::remove_reference_t<ValueType> &operator*() const {
+      return *generator.promise().current;
+    }
+
+    std::remove_reference_t<ValueType> *operator->() const {
+      return generator.promise().current;
+    }
+
+    // the awaiter moves this iterator on, or to the end.
+    auto operator++() {
+      return AdvanceAwaiter(generator, this);
+    }
+
+    bool operator==(const Iterator &other) const = default;
+
+   private:
+    // the end iterator has none.
+    Handle generator = nullptr;
+  };
+
+  class NextAwaiter : public AsyncGeneratorAwaiter<ValueType, std::optional<std::remove_cvref_t<ValueType>>> {
+   public:
+    using ResultType = std::optional<std::remove_cvref_t<ValueType>>;
+
+    using AsyncGeneratorAwaiter<ValueType, ResultType>::AsyncGeneratorAwaiter;
+
+   protected:
+    void before_resume() override {
+      auto &promise = this->generator.promise();
+      promise.rethrow_if_failed();
+      if (!promise.current) {
+        this->_result.emplace(ResultType());
+        return;
+      }
+      // a move-only value can only be moved, even out of a variable of the generator.
+      if constexpr (std::is_copy_constructible_v<std::remove_cvref_t<ValueType>>) {
+        if (!promise.is_current_movable) {
+          this->_result.emplace(ResultType(*promise.current));
+          return;
+        }
+      }
+      this->_result.emplace(ResultType(std::move(*promise.current)));
+    }
+  };
+
+  class AdvanceAwaiter : public AsyncGeneratorAwaiter<ValueType, Iterator> {
+   public:
+    using ResultType = Iterator;
+
+    explicit AdvanceAwaiter(Handle generator, Iterator *iterator = nullptr)
+        : AsyncGeneratorAwaiter<ValueType, Iterator>(generator), iterator(iterator) {}
+
+    AdvanceAwaiter(AdvanceAwaiter &&other) noexcept
+        : AsyncGeneratorAwaiter<ValueType, Iterator>(std::move(other)), iterator(other.iterator) {}
+
+   protected:
+    void before_resume() override {
+      auto &promise = this->generator.promise();
+      promise.rethrow_if_failed();
+      auto next = promise.current ? Iterator(this->generator) : Iterator();
+      if (iterator) *iterator = next;
+      this->_result.emplace(next);
+    }
+
+   private:
+    Iterator *iterator;
+  };
+
+  explicit AsyncGenerator(Handle handle) noexcept: handle(handle) {}
+
+  AsyncGenerator(AsyncGenerator &&generator) noexcept: handle(std::exchange(generator.handle, nullptr)) {}
+
+  AsyncGenerator(AsyncGenerator &) = delete;
+
+  AsyncGenerator &operator=(AsyncGenerator &) = delete;
+
+  ~AsyncGenerator() {
+    if (handle) handle.destroy();
+  }
+
+  // the next value, or nullopt once the generator has completed.
+  NextAwaiter next() {
+    return NextAwaiter(handle);
+  }
+
+  AdvanceAwaiter begin() {
+    return AdvanceAwaiter(handle);
+  }
+
+  Iterator end() {
+    return Iterator();
+  }
+
+ private:
+  Handle handle;
+};
+
+#endif //CPPCOROUTINES_TASKS_04_TASK_ASYNCGENERATOR_H_
@@ -0,0 +1,372 @@
+//
+// Created by benny on 2022/4/18.
+//
+
+#ifndef CPPCOROUTINES_TASKS_10_SYNC_ASYNCMUTEX_H_
+#define CPPCOROUTINES_TASKS_10_SYNC_ASYNCMUTEX_H_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+#include "coroutine_common.h"
+#include "AsyncWaitQueue.h"
+#include "CommonAwaiter.h"
+
+class AsyncMutexLockAwaiter;
+class AsyncScopedLockAwaiter;
+
+/**
+ * A mutex for coroutines: co_await mutex.lock() suspends the coroutine instead of blocking its
+ * thread, and it is resumed through its executor once it holds the mutex. Unlike std::mutex it
+ * may be held across co_await and unlocked on another thread.
+ *
+ * Locking and unlocking without contention is a single atomic operation. Waiters hold the mutex
+ * in the order they came, the mutex is handed to the next one on unlock.
+ */
+class AsyncMutex {
+ public:
+  AsyncMutex() = default;
+
+  AsyncMutex(AsyncMutex &) = delete;
+
+  AsyncMutex &operator=(AsyncMutex &) = delete;
+
+  [[nodiscard]] bool try_lock() {
+    uint32_t expected = 0;
+    return state.compare_exchange_strong(expected, kLocked, std::memory_order_acquire, std::memory_order_relaxed);
+  }
+
+  // co_await mutex.lock(); ... mutex.unlock();
+  AsyncMutexLockAwaiter lock();
+
+  // auto guard = co_await mutex.scoped_lock(); unlocks when the guard goes out of scope.
+  AsyncScopedLockAwaiter scoped_lock();
+
+  void unlock() {
+    if (state.fetch_and(~kLocked, std::memory_order_release) & kQueued) {
+      serve_waiters();
+    }
+  }
+
+  // wakes waiter up once it holds the mutex.
+  void enqueue(AsyncWaiter *waiter) {
+    waiters.push(waiter);
+    serve_waiters();
+  }
+
+ private:
+  static constexpr uint32_t kLocked = 1;
+  static constexpr uint32_t kQueued = 2;
+
+  std::atomic<uint32_t> state{0};
+  AsyncWaitQueue waiters;
+
+  void serve_waiters() {
+    waiters.serve([this](auto &waiting, auto &woken) {
+      grant_in_order(state, kQueued, waiting, woken, [](uint32_t current, AsyncWaiter *) -> std::optional<uint32_t> {
+        if (current & kLocked) return std::nullopt;
+        return kLocked;
+      });
+    });
+  }
+};
+
+/**
+ * Unlocks its AsyncMutex when it goes out of scope, unless it has been unlocked or moved from.
+ */
+class AsyncLockGuard {
+ public:
+  AsyncLockGuard(AsyncMutex &mutex, std::adopt_lock_t) : mutex(&mutex) {}
+
+  AsyncLockGuard(AsyncLockGuard &&guard) noexcept : mutex(std::exchange(guard.mutex, nullptr)) {}
+
+  AsyncLockGuard &operator=(AsyncLockGuard &&guard) noexcept {
+    if (this != &guard) {
+      unlock();
+      mutex = std::exchange(guard.mutex, nullptr);
+    }
+    return *this;
+  }
+
+  AsyncLockGuard(AsyncLockGuard &) = delete;
+
+  AsyncLockGuard &operator=(AsyncLockGuard &) = delete;
+
+  ~AsyncLockGuard() {
+    unlock();
+  }
+
+  [[nodiscard]] bool owns_lock() const {
+    return mutex != nullptr;
+  }
+
+  void unlock() {
+    if (mutex) {
+      std::exchange(mutex, nullptr)->unlock();
+    }
+  }
+
+ private:
+  AsyncMutex *mutex;
+};
+
+class AsyncMutexLockAwaiter : public Awaiter<void>, public AsyncWaiter {
+ public:
+  explicit AsyncMutexLockAwaiter(AsyncMutex &mutex) : mutex(&mutex) {}
+
+  bool await_ready() {
+    if (mutex->try_lock()) {
+      _result = Result<void>();
+      return true;
+    }
+    return false;
+  }
+
+  void wake() override {
+    resume();
+  }
+
+ protected:
+  void after_suspend() override {
+    mutex->enqueue(this);
+  }
+
+ private:
+  AsyncMutex *mutex;
+};
+
+class AsyncScopedLockAwaiter : public Awaiter<AsyncLockGuard>, public AsyncWaiter {
+ public:
+  explicit AsyncScopedLockAwaiter(AsyncMutex &mutex) : mutex(&mutex) {}
+
+  bool await_ready() {
+    if (mutex->try_lock()) {
+      _result.emplace(AsyncLockGuard(*mutex, std::adopt_lock));
+      return true;
+    }
+    return false;
+  }
+
+  void wake() override {
+    resume(AsyncLockGuard(*mutex, std::adopt_lock));
+  }
+
+ protected:
+  void after_suspend() override {
+    mutex->enqueue(this);
+  }
+
+ private:
+  AsyncMutex *mutex;
+};
+
+inline AsyncMutexLockAwaiter AsyncMutex::lock() {
+  return AsyncMutexLockAwaiter(*this);
+}
+
+inline AsyncScopedLockAwaiter AsyncMutex::scoped_lock() {
+  return AsyncScopedLockAwaiter(*this);
+}
+
+class AsyncSharedLockAwaiter;
+
+/**
+ * A readers-writer lock for coroutines, with the uncontended paths of AsyncMutex. Once a writer
+ * waits, readers that come later wait behind it, so writers are not starved.
+ */
+class AsyncSharedMutex {
+ public:
+  AsyncSharedMutex() = default;
+
+  AsyncSharedMutex(AsyncSharedMutex &) = delete;
+
+  AsyncSharedMutex &operator=(AsyncSharedMutex &) = delete;
+
+  [[nodiscard]] bool try_lock() {
+    uint64_t expected = 0;
+    return state.compare_exchange_strong(expected, kWriter, std::memory_order_acquire, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] bool try_lock_shared() {
+    auto current = state.load(std::memory_order_relaxed);
+    while (!(current & (kWriter | kQueued))) {
+      if (state.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  AsyncSharedLockAwaiter lock();
+
+  AsyncSharedLockAwaiter lock_shared();
+
+  void unlock() {
+    if (state.fetch_and(~kWriter, std::memory_order_release) & kQueued) {
+      serve_waiters();
+    }
+  }
+
+  void unlock_shared() {
+    // only the last reader can let a waiter in.
+    auto previous = state.fetch_sub(1, std::memory_order_release);
+    if ((previous & kQueued) && (previous & kReaders) == 1) {
+      serve_waiters();
+    }
+  }
+
+  // wakes waiter up once it holds the lock, shared if its tag is kShared.
+  void enqueue(AsyncWaiter *waiter) {
+    waiters.push(waiter);
+    serve_waiters();
+  }
+
+  static constexpr uint64_t kShared = 1;
+
+ private:
+  static constexpr uint64_t kQueued = uint64_t(1) << 63;
+  static constexpr uint64_t kWriter = uint64_t(1) << 62;
+  static constexpr uint64_t kReaders = kWriter - 1;
+
+  // the readers holding the lock, or kWriter.
+  std::atomic<uint64_t> state{0};
+  AsyncWaitQueue waiters;
+
+  void serve_waiters() {
+    waiters.serve([this](auto &waiting, auto &woken) {
+      grant_in_order(state, kQueued, waiting, woken, [](uint64_t current, AsyncWaiter *waiter) -> std::optional<uint64_t> {
+        if (waiter->tag == kShared) {
+          if (current & kWriter) return std::nullopt;
+          return current + 1;
+        }
+        if (current != 0) return std::nullopt;
+        return kWriter;
+      });
+    });
+  }
+};
+
+class AsyncSharedLockAwaiter : public Awaiter<void>, public AsyncWaiter {
+ public:
+  AsyncSharedLockAwaiter(AsyncSharedMutex &mutex, bool is_shared) : mutex(&mutex) {
+    tag = is_shared ? AsyncSharedMutex::kShared : 0;
+  }
+
+  bool await_ready() {
+    if (tag == AsyncSharedMutex::kShared ? mutex->try_lock_shared() : mutex->try_lock()) {
+      _result = Result<void>();
+      return true;
+    }
+    return false;
+  }
+
+  void wake() override {
+    resume();
+  }
+
+ protected:
+  void after_suspend() override {
+    mutex->enqueue(this);
+  }
+
+ private:
+  AsyncSharedMutex *mutex;
+};
+
+inline AsyncSharedLockAwaiter AsyncSharedMutex::lock() {
+  return AsyncSharedLockAwaiter(*this, false);
+}
+
+inline AsyncSharedLockAwaiter AsyncSharedMutex::lock_shared() {
+  return AsyncSharedLockAwaiter(*this, true);
+}
+
+class AsyncConditionWaitAwaiter;
+
+/**
+ * A condition variable for coroutines holding an AsyncMutex. co_await condition.wait(mutex)
+ * unlocks the mutex while suspended and resumes the coroutine once it holds the mutex again. As
+ * with std::condition_variable, check the condition in a loop around the wait.
+ */
+class AsyncConditionVariable {
+ public:
+  AsyncConditionVariable() = default;
+
+  AsyncConditionVariable(AsyncConditionVariable &) = delete;
+
+  AsyncConditionVariable &operator=(AsyncConditionVariable &) = delete;
+
+  // the caller holds mutex.
+  AsyncConditionWaitAwaiter wait(AsyncMutex &mutex);
+
+  void notify_one() {
+    notifications.fetch_add(1, std::memory_order_relaxed);
+    serve_waiters();
+  }
+
+  void notify_all() {
+    is_notifying_all.store(true, std::memory_order_relaxed);
+    serve_waiters();
+  }
+
+  void enqueue(AsyncConditionWaitAwaiter *waiter);
+
+ private:
+  AsyncWaitQueue waiters;
+  std::atomic<size_t> notifications{0};
+  std::atomic<bool> is_notifying_all{false};
+
+  void serve_waiters();
+};
+
+class AsyncConditionWaitAwaiter : public Awaiter<void>, public AsyncWaiter {
+ public:
+  AsyncConditionWaitAwaiter(AsyncConditionVariable &condition, AsyncMutex &mutex)
+      : condition(&condition), mutex(&mutex) {}
+
+  // notified, waits for the mutex next.
+  void relock() {
+    mutex->enqueue(this);
+  }
+
+  void wake() override {
+    resume();
+  }
+
+ protected:
+  // a notify after the unlock finds the waiter.
+  void after_suspend() override {
+    condition->enqueue(this);
+    mutex->unlock();
+  }
+
+ private:
+  AsyncConditionVariable *condition;
+  AsyncMutex *mutex;
+};
+
+inline AsyncConditionWaitAwaiter AsyncConditionVariable::wait(AsyncMutex &mutex) {
+  return AsyncConditionWaitAwaiter(*this, mutex);
+}
+
+inline void AsyncConditionVariable::enqueue(AsyncConditionWaitAwaiter *waiter) {
+  waiters.push(waiter);
+}
+
+inline void AsyncConditionVariable::serve_waiters() {
+  waiters.serve([this](auto &waiting, auto &) {
+    // notifications without waiters are lost, like those of std::condition_variable.
+    auto count = notifications.exchange(0, std::memory_order_relaxed);
+    if (is_notifying_all.exchange(false, std::memory_order_relaxed)) {
+      count = waiting.size();
+    }
+    for (; count > 0 && !waiting.empty(); --count) {
+      static_cast<AsyncConditionWaitAwaiter *>(waiting.pop_front())->relock();
+    }
+  });
+}
+
+#endif //CPPCOROUTINES_TASKS_10_SYNC_ASYNCMUTEX_H_
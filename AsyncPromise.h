@@ -0,0 +1,160 @@
+//
+// Created by benny on 2022/4/15.
+//
+
+#ifndef CPPCOROUTINES_04_TASK_ASYNCPROMISE_H_
+#define CPPCOROUTINES_04_TASK_ASYNCPROMISE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "Result.h"
+
+/**
+ * Shared by an AsyncPromise and its AsyncFuture. waiter holds kEmpty, kReady or the awaiter of the
+ * future, whoever comes second of the result and the awaiter resumes it.
+ */
+template<typename R>
+struct AsyncFutureState {
+  static constexpr uintptr_t kEmpty = 0;
+  static constexpr uintptr_t kReady = 1;
+
+  std::atomic<uintptr_t> waiter{kEmpty};
+  std::optional<Result<R>> result;
+
+  void complete(Result<R> &&value) {
+    result.emplace(std::move(value));
+    auto previous = waiter.exchange(kReady, std::memory_order_acq_rel);
+    if (previous != kEmpty) {
+      reinterpret_cast<Awaiter<R> *>(previous)->resume_unsafe();
+    }
+  }
+
+  [[nodiscard]] bool is_ready() const {
+    return waiter.load(std::memory_order_acquire) == kReady;
+  }
+};
+
+template<typename R>
+class AsyncFutureAwaiter : public Awaiter<R> {
+ public:
+  explicit AsyncFutureAwaiter(std::shared_ptr<AsyncFutureState<R>> state) : state(std::move(state)) {}
+
+  AsyncFutureAwaiter(AsyncFutureAwaiter &&awaiter) noexcept
+      : Awaiter<R>(std::move(awaiter)), state(std::move(awaiter.state)) {}
+
+  bool await_ready() {
+    return state->is_ready();
+  }
+
+ protected:
+  void after_suspend() override {
+    auto expected = AsyncFutureState<R>::kEmpty;
+    auto self = reinterpret_cast<uintptr_t>(static_cast<Awaiter<R> *>(this));
+    if (!state->waiter.compare_exchange_strong(expected, self, std::memory_order_acq_rel)) {
+      // completed in the meantime.
+      this->resume_unsafe();
+    }
+  }
+
+  void before_resume() override {
+    this->_result = std::move(*state->result);
+  }
+
+ private:
+  std::shared_ptr<AsyncFutureState<R>> state;
+};
+
+/**
+ * The consumer side of an AsyncPromise, co_await future.get() resumes with its value or throws
+ * its exception. It can be awaited once.
+ */
+template<typename R>
+class AsyncFuture {
+ public:
+  explicit AsyncFuture(std::shared_ptr<AsyncFutureState<R>> state) : state(std::move(state)) {}
+
+  [[nodiscard]] AsyncFutureAwaiter<R> get() {
+    return AsyncFutureAwaiter<R>(std::move(state));
+  }
+
+  [[nodiscard]] bool valid() const {
+    return state != nullptr;
+  }
+
+  [[nodiscard]] bool is_ready() const {
+    return state && state->is_ready();
+  }
+
+ private:
+  std::shared_ptr<AsyncFutureState<R>> state;
+};
+
+/**
+ * Like std::promise, but its future is awaited by a coroutine: setting the value resumes the
+ * awaiter right away through its executor, nothing blocks or polls. Destroying the promise
+ * without a value completes the future with std::future_errc::broken_promise.
+ */
+template<typename R>
+class AsyncPromise {
+ public:
+  AsyncPromise() : state(std::make_shared<AsyncFutureState<R>>()) {}
+
+  AsyncPromise(AsyncPromise &&promise) noexcept
+      : state(std::move(promise.state)), is_future_retrieved(promise.is_future_retrieved),
+        is_satisfied(promise.is_satisfied) {}
+
+  AsyncPromise(AsyncPromise &) = delete;
+
+  AsyncPromise &operator=(AsyncPromise &) = delete;
+
+  ~AsyncPromise() {
+    if (state && !is_satisfied) {
+      state->complete(Result<R>(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise))));
+    }
+  }
+
+  AsyncFuture<R> get_future() {
+    if (std::exchange(is_future_retrieved, true)) {
+      throw std::future_error(std::future_errc::future_already_retrieved);
+    }
+    return AsyncFuture<R>(state);
+  }
+
+  template<typename T = R>
+  requires (!std::is_void_v<T>)
+  void set_value(T value) {
+    satisfy();
+    state->complete(Result<R>(std::move(value)));
+  }
+
+  void set_value() requires std::is_void_v<R> {
+    satisfy();
+    state->complete(Result<void>());
+  }
+
+  void set_exception(std::exception_ptr exception) {
+    satisfy();
+    state->complete(Result<R>(std::move(exception)));
+  }
+
+ private:
+  std::shared_ptr<AsyncFutureState<R>> state;
+  bool is_future_retrieved = false;
+  bool is_satisfied = false;
+
+  void satisfy() {
+    if (std::exchange(is_satisfied, true)) {
+      throw std::future_error(std::future_errc::promise_already_satisfied);
+    }
+  }
+};
+
+#endif //CPPCOROUTINES_04_TASK_ASYNCPROMISE_H_
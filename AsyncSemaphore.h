@@ -0,0 +1,280 @@
+//
+// Created by benny on 2022/4/18.
+//
+
+#ifndef CPPCOROUTINES_TASKS_10_SYNC_ASYNCSEMAPHORE_H_
+#define CPPCOROUTINES_TASKS_10_SYNC_ASYNCSEMAPHORE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "coroutine_common.h"
+#include "AsyncWaitQueue.h"
+#include "CommonAwaiter.h"
+
+class AsyncSemaphoreAwaiter;
+
+/**
+ * A counting semaphore for coroutines: co_await semaphore.acquire() takes a permit or suspends
+ * until release() hands one over, in the order the coroutines came. Without contention acquire
+ * and release are a single atomic operation.
+ */
+class AsyncSemaphore {
+ public:
+  explicit AsyncSemaphore(uint64_t permits = 0) : state(permits) {}
+
+  AsyncSemaphore(AsyncSemaphore &) = delete;
+
+  AsyncSemaphore &operator=(AsyncSemaphore &) = delete;
+
+  [[nodiscard]] bool try_acquire() {
+    auto current = state.load(std::memory_order_relaxed);
+    // nobody may take a permit past the waiters.
+    while (current != 0 && !(current & kQueued)) {
+      if (state.compare_exchange_weak(current, current - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  AsyncSemaphoreAwaiter acquire();
+
+  void release(uint64_t permits = 1) {
+    if (state.fetch_add(permits, std::memory_order_release) & kQueued) {
+      serve_waiters();
+    }
+  }
+
+  // free permits, 0 while coroutines wait.
+  [[nodiscard]] uint64_t available() const {
+    auto current = state.load(std::memory_order_relaxed);
+    return current & kQueued ? 0 : current;
+  }
+
+  // wakes waiter up once it holds a permit.
+  void enqueue(AsyncWaiter *waiter) {
+    waiters.push(waiter);
+    serve_waiters();
+  }
+
+ private:
+  static constexpr uint64_t kQueued = uint64_t(1) << 63;
+
+  // the free permits.
+  std::atomic<uint64_t> state;
+  AsyncWaitQueue waiters;
+
+  void serve_waiters() {
+    waiters.serve([this](auto &waiting, auto &woken) {
+      grant_in_order(state, kQueued, waiting, woken, [](uint64_t current, AsyncWaiter *) -> std::optional<uint64_t> {
+        if (current == 0) return std::nullopt;
+        return current - 1;
+      });
+    });
+  }
+};
+
+class AsyncSemaphoreAwaiter : public Awaiter<void>, public AsyncWaiter {
+ public:
+  explicit AsyncSemaphoreAwaiter(AsyncSemaphore &semaphore) : semaphore(&semaphore) {}
+
+  bool await_ready() {
+    if (semaphore->try_acquire()) {
+      _result = Result<void>();
+      return true;
+    }
+    return false;
+  }
+
+  void wake() override {
+    resume();
+  }
+
+ protected:
+  void after_suspend() override {
+    semaphore->enqueue(this);
+  }
+
+ private:
+  AsyncSemaphore *semaphore;
+};
+
+inline AsyncSemaphoreAwaiter AsyncSemaphore::acquire() {
+  return AsyncSemaphoreAwaiter(*this);
+}
+
+class AsyncLatchAwaiter;
+
+/**
+ * A single-use countdown: co_await latch.wait() resumes once count_down has been called as often
+ * as the latch was created with. Waiting on an open latch does not suspend.
+ */
+class AsyncLatch {
+ public:
+  explicit AsyncLatch(ptrdiff_t expected) : count(expected) {}
+
+  AsyncLatch(AsyncLatch &) = delete;
+
+  AsyncLatch &operator=(AsyncLatch &) = delete;
+
+  void count_down(ptrdiff_t n = 1) {
+    // wakes the waiters when this call opens the latch, even if it counts down past zero.
+    auto previous = count.fetch_sub(n, std::memory_order_acq_rel);
+    if (previous > 0 && previous <= n) {
+      serve_waiters();
+    }
+  }
+
+  [[nodiscard]] bool try_wait() const {
+    return count.load(std::memory_order_acquire) <= 0;
+  }
+
+  AsyncLatchAwaiter wait();
+
+  // count_down, then wait.
+  AsyncLatchAwaiter arrive_and_wait(ptrdiff_t n = 1);
+
+  void enqueue(AsyncWaiter *waiter) {
+    waiters.push(waiter);
+    serve_waiters();
+  }
+
+ private:
+  std::atomic<ptrdiff_t> count;
+  AsyncWaitQueue waiters;
+
+  void serve_waiters() {
+    waiters.serve([this](auto &waiting, auto &woken) {
+      if (try_wait()) {
+        while (auto waiter = waiting.pop_front()) {
+          woken.push_back(waiter);
+        }
+      }
+    });
+  }
+};
+
+class AsyncLatchAwaiter : public Awaiter<void>, public AsyncWaiter {
+ public:
+  explicit AsyncLatchAwaiter(AsyncLatch &latch) : latch(&latch) {}
+
+  bool await_ready() {
+    if (latch->try_wait()) {
+      _result = Result<void>();
+      return true;
+    }
+    return false;
+  }
+
+  void wake() override {
+    resume();
+  }
+
+ protected:
+  void after_suspend() override {
+    latch->enqueue(this);
+  }
+
+ private:
+  AsyncLatch *latch;
+};
+
+inline AsyncLatchAwaiter AsyncLatch::wait() {
+  return AsyncLatchAwaiter(*this);
+}
+
+inline AsyncLatchAwaiter AsyncLatch::arrive_and_wait(ptrdiff_t n) {
+  count_down(n);
+  return wait();
+}
+
+class AsyncBarrierAwaiter;
+
+/**
+ * A reusable barrier for a fixed number of coroutines: each co_await barrier.arrive_and_wait()
+ * resumes once all of them have arrived, then the next phase begins. The last one to arrive
+ * does not suspend.
+ */
+class AsyncBarrier {
+ public:
+  explicit AsyncBarrier(uint32_t expected) : expected(expected) {}
+
+  AsyncBarrier(AsyncBarrier &) = delete;
+
+  AsyncBarrier &operator=(AsyncBarrier &) = delete;
+
+  AsyncBarrierAwaiter arrive_and_wait();
+
+  // the phase of the arrival, true for the last one, which has begun the next phase.
+  bool arrive(uint64_t &phase) {
+    auto previous = state.fetch_add(1, std::memory_order_acq_rel);
+    phase = previous >> 32;
+    if ((previous & kArrived) + 1 < expected) {
+      return false;
+    }
+    // nobody arrives for the next phase before the waiters of this one are woken.
+    state.store((phase + 1) << 32, std::memory_order_release);
+    serve_waiters();
+    return true;
+  }
+
+  // wakes waiter up once the phase in its tag is over.
+  void enqueue(AsyncWaiter *waiter) {
+    waiters.push(waiter);
+    serve_waiters();
+  }
+
+ private:
+  static constexpr uint64_t kArrived = 0xffffffff;
+
+  uint64_t expected;
+  // the phase in the high half, the coroutines arrived in it in the low one.
+  std::atomic<uint64_t> state{0};
+  AsyncWaitQueue waiters;
+
+  void serve_waiters() {
+    waiters.serve([this](auto &waiting, auto &woken) {
+      auto phase = state.load(std::memory_order_acquire) >> 32;
+      waiting.for_each([&](AsyncWaiter *waiter) {
+        if (waiter->tag != phase) {
+          waiting.remove(waiter);
+          woken.push_back(waiter);
+        }
+      });
+    });
+  }
+};
+
+class AsyncBarrierAwaiter : public Awaiter<void>, public AsyncWaiter {
+ public:
+  explicit AsyncBarrierAwaiter(AsyncBarrier &barrier) : barrier(&barrier) {}
+
+  bool await_ready() {
+    if (barrier->arrive(tag)) {
+      _result = Result<void>();
+      return true;
+    }
+    return false;
+  }
+
+  void wake() override {
+    resume();
+  }
+
+ protected:
+  void after_suspend() override {
+    barrier->enqueue(this);
+  }
+
+ private:
+  AsyncBarrier *barrier;
+};
+
+inline AsyncBarrierAwaiter AsyncBarrier::arrive_and_wait() {
+  return AsyncBarrierAwaiter(*this);
+}
+
+#endif //CPPCOROUTINES_TASKS_10_SYNC_ASYNCSEMAPHORE_H_
@@ -0,0 +1,132 @@
+//
+// Created by benny on 2022/4/18.
+//
+
+#ifndef CPPCOROUTINES_TASKS_10_SYNC_ASYNCWAITQUEUE_H_
+#define CPPCOROUTINES_TASKS_10_SYNC_ASYNCWAITQUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "IntrusiveList.h"
+
+/**
+ * A coroutine suspended in an async synchronization primitive.
+ */
+struct AsyncWaiter : IntrusiveListNode<AsyncWaiter> {
+  // up to the primitive: whether a lock is shared, the phase of a barrier.
+  uint64_t tag = 0;
+
+  virtual void wake() = 0;
+
+ protected:
+  ~AsyncWaiter() = default;
+};
+
+/**
+ * Waiters of an async synchronization primitive. Any thread pushes a waiter onto a lock-free
+ * stack, and one thread at a time serves them: it moves the stack, oldest first, to the end of a
+ * FIFO list that only the serving thread touches. Popping single waiters off a shared stack is
+ * prone to ABA, taking all of them at once is not.
+ */
+class AsyncWaitQueue {
+ public:
+  AsyncWaitQueue() = default;
+
+  AsyncWaitQueue(AsyncWaitQueue &) = delete;
+
+  AsyncWaitQueue &operator=(AsyncWaitQueue &) = delete;
+
+  // from any thread, the waiter is seen by the next serve.
+  void push(AsyncWaiter *waiter) {
+    auto head = incoming.load(std::memory_order_relaxed);
+    do {
+      waiter->next = head;
+    } while (!incoming.compare_exchange_weak(head, waiter, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  /**
+   * Calls serve(waiting, woken) with the pushed waiters appended to waiting; serve moves the
+   * waiters it lets in to woken. A call while another thread is serving returns right away, that
+   * thread calls serve once more for it. The woken waiters are resumed after the last call, once
+   * the primitive is not touched anymore: a resumed coroutine may destroy it.
+   */
+  template<typename Serve>
+  void serve(Serve &&serve) {
+    if (serve_requests.fetch_add(1, std::memory_order_acq_rel) != 0) {
+      return;
+    }
+    IntrusiveList<AsyncWaiter> woken;
+    size_t requests = 1;
+    do {
+      take_incoming();
+      serve(waiting, woken);
+      requests = serve_requests.fetch_sub(requests, std::memory_order_acq_rel) - requests;
+    } while (requests != 0);
+    while (auto waiter = woken.pop_front()) {
+      waiter->wake();
+    }
+  }
+
+ private:
+  std::atomic<AsyncWaiter *> incoming{nullptr};
+  std::atomic<size_t> serve_requests{0};
+  IntrusiveList<AsyncWaiter> waiting;
+
+  void take_incoming() {
+    auto waiter = incoming.exchange(nullptr, std::memory_order_acquire);
+    // the stack is newest first.
+    AsyncWaiter *oldest = nullptr;
+    while (waiter) {
+      auto next = waiter->next;
+      waiter->next = oldest;
+      oldest = waiter;
+      waiter = next;
+    }
+    while (oldest) {
+      auto next = oldest->next;
+      waiting.push_back(oldest);
+      oldest = next;
+    }
+  }
+};
+
+/**
+ * Lets the waiting waiters in, in order, as long as grant(state, front) returns the state with the
+ * front waiter let in. queued_bit is set in the state while waiters are left: newcomers cannot
+ * take the state past them, and whoever releases the state has to serve the queue.
+ */
+template<typename State, typename Grant>
+void grant_in_order(std::atomic<State> &state, State queued_bit,
+                    IntrusiveList<AsyncWaiter> &waiting, IntrusiveList<AsyncWaiter> &woken, Grant &&grant) {
+  auto current = state.load(std::memory_order_relaxed);
+  while (true) {
+    auto waiter = waiting.front();
+    if (!waiter) {
+      if (!(current & queued_bit)
+          || state.compare_exchange_weak(current, current & ~queued_bit, std::memory_order_acq_rel)) {
+        return;
+      }
+      continue;
+    }
+    std::optional<State> granted = grant(static_cast<State>(current & ~queued_bit), waiter);
+    if (!granted) {
+      // the release that lets the waiter in sees the bit and serves again.
+      if ((current & queued_bit)
+          || state.compare_exchange_weak(current, current | queued_bit, std::memory_order_acq_rel)) {
+        return;
+      }
+      continue;
+    }
+    auto desired = waiting.size() > 1 ? static_cast<State>(*granted | queued_bit) : *granted;
+    if (state.compare_exchange_weak(current, desired, std::memory_order_acq_rel)) {
+      woken.push_back(waiting.pop_front());
+      current = desired;
+    }
+  }
+}
+
+#endif //CPPCOROUTINES_TASKS_10_SYNC_ASYNCWAITQUEUE_H_
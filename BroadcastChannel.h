@@ -0,0 +1,432 @@
+//
+// Created by benny on 2022/4/19.
+//
+
+#ifndef CPPCOROUTINES_TASKS_07_CHANNEL_BROADCASTCHANNEL_H_
+#define CPPCOROUTINES_TASKS_07_CHANNEL_BROADCASTCHANNEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "IntrusiveList.h"
+
+// what a BroadcastChannel does when its slowest subscriber is a whole ring behind.
+enum class BroadcastOverflow {
+  // writers wait until every subscriber has read the oldest value.
+  kBackpressure,
+  // writers overwrite it, subscribers that had not read it skip ahead.
+  kLag,
+};
+
+template<typename ValueType>
+class BroadcastChannel;
+
+template<typename ValueType>
+class BroadcastSubscriber;
+
+template<typename ValueType>
+struct BroadcastSlot {
+  // position + 1 of the value held, 0 while it is being replaced.
+  std::atomic<uint64_t> sequence{0};
+  // kLag: subscribers copying the value, the writer waits for them before replacing it.
+  std::atomic<uint32_t> pins{0};
+  // kBackpressure: subscribers yet to read the value, the slot is free at 0.
+  std::atomic<uint32_t> remaining{0};
+  std::shared_ptr<const ValueType> value;
+};
+
+template<typename ValueType>
+struct BroadcastWriteAwaiter : public Awaiter<void>, IntrusiveListNode<BroadcastWriteAwaiter<ValueType>> {
+  BroadcastChannel<ValueType> *channel;
+  std::shared_ptr<const ValueType> _value;
+
+  BroadcastWriteAwaiter(BroadcastChannel<ValueType> *channel, std::shared_ptr<const ValueType> &&value)
+      : channel(channel), _value(std::move(value)) {}
+
+  BroadcastWriteAwaiter(BroadcastWriteAwaiter &&other) noexcept
+      : Awaiter(other), channel(std::exchange(other.channel, nullptr)), _value(std::move(other._value)) {}
+
+  bool await_ready() {
+    if (channel->try_write(_value)) {
+      _result = Result<void>();
+      return true;
+    }
+    return false;
+  }
+
+  void after_suspend() override {
+    channel->push_writer(this);
+  }
+
+  void before_resume() override {
+    channel = nullptr;
+  }
+
+  ~BroadcastWriteAwaiter() {
+    if (channel) channel->remove_writer(this);
+  }
+};
+
+template<typename ValueType>
+struct BroadcastReceiveAwaiter
+    : public Awaiter<std::shared_ptr<const ValueType>>, IntrusiveListNode<BroadcastReceiveAwaiter<ValueType>> {
+  BroadcastSubscriber<ValueType> *subscriber;
+  bool is_waiting = false;
+
+  explicit BroadcastReceiveAwaiter(BroadcastSubscriber<ValueType> *subscriber) : subscriber(subscriber) {}
+
+  BroadcastReceiveAwaiter(BroadcastReceiveAwaiter &&other) noexcept
+      : Awaiter<std::shared_ptr<const ValueType>>(std::move(other)), subscriber(other.subscriber) {}
+
+  bool await_ready() {
+    if (auto value = subscriber->try_read()) {
+      this->_result.emplace(std::move(*value));
+      return true;
+    }
+    return false;
+  }
+
+  void after_suspend() override {
+    subscriber->channel->push_reader(this);
+  }
+
+  ~BroadcastReceiveAwaiter() {
+    if (is_waiting) subscriber->channel->remove_reader(this);
+  }
+};
+
+/**
+ * Reads a BroadcastChannel from its own cursor, every value written after it subscribed. The
+ * values are shared with the other subscribers, nothing is copied per subscriber. One coroutine
+ * at a time may read from a subscriber.
+ */
+template<typename ValueType>
+class BroadcastSubscriber {
+ public:
+  using Reader = BroadcastReceiveAwaiter<ValueType>;
+
+  BroadcastSubscriber(BroadcastChannel<ValueType> *channel, uint64_t cursor) : channel(channel), cursor(cursor) {}
+
+  BroadcastSubscriber(BroadcastSubscriber &&other) noexcept
+      : channel(std::exchange(other.channel, nullptr)), cursor(other.cursor), skipped_count(other.skipped_count) {}
+
+  BroadcastSubscriber(BroadcastSubscriber &) = delete;
+
+  BroadcastSubscriber &operator=(BroadcastSubscriber &) = delete;
+
+  ~BroadcastSubscriber() {
+    if (channel) channel->unsubscribe(cursor);
+  }
+
+  // resumes with the next value, throws ChannelClosedException once the channel is closed and read up.
+  auto read() {
+    return Reader{this};
+  }
+
+  std::optional<std::shared_ptr<const ValueType>> try_read() {
+    return channel->read_at(cursor, skipped_count);
+  }
+
+  // values overwritten before this subscriber read them, kLag only.
+  [[nodiscard]] uint64_t skipped() const {
+    return skipped_count;
+  }
+
+ private:
+  friend struct BroadcastReceiveAwaiter<ValueType>;
+  friend class BroadcastChannel<ValueType>;
+
+  BroadcastChannel<ValueType> *channel;
+  uint64_t cursor;
+  uint64_t skipped_count = 0;
+};
+
+/**
+ * A channel whose values go to every subscriber. Writers append to one ring buffer shared by all
+ * subscribers, each of them reads it from its own cursor, so a write costs the same however many
+ * subscribers there are; only subscribers waiting for it are resumed by the writer. Values are
+ * stored once, as shared_ptr<const ValueType>.
+ *
+ * Writers are serialized by a lock, subscribers read without it unless they have to wait.
+ * A subscriber a whole ring behind makes writers wait, or skip values, see BroadcastOverflow.
+ * The capacity is rounded up to a power of two.
+ */
+template<typename ValueType>
+class BroadcastChannel {
+ public:
+  using Value = std::shared_ptr<const ValueType>;
+  using Writer = BroadcastWriteAwaiter<ValueType>;
+  using Reader = BroadcastReceiveAwaiter<ValueType>;
+
+  struct ChannelClosedException : std::exception {
+    const char *what() const noexcept override {
+      return "Channel is closed.";
+    }
+  };
+
+  explicit BroadcastChannel(size_t capacity, BroadcastOverflow overflow = BroadcastOverflow::kBackpressure)
+      : capacity(std::bit_ceil(std::max<size_t>(capacity, 1))), overflow(overflow),
+        slots(new BroadcastSlot<ValueType>[this->capacity]) {}
+
+  BroadcastChannel(BroadcastChannel &&channel) = delete;
+
+  BroadcastChannel(BroadcastChannel &) = delete;
+
+  BroadcastChannel &operator=(BroadcastChannel &) = delete;
+
+  // subscribers must be destroyed before the channel.
+  ~BroadcastChannel() {
+    close();
+  }
+
+  void check_closed() {
+    if (!_is_active.load(std::memory_order_relaxed)) {
+      throw ChannelClosedException();
+    }
+  }
+
+  // reads every value written from now on.
+  BroadcastSubscriber<ValueType> subscribe() {
+    std::lock_guard lock(channel_lock);
+    ++subscriber_count;
+    return BroadcastSubscriber<ValueType>(this, tail.load(std::memory_order_relaxed));
+  }
+
+  auto write(ValueType value) {
+    return write(std::make_shared<const ValueType>(std::move(value)));
+  }
+
+  auto write(Value value) {
+    check_closed();
+    return Writer{this, std::move(value)};
+  }
+
+  auto operator<<(ValueType value) {
+    return write(std::move(value));
+  }
+
+  // moves value into the ring unless writers wait or, with kBackpressure, the ring is full.
+  bool try_write(Value &value) {
+    std::unique_lock lock(channel_lock);
+    check_closed();
+    if (!writer_list.empty() || !publish(value)) {
+      return false;
+    }
+    wake_readers(lock);
+    return true;
+  }
+
+  void close() {
+    std::unique_lock lock(channel_lock);
+    bool expect = true;
+    if (!_is_active.compare_exchange_strong(expect, false, std::memory_order_relaxed)) {
+      return;
+    }
+    auto writers = std::move(writer_list);
+    auto readers = std::move(reader_list);
+    writer_waiting.store(false, std::memory_order_relaxed);
+    lock.unlock();
+
+    while (auto writer = writers.pop_front()) {
+      writer->resume_exception(std::make_exception_ptr(ChannelClosedException()));
+    }
+    while (auto reader = readers.pop_front()) {
+      reader->is_waiting = false;
+      serve_reader(reader);
+    }
+  }
+
+  [[nodiscard]] bool is_active() const {
+    return _is_active.load(std::memory_order_relaxed);
+  }
+
+  void push_writer(Writer *writer) {
+    std::unique_lock lock(channel_lock);
+    if (!is_active()) {
+      lock.unlock();
+      writer->resume_exception(std::make_exception_ptr(ChannelClosedException()));
+      return;
+    }
+    writer_list.push_back(writer);
+    writer_waiting.store(true, std::memory_order_relaxed);
+    // pairs with the fence in read_at: either we see the slot freed or the reader sees us waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    transfer(lock);
+  }
+
+  void push_reader(Reader *reader) {
+    serve_reader(reader);
+  }
+
+  void remove_writer(Writer *writer) {
+    std::lock_guard lock(channel_lock);
+    writer_list.remove(writer);
+    writer_waiting.store(!writer_list.empty(), std::memory_order_relaxed);
+  }
+
+  void remove_reader(Reader *reader) {
+    std::lock_guard lock(channel_lock);
+    reader_list.remove(reader);
+  }
+
+  // the next value at cursor for a subscriber, which moves past it.
+  std::optional<Value> read_at(uint64_t &cursor, uint64_t &skipped) {
+    if (overflow == BroadcastOverflow::kBackpressure) {
+      auto &slot = slots[cursor & (capacity - 1)];
+      if (slot.sequence.load(std::memory_order_acquire) != cursor + 1) {
+        return std::nullopt;
+      }
+      auto value = slot.value;
+      ++cursor;
+      if (slot.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writer_waiting.load(std::memory_order_relaxed)) {
+          std::unique_lock lock(channel_lock);
+          transfer(lock);
+        }
+      }
+      return value;
+    }
+
+    while (true) {
+      auto &slot = slots[cursor & (capacity - 1)];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence == cursor + 1) {
+        // pairs with the writer, which clears the sequence before it checks the pins.
+        slot.pins.fetch_add(1, std::memory_order_seq_cst);
+        if (slot.sequence.load(std::memory_order_seq_cst) == sequence) {
+          auto value = slot.value;
+          slot.pins.fetch_sub(1, std::memory_order_release);
+          ++cursor;
+          return value;
+        }
+        slot.pins.fetch_sub(1, std::memory_order_release);
+      }
+      auto written = tail.load(std::memory_order_acquire);
+      if (written <= cursor) {
+        return std::nullopt;
+      }
+      // the value at cursor has been overwritten, skip to the oldest one left.
+      auto oldest = written > capacity ? std::max(cursor + 1, written - capacity) : cursor + 1;
+      skipped += oldest - cursor;
+      cursor = oldest;
+    }
+  }
+
+  void unsubscribe(uint64_t cursor) {
+    std::unique_lock lock(channel_lock);
+    --subscriber_count;
+    if (overflow != BroadcastOverflow::kBackpressure) {
+      return;
+    }
+    // the values it has not read no longer wait for it.
+    bool has_freed = false;
+    for (auto end = tail.load(std::memory_order_relaxed); cursor < end; ++cursor) {
+      if (slots[cursor & (capacity - 1)].remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        has_freed = true;
+      }
+    }
+    if (has_freed && !writer_list.empty()) {
+      transfer(lock);
+    }
+  }
+
+ private:
+  size_t capacity;
+  BroadcastOverflow overflow;
+  std::unique_ptr<BroadcastSlot<ValueType>[]> slots;
+
+  // the position of the next value, only written with channel_lock held.
+  alignas(64) std::atomic<uint64_t> tail{0};
+  std::atomic<bool> writer_waiting{false};
+  std::atomic<bool> _is_active{true};
+
+  std::mutex channel_lock;
+  uint32_t subscriber_count = 0;
+  IntrusiveList<Writer> writer_list;
+  IntrusiveList<Reader> reader_list;
+
+  // with channel_lock held.
+  bool publish(Value &value) {
+    auto position = tail.load(std::memory_order_relaxed);
+    auto &slot = slots[position & (capacity - 1)];
+    if (overflow == BroadcastOverflow::kBackpressure) {
+      if (slot.remaining.load(std::memory_order_acquire) != 0) {
+        return false;
+      }
+    } else {
+      slot.sequence.store(0, std::memory_order_seq_cst);
+      // a subscriber copies the shared_ptr, it does not take long.
+      while (slot.pins.load(std::memory_order_seq_cst) != 0) {
+        std::this_thread::yield();
+      }
+    }
+    slot.value = std::move(value);
+    slot.remaining.store(subscriber_count, std::memory_order_relaxed);
+    slot.sequence.store(position + 1, std::memory_order_release);
+    tail.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // resumes the subscriber with its next value, or leaves it waiting until one is written.
+  void serve_reader(Reader *reader) {
+    while (true) {
+      if (auto value = reader->subscriber->try_read()) {
+        reader->resume(std::move(*value));
+        return;
+      }
+      std::unique_lock lock(channel_lock);
+      if (tail.load(std::memory_order_relaxed) > reader->subscriber->cursor) {
+        // written in the meantime.
+        continue;
+      }
+      if (!is_active()) {
+        lock.unlock();
+        reader->resume_exception(std::make_exception_ptr(ChannelClosedException()));
+        return;
+      }
+      reader->is_waiting = true;
+      reader_list.push_back(reader);
+      return;
+    }
+  }
+
+  // with channel_lock held, which it releases: waiting subscribers have values to read now.
+  void wake_readers(std::unique_lock<std::mutex> &lock) {
+    auto readers = std::move(reader_list);
+    lock.unlock();
+    while (auto reader = readers.pop_front()) {
+      reader->is_waiting = false;
+      serve_reader(reader);
+    }
+  }
+
+  // with channel_lock held, which it releases: writes the values of waiting writers while there is room.
+  void transfer(std::unique_lock<std::mutex> &lock) {
+    IntrusiveList<Writer> resumed_writers;
+    while (!writer_list.empty() && publish(writer_list.front()->_value)) {
+      resumed_writers.push_back(writer_list.pop_front());
+    }
+    writer_waiting.store(!writer_list.empty(), std::memory_order_relaxed);
+    if (resumed_writers.empty()) {
+      lock.unlock();
+      return;
+    }
+    wake_readers(lock);
+    while (auto writer = resumed_writers.pop_front()) {
+      writer->resume();
+    }
+  }
+};
+
+#endif //CPPCOROUTINES_TASKS_07_CHANNEL_BROADCASTCHANNEL_H_
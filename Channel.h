@@ -8,6 +8,11 @@
 #include "coroutine_common.h"
 #include "ChannelAwaiter.h"
 #include <exception>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <span>
 
 template<typename ValueType>
 struct Channel {
@@ -24,75 +29,42 @@ struct Channel {
     }
   }
 
-  void try_push_reader(ReaderAwaiter<ValueType> *reader_awaiter) {
+  void try_push_reader(PendingReader<ValueType> *reader) {
     std::unique_lock lock(channel_lock);
     check_closed();
 
-    if (!buffer.empty()) {
-      auto value = buffer.front();
-      buffer.pop();
-
-      if (!writer_list.empty()) {
-        auto writer = writer_list.front();
-        writer_list.pop_front();
-        buffer.push(writer->_value);
-        lock.unlock();
-
-        writer->resume();
-      } else {
-        lock.unlock();
-      }
-
-      reader_awaiter->resume(value);
-      return;
-    }
-
-    if (!writer_list.empty()) {
-      auto writer = writer_list.front();
-      writer_list.pop_front();
-      lock.unlock();
-
-      reader_awaiter->resume(writer->_value);
-      writer->resume();
-      return;
+    serve_reader(reader);
+    if (reader->missing() > 0) {
+      reader_list.push_back(reader);
+      reader = nullptr;
     }
+    wake_up(lock);
 
-    reader_list.push_back(reader_awaiter);
+    if (reader) reader->wake();
   }
 
-  void try_push_writer(WriterAwaiter<ValueType> *writer_awaiter) {
+  void try_push_writer(PendingWriter<ValueType> *writer) {
     std::unique_lock lock(channel_lock);
     check_closed();
-    // suspended readers
-    if (!reader_list.empty()) {
-      auto reader = reader_list.front();
-      reader_list.pop_front();
-      lock.unlock();
-
-      reader->resume(writer_awaiter->_value);
-      writer_awaiter->resume();
-      return;
-    }
 
-    // write to buffer
-    if (buffer.size() < buffer_capacity) {
-      buffer.push(writer_awaiter->_value);
-      lock.unlock();
-      writer_awaiter->resume();
-      return;
+    serve_writer(writer);
+    // suspend writer
+    if (writer->remaining() > 0) {
+      writer_list.push_back(writer);
+      writer = nullptr;
     }
+    wake_up(lock);
 
-    // suspend writer
-    writer_list.push_back(writer_awaiter);
+    if (writer) writer->wake();
   }
 
-  void remove_writer(WriterAwaiter<ValueType> *writer_awaiter) {
+  void remove_writer(PendingWriter<ValueType> *writer_awaiter) {
     std::lock_guard lock(channel_lock);
     auto size = writer_list.remove(writer_awaiter);
     debug("remove writer ", size);
   }
 
-  void remove_reader(ReaderAwaiter<ValueType> *reader_awaiter) {
+  void remove_reader(PendingReader<ValueType> *reader_awaiter) {
     std::lock_guard lock(channel_lock);
     auto size = reader_list.remove(reader_awaiter);
     debug("remove reader ", size);
@@ -100,11 +72,11 @@ struct Channel {
 
   auto write(ValueType value){
     check_closed();
-    return WriterAwaiter<ValueType>{this, value};
+    return WriterAwaiter<ValueType>{this, std::move(value)};
   }
 
   auto operator<<(ValueType value) {
-    return write(value);
+    return write(std::move(value));
   }
 
   auto read(){
@@ -118,6 +90,67 @@ struct Channel {
     return awaiter;
   }
 
+  auto write_many(std::span<ValueType> values) {
+    check_closed();
+    return ManyWriterAwaiter<ValueType>{this, values};
+  }
+
+  auto read_many(std::span<ValueType> out, size_t min_count = 1) {
+    check_closed();
+    return ManyReaderAwaiter<ValueType>{this, out, min_count};
+  }
+
+  // waiters satisfied under channel_lock, woken up after releasing it.
+  struct ResumedWaiters {
+    IntrusiveList<PendingWriter<ValueType>> writers;
+    IntrusiveList<PendingReader<ValueType>> readers;
+
+    void wake() {
+      while (auto writer = writers.pop_front()) {
+        writer->wake();
+      }
+      while (auto reader = readers.pop_front()) {
+        reader->wake();
+      }
+    }
+  };
+
+  // select support, see Select.h. A select holds the locks of all of its channels while it
+  // looks for a ready case and registers the others, so its own waiters need no claim.
+  std::mutex &select_mutex() {
+    return channel_lock;
+  }
+
+  // with select_mutex held: true if the read completed, or cannot complete since the channel is closed.
+  bool try_read_locked(PendingReader<ValueType> *reader) {
+    if (!is_active()) {
+      return true;
+    }
+    serve_reader(reader);
+    return reader->missing() == 0;
+  }
+
+  bool try_write_locked(PendingWriter<ValueType> *writer) {
+    if (!is_active()) {
+      return true;
+    }
+    serve_writer(writer);
+    return writer->remaining() == 0;
+  }
+
+  void push_reader_locked(PendingReader<ValueType> *reader) {
+    reader_list.push_back(reader);
+  }
+
+  void push_writer_locked(PendingWriter<ValueType> *writer) {
+    writer_list.push_back(writer);
+  }
+
+  // the waiters to wake once select_mutex is released.
+  ResumedWaiters take_resumed_locked() {
+    return {std::move(resumed_writers), std::move(resumed_readers)};
+  }
+
   void close() {
     bool expect = true;
     if (_is_active.compare_exchange_strong(expect, false, std::memory_order_relaxed)) {
@@ -146,29 +179,113 @@ struct Channel {
  private:
   int buffer_capacity;
   std::queue<ValueType> buffer;
-  std::list<WriterAwaiter<ValueType> *> writer_list;
-  std::list<ReaderAwaiter<ValueType> *> reader_list;
+  IntrusiveList<PendingWriter<ValueType>> writer_list;
+  IntrusiveList<PendingReader<ValueType>> reader_list;
+
+  // waiters satisfied under channel_lock, woken up by wake_up after releasing it.
+  IntrusiveList<PendingWriter<ValueType>> resumed_writers;
+  IntrusiveList<PendingReader<ValueType>> resumed_readers;
 
   std::atomic<bool> _is_active;
 
   std::mutex channel_lock;
   std::condition_variable channel_condition;
 
-  void clean_up() {
-    std::lock_guard lock(channel_lock);
+  // the first waiting reader that takes values. A waiting select case whose select has been
+  // claimed by another case is dropped, it must neither get a value nor be woken up.
+  PendingReader<ValueType> *active_reader() {
+    while (auto reader = reader_list.front()) {
+      if (reader->claim()) {
+        return reader;
+      }
+      reader_list.pop_front();
+    }
+    return nullptr;
+  }
+
+  PendingWriter<ValueType> *active_writer() {
+    while (auto writer = writer_list.front()) {
+      if (writer->claim()) {
+        return writer;
+      }
+      writer_list.pop_front();
+    }
+    return nullptr;
+  }
+
+  // gives reader what the buffer and the waiting writers have, up to wanted().
+  void serve_reader(PendingReader<ValueType> *reader) {
+    while (reader->wanted() > 0 && !buffer.empty()) {
+      reader->give(std::move(buffer.front()));
+      buffer.pop();
+    }
+    // the buffer is empty now, unless the reader is full: the next values are the writers'.
+    while (reader->wanted() > 0) {
+      auto writer = active_writer();
+      if (!writer) break;
+      reader->give(writer->take());
+      if (writer->remaining() == 0) {
+        resumed_writers.push_back(writer_list.pop_front());
+      }
+    }
+    fill_buffer();
+  }
+
+  void serve_writer(PendingWriter<ValueType> *writer) {
+    // suspended readers, the buffer is empty while there are any.
+    while (writer->remaining() > 0) {
+      auto reader = active_reader();
+      if (!reader) break;
+      reader->give(writer->take());
+      if (reader->wanted() == 0) {
+        resumed_readers.push_back(reader_list.pop_front());
+      }
+    }
+    // a partially filled reader that has enough gets what has been written so far.
+    if (auto reader = reader_list.front(); reader && reader->missing() == 0) {
+      resumed_readers.push_back(reader_list.pop_front());
+    }
+
+    // write to buffer
+    while (writer->remaining() > 0 && buffer.size() < buffer_capacity) {
+      buffer.push(writer->take());
+    }
+  }
+
+  // moves the values of waiting writers into the free space of the buffer in one go.
+  void fill_buffer() {
+    while (buffer.size() < buffer_capacity) {
+      auto writer = active_writer();
+      if (!writer) break;
+      buffer.push(writer->take());
+      if (writer->remaining() == 0) {
+        resumed_writers.push_back(writer_list.pop_front());
+      }
+    }
+  }
 
-    for (auto writer : writer_list) {
-      writer->resume();
+  void wake_up(std::unique_lock<std::mutex> &lock) {
+    if (resumed_writers.empty() && resumed_readers.empty()) {
+      return;
     }
-    writer_list.clear();
+    auto resumed = take_resumed_locked();
+    lock.unlock();
+    resumed.wake();
+  }
 
-    for (auto reader : reader_list) {
-      reader->resume_unsafe();
+  void clean_up() {
+    std::unique_lock lock(channel_lock);
+    // woken up after unlocking, an awaiter resumed inline may use the channel again.
+    while (auto writer = active_writer()) {
+      resumed_writers.push_back(writer_list.pop_front());
+    }
+    while (auto reader = active_reader()) {
+      resumed_readers.push_back(reader_list.pop_front());
     }
-    reader_list.clear();
 
     decltype(buffer) empty_buffer;
     std::swap(buffer, empty_buffer);
+    wake_up(lock);
   }
 };
 
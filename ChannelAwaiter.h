@@ -7,22 +7,91 @@
 
 #include "coroutine_common.h"
 #include "CommonAwaiter.h"
+#include "IntrusiveList.h"
+#include <algorithm>
+#include <span>
 #include "utility"
 
 template<typename ValueType>
 struct Channel;
 
+/**
+ * A writer suspended in a channel with one or more values left. The channel takes the values
+ * under its lock and wakes the writer up after releasing it.
+ */
 template<typename ValueType>
-struct WriterAwaiter : public Awaiter<void> {
-  Channel<ValueType> *channel;
+struct PendingWriter : IntrusiveListNode<PendingWriter<ValueType>> {
+  [[nodiscard]] virtual size_t remaining() const = 0;
+
+  // the next value, moved from by the caller before anything else is called on the writer.
+  virtual ValueType &&take() = 0;
+
+  virtual void wake() = 0;
+
+  // called by the channel before it serves a waiting writer. A select case returns false once
+  // another case of its select has won, the channel drops it then.
+  virtual bool claim() { return true; }
+};
+
+/**
+ * A reader suspended in a channel. It takes up to wanted() more values and is woken up once
+ * missing() reaches 0.
+ */
+template<typename ValueType>
+struct PendingReader : IntrusiveListNode<PendingReader<ValueType>> {
+  [[nodiscard]] virtual size_t wanted() const = 0;
+
+  [[nodiscard]] virtual size_t missing() const = 0;
+
+  virtual void give(ValueType &&value) = 0;
+
+  virtual void wake() = 0;
+
+  // see PendingWriter::claim.
+  virtual bool claim() { return true; }
+};
+
+/**
+ * Awaiters are shared by the channel implementations. A channel with a non-blocking
+ * try_write/try_read completes the operation in await_ready when it can and only suspends
+ * the coroutine when it has to wait.
+ */
+template<typename ValueType, typename ChannelType = Channel<ValueType>>
+struct WriterAwaiter : public Awaiter<void>, PendingWriter<ValueType> {
+  ChannelType *channel;
   ValueType _value;
+  bool is_taken = false;
 
-  WriterAwaiter(Channel<ValueType> *channel, ValueType value) : channel(channel), _value(value) {}
+  WriterAwaiter(ChannelType *channel, ValueType &&value) : channel(channel), _value(std::move(value)) {}
 
   WriterAwaiter(WriterAwaiter &&other) noexcept
       : Awaiter(other),
         channel(std::exchange(other.channel, nullptr)),
-        _value(other._value) {}
+        _value(std::move(other._value)),
+        is_taken(other.is_taken) {}
+
+  bool await_ready() {
+    if constexpr (requires { channel->try_write(_value); }) {
+      if (channel->try_write(_value)) {
+        _result = Result<void>();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  [[nodiscard]] size_t remaining() const override {
+    return is_taken ? 0 : 1;
+  }
+
+  ValueType &&take() override {
+    is_taken = true;
+    return std::move(_value);
+  }
+
+  void wake() override {
+    resume();
+  }
 
   void after_suspend() override {
     channel->try_push_writer(this);
@@ -38,17 +107,51 @@ struct WriterAwaiter : public Awaiter<void> {
   }
 };
 
-template<typename ValueType>
-struct ReaderAwaiter : public Awaiter<ValueType> {
-  Channel<ValueType> *channel;
+template<typename ValueType, typename ChannelType = Channel<ValueType>>
+struct ReaderAwaiter : public Awaiter<ValueType>, PendingReader<ValueType> {
+  ChannelType *channel;
   ValueType *p_value = nullptr;
+  bool has_value = false;
 
-  explicit ReaderAwaiter(Channel<ValueType> *channel) : Awaiter<ValueType>(), channel(channel) {}
+  explicit ReaderAwaiter(ChannelType *channel) : Awaiter<ValueType>(), channel(channel) {}
 
   ReaderAwaiter(ReaderAwaiter &&other) noexcept
-      : Awaiter<ValueType>(other),
+      : Awaiter<ValueType>(std::move(other)),
         channel(std::exchange(other.channel, nullptr)),
-        p_value(std::exchange(other.p_value, nullptr)) {}
+        p_value(std::exchange(other.p_value, nullptr)),
+        has_value(other.has_value) {}
+
+  bool await_ready() {
+    if constexpr (requires { channel->try_read(); }) {
+      if (auto value = channel->try_read()) {
+        set_value(std::move(*value));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // lets a channel hand over the value under its lock and call resume_unsafe after releasing it.
+  void set_value(ValueType &&value) {
+    this->_result.emplace(std::move(value));
+    has_value = true;
+  }
+
+  [[nodiscard]] size_t wanted() const override {
+    return has_value ? 0 : 1;
+  }
+
+  [[nodiscard]] size_t missing() const override {
+    return wanted();
+  }
+
+  void give(ValueType &&value) override {
+    set_value(std::move(value));
+  }
+
+  void wake() override {
+    this->resume_unsafe();
+  }
 
   void after_suspend() override {
     channel->try_push_reader(this);
@@ -57,7 +160,7 @@ struct ReaderAwaiter : public Awaiter<ValueType> {
   void before_resume() override {
     channel->check_closed();
     if (p_value) {
-      *p_value = this->_result->get_or_throw();
+      *p_value = std::move(*this->_result).get_or_throw();
     }
     channel = nullptr;
   }
@@ -67,4 +170,103 @@ struct ReaderAwaiter : public Awaiter<ValueType> {
   }
 };
 
+/**
+ * Writes all values of a span, suspending once for whatever does not fit into the channel.
+ * The values are moved out of the span, which must stay valid until the awaiter is resumed.
+ */
+template<typename ValueType>
+struct ManyWriterAwaiter : public Awaiter<void>, PendingWriter<ValueType> {
+  Channel<ValueType> *channel;
+  std::span<ValueType> values;
+  size_t written = 0;
+
+  ManyWriterAwaiter(Channel<ValueType> *channel, std::span<ValueType> values)
+      : channel(channel), values(values) {}
+
+  ManyWriterAwaiter(ManyWriterAwaiter &&other) noexcept
+      : Awaiter(other),
+        channel(std::exchange(other.channel, nullptr)),
+        values(other.values),
+        written(other.written) {}
+
+  [[nodiscard]] size_t remaining() const override {
+    return values.size() - written;
+  }
+
+  ValueType &&take() override {
+    return std::move(values[written++]);
+  }
+
+  void wake() override {
+    resume();
+  }
+
+  void after_suspend() override {
+    channel->try_push_writer(this);
+  }
+
+  void before_resume() override {
+    channel->check_closed();
+    channel = nullptr;
+  }
+
+  ~ManyWriterAwaiter() {
+    if (channel) channel->remove_writer(this);
+  }
+};
+
+/**
+ * Reads between min_count and out.size() values into out in one suspension and returns how many
+ * were read. If the channel is closed while waiting, the values read so far are returned and
+ * ChannelClosedException is only thrown if there are none.
+ */
+template<typename ValueType>
+struct ManyReaderAwaiter : public Awaiter<size_t>, PendingReader<ValueType> {
+  Channel<ValueType> *channel;
+  std::span<ValueType> out;
+  size_t min_count;
+  size_t filled = 0;
+
+  ManyReaderAwaiter(Channel<ValueType> *channel, std::span<ValueType> out, size_t min_count)
+      : channel(channel), out(out), min_count(std::min(min_count, out.size())) {}
+
+  ManyReaderAwaiter(ManyReaderAwaiter &&other) noexcept
+      : Awaiter(other),
+        channel(std::exchange(other.channel, nullptr)),
+        out(other.out),
+        min_count(other.min_count),
+        filled(other.filled) {}
+
+  [[nodiscard]] size_t wanted() const override {
+    return out.size() - filled;
+  }
+
+  [[nodiscard]] size_t missing() const override {
+    return filled < min_count ? min_count - filled : 0;
+  }
+
+  void give(ValueType &&value) override {
+    out[filled++] = std::move(value);
+  }
+
+  void wake() override {
+    resume(filled);
+  }
+
+  void after_suspend() override {
+    channel->try_push_reader(this);
+  }
+
+  void before_resume() override {
+    if (filled == 0) {
+      channel->check_closed();
+    }
+    channel = nullptr;
+  }
+
+  ~ManyReaderAwaiter() {
+    if (channel) channel->remove_reader(this);
+  }
+};
+
 #endif //CPPCOROUTINES_TASKS_07_CHANNEL_CHANNELAWAITER_H_
@@ -7,7 +7,9 @@
 
 #include "Executor.h"
 #include "Result.h"
+#include "TaskPriority.h"
 #include "coroutine_common.h"
+#include <optional>
 
 template<typename R>
 struct Awaiter {
@@ -23,31 +25,42 @@ struct Awaiter {
 
   R await_resume() {
     before_resume();
-    return _result->get_or_throw();
+    return std::move(*_result).get_or_throw();
   }
 
   void resume(R value) {
-    dispatch([this, value]() {
-      _result = Result<R>(static_cast<R>(value));
-      _handle.resume();
-    });
+    // the coroutine is suspended, nobody reads _result until it is resumed.
+    _result.emplace(std::move(value));
+    dispatch();
   }
 
   void resume_unsafe() {
-    dispatch([this]() { _handle.resume(); });
+    dispatch();
   }
 
   void resume_exception(std::exception_ptr &&e) {
-    dispatch([this, e]() {
-      _result = Result<R>(static_cast<std::exception_ptr>(e));
-      _handle.resume();
-    });
+    _result = Result<R>(static_cast<std::exception_ptr>(e));
+    dispatch();
   }
 
   void install_executor(AbstractExecutor *executor) {
     _executor = executor;
   }
 
+  // the awaiting coroutine is resumed in the lane of priority.
+  void install_executor(AbstractExecutor *executor, TaskPriority priority) {
+    _executor = executor;
+    _priority = priority;
+  }
+
+  [[nodiscard]] AbstractExecutor *installed_executor() const {
+    return _executor;
+  }
+
+  [[nodiscard]] TaskPriority installed_priority() const {
+    return _priority;
+  }
+
  protected:
   std::optional<Result<R>> _result{};
 
@@ -56,13 +69,14 @@ struct Awaiter {
   virtual void before_resume() {}
  private:
   AbstractExecutor *_executor = nullptr;
+  TaskPriority _priority = TaskPriority::kNormal;
   std::coroutine_handle<> _handle = nullptr;
 
-  void dispatch(std::function<void()> &&f) {
+  void dispatch() {
     if (_executor) {
-      _executor->execute(std::move(f));
+      _executor->execute(_handle, _priority);
     } else {
-      f();
+      _handle.resume();
     }
   }
 };
@@ -85,41 +99,54 @@ struct Awaiter<void> {
   }
 
   void resume() {
-    dispatch([this]() {
-      _result = Result<void>();
-      _handle.resume();
-    });
+    _result = Result<void>();
+    dispatch();
   }
 
   void resume_unsafe() {
-    dispatch([this]() { _handle.resume(); });
+    dispatch();
   }
 
   void resume_exception(std::exception_ptr &&e) {
-    dispatch([this, e]() {
-      _result = Result<void>(static_cast<std::exception_ptr>(e));
-      _handle.resume();
-    });
+    _result = Result<void>(static_cast<std::exception_ptr>(e));
+    dispatch();
   }
 
   void install_executor(AbstractExecutor *executor) {
     _executor = executor;
   }
 
+  // the awaiting coroutine is resumed in the lane of priority.
+  void install_executor(AbstractExecutor *executor, TaskPriority priority) {
+    _executor = executor;
+    _priority = priority;
+  }
+
+  [[nodiscard]] AbstractExecutor *installed_executor() const {
+    return _executor;
+  }
+
+  [[nodiscard]] TaskPriority installed_priority() const {
+    return _priority;
+  }
+
   virtual void after_suspend() {}
 
   virtual void before_resume() {}
 
- private:
+ protected:
   std::optional<Result<void>> _result{};
+
+ private:
   AbstractExecutor *_executor = nullptr;
+  TaskPriority _priority = TaskPriority::kNormal;
   std::coroutine_handle<> _handle = nullptr;
 
-  void dispatch(std::function<void()> &&f) {
+  void dispatch() {
     if (_executor) {
-      _executor->execute(std::move(f));
+      _executor->execute(_handle, _priority);
     } else {
-      f();
+      _handle.resume();
     }
   }
 };
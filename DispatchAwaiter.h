@@ -10,21 +10,20 @@
 
 struct DispatchAwaiter {
 
-  explicit DispatchAwaiter(AbstractExecutor *executor) noexcept
-      : _executor(executor) {}
+  explicit DispatchAwaiter(AbstractExecutor *executor, TaskPriority priority = TaskPriority::kNormal) noexcept
+      : _executor(executor), _priority(priority) {}
 
   bool await_ready() const { return false; }
 
   void await_suspend(std::coroutine_handle<> handle) const {
-    _executor->execute([handle]() {
-      handle.resume();
-    });
+    _executor->execute(handle, _priority);
   }
 
   void await_resume() {}
 
  private:
   AbstractExecutor *_executor;
+  TaskPriority _priority;
 };
 
 #endif //CPPCOROUTINES_04_TASK_DISPATCHAWAITER_H_
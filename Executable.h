@@ -0,0 +1,134 @@
+//
+// Created by benny on 2022/3/28.
+//
+
+#ifndef CPPCOROUTINES_TASKS_09_EXECUTOR_EXECUTABLE_H_
+#define CPPCOROUTINES_TASKS_09_EXECUTOR_EXECUTABLE_H_
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "coroutine_common.h"
+
+/**
+ * Move-only replacement of std::function<void()> for executors.
+ *
+ * Callables up to kInlineSize bytes are stored inline, so resuming a coroutine handle
+ * or running a lambda with a few captures never touches the heap.
+ */
+class Executable {
+ public:
+  static constexpr size_t kInlineSize = 6 * sizeof(void *);
+
+  Executable() noexcept = default;
+
+  Executable(std::nullptr_t) noexcept {}
+
+  Executable(std::coroutine_handle<> handle) noexcept
+      : Executable([handle]() { handle.resume(); }) {}
+
+  template<typename F>
+  requires (!std::is_same_v<std::decay_t<F>, Executable>) && std::is_invocable_v<std::decay_t<F> &>
+  Executable(F &&func) {
+    using Func = std::decay_t<F>;
+    if constexpr (is_stored_inline<Func>) {
+      ::new(static_cast<void *>(storage)) Func(std::forward<F>(func));
+      vtable = &inline_vtable<Func>;
+    } else {
+      *reinterpret_cast<Func **>(storage) = new Func(std::forward<F>(func));
+      vtable = &heap_vtable<Func>;
+    }
+  }
+
+  Executable(Executable &&other) noexcept {
+    move_from(other);
+  }
+
+  Executable &operator=(Executable &&other) noexcept {
+    if (this != &other) {
+      reset();
+      move_from(other);
+    }
+    return *this;
+  }
+
+  Executable &operator=(std::nullptr_t) noexcept {
+    reset();
+    return *this;
+  }
+
+  Executable(Executable &) = delete;
+
+  Executable &operator=(Executable &) = delete;
+
+  ~Executable() {
+    reset();
+  }
+
+  void operator()() {
+    vtable->invoke(storage);
+  }
+
+  explicit operator bool() const noexcept {
+    return vtable != nullptr;
+  }
+
+ private:
+  struct VTable {
+    void (*invoke)(void *);
+    // move-constructs into dst and destroys src.
+    void (*relocate)(void *dst, void *src) noexcept;
+    void (*destroy)(void *) noexcept;
+  };
+
+  template<typename Func>
+  static constexpr bool is_stored_inline = sizeof(Func) <= kInlineSize
+      && alignof(Func) <= alignof(std::max_align_t)
+      && std::is_nothrow_move_constructible_v<Func>;
+
+  template<typename Func>
+  static constexpr VTable inline_vtable{
+      [](void *p) { (*static_cast<Func *>(p))(); },
+      [](void *dst, void *src) noexcept {
+        ::new(dst) Func(std::move(*static_cast<Func *>(src)));
+        static_cast<Func *>(src)->~Func();
+      },
+      [](void *p) noexcept { static_cast<Func *>(p)->~Func(); }
+  };
+
+  template<typename Func>
+  static constexpr VTable heap_vtable{
+      [](void *p) { (**static_cast<Func **>(p))(); },
+      [](void *dst, void *src) noexcept {
+        *static_cast<Func **>(dst) = *static_cast<Func **>(src);
+      },
+      [](void *p) noexcept { delete *static_cast<Func **>(p); }
+  };
+
+  alignas(std::max_align_t) unsigned char storage[kInlineSize]{};
+  const VTable *vtable = nullptr;
+
+  void move_from(Executable &other) noexcept {
+    if (other.vtable) {
+      other.vtable->relocate(storage, other.storage);
+      vtable = std::exchange(other.vtable, nullptr);
+    }
+  }
+
+  void reset() noexcept {
+    if (vtable) {
+      std::exchange(vtable, nullptr)->destroy(storage);
+    }
+  }
+};
+
+// set on the threads running the loop of an executor, the Scheduler, a reactor or a poller. Others
+// depend on their progress, so they must never wait in an execute(), see BlockingPoolExecutor.
+inline bool &is_loop_thread() {
+  thread_local bool is_loop = false;
+  return is_loop;
+}
+
+#endif //CPPCOROUTINES_TASKS_09_EXECUTOR_EXECUTABLE_H_
@@ -5,82 +5,327 @@
 #ifndef CPPCOROUTINES_04_TASK_EXECUTOR_H_
 #define CPPCOROUTINES_04_TASK_EXECUTOR_H_
 
-#include <queue>
+#include <linux/futex.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
 #include <mutex>
-#include <functional>
-#include <future>
-#include <map>
+#include <thread>
+#include <vector>
+#include "Executable.h"
+#include "ExecutorMetrics.h"
+#include "TaskPriority.h"
+#include "TimerQueue.h"
 #include "io_utils.h"
 
 class AbstractExecutor {
  public:
-  virtual void execute(std::function<void()> &&func) = 0;
+  virtual ~AbstractExecutor() = default;
+
+  // a std::coroutine_handle<> converts to an Executable without allocation.
+  virtual void execute(Executable &&func) = 0;
+
+  // resumes handle from the lane of priority, kNormal is the lane of execute(func), see
+  // resumption_of.
+  void execute(std::coroutine_handle<> handle, TaskPriority priority) {
+    if (priority == TaskPriority::kNormal) {
+      execute(resumption_of(handle, priority));
+    } else {
+      execute_in_lane(resumption_of(handle, priority), priority);
+    }
+  }
+
+  // overridden by executors with priority lanes, the others run func like any executable.
+  virtual void execute_in_lane(Executable &&func, TaskPriority) {
+    execute(std::move(func));
+  }
+
+  // resumes handle with current_task_priority() set to priority until it suspends, so the tasks
+  // the coroutine creates inherit its priority.
+  static Executable resumption_of(std::coroutine_handle<> handle, TaskPriority priority) {
+    return [handle, priority]() {
+      TaskPriorityScope scope(priority);
+      handle.resume();
+    };
+  }
+
+  // true if an executable dispatched here may run on the calling thread right away.
+  [[nodiscard]] virtual bool is_executor_thread() const {
+    return false;
+  }
+
+  // runs func on the executor once delay has passed and returns true, or returns false without
+  // touching func if the executor has no timers of its own.
+  virtual bool execute_after(Executable &&, TimerClock::duration) {
+    return false;
+  }
+
+  // true if the destructor joins threads of the executor, it must not run on one of them.
+  [[nodiscard]] virtual bool joins_on_destruction() const {
+    return false;
+  }
+
+  // starts collecting metrics, a no-op for executors without a queue of their own.
+  virtual void enable_metrics() {}
+
+  // empty unless enable_metrics has been called and the executor supports metrics.
+  [[nodiscard]] virtual std::optional<ExecutorMetricsSnapshot> metrics_snapshot() {
+    return std::nullopt;
+  }
 };
 
 class NoopExecutor : public AbstractExecutor {
  public:
-  void execute(std::function<void()> &&func) override {
+  void execute(Executable &&func) override {
     func();
   }
-};
 
-class NewThreadExecutor : public AbstractExecutor {
- public:
-  void execute(std::function<void()> &&func) override {
-    std::thread(func).detach();
+  [[nodiscard]] bool is_executor_thread() const override {
+    return true;
   }
 };
 
-class AsyncExecutor : public AbstractExecutor {
- public:
-  void execute(std::function<void()> &&func) override {
-    std::unique_lock lock(future_lock);
-    auto id = nextId++;
-    lock.unlock();
+class LooperExecutor : public AbstractExecutor {
+ private:
+  struct Node {
+    std::atomic<Node *> next{nullptr};
+    Executable func;
+    // set while metrics are enabled.
+    MetricsClock::time_point enqueued_at;
+  };
 
-    auto future = std::async([this, id, func](){
-      func();
+  // nodes released by the work thread, handed back to producers in one exchange.
+  alignas(64) std::atomic<Node *> free_nodes{nullptr};
 
-      std::unique_lock lock(future_lock);
-      // move future to stack so that it will be destroyed after unlocked.
-      auto f = std::move(this->futures[id]);
-      this->futures.erase(id);
-      lock.unlock();
-    });
+  // per-thread node cache shared by all loopers, refilled from free_nodes.
+  struct NodeCache {
+    Node *head = nullptr;
 
-    lock.lock();
-    this->futures[id] = std::move(future);
-    lock.unlock();
+    ~NodeCache() {
+      while (head) {
+        delete std::exchange(head, head->next.load(std::memory_order_relaxed));
+      }
+    }
+  };
+
+  static NodeCache &node_cache() {
+    thread_local NodeCache cache;
+    return cache;
   }
- private:
-  std::mutex future_lock;
-  int nextId = 0;
-  std::map<int, std::future<void>> futures{};
-};
 
-class LooperExecutor : public AbstractExecutor {
- private:
-  std::condition_variable queue_condition;
-  std::mutex queue_lock;
-  std::queue<std::function<void()>> executable_queue;
+  Node *obtain_node() {
+    auto &cache = node_cache();
+    if (!cache.head) {
+      cache.head = free_nodes.exchange(nullptr, std::memory_order_acquire);
+      if (!cache.head) {
+        return new Node;
+      }
+    }
+    return std::exchange(cache.head, cache.head->next.load(std::memory_order_relaxed));
+  }
+
+  // called by the work thread only.
+  void recycle_node(Node *node) {
+    node->func = nullptr;
+    auto head = free_nodes.load(std::memory_order_relaxed);
+    do {
+      node->next.store(head, std::memory_order_relaxed);
+    } while (!free_nodes.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  // intrusive multi-producer/single-consumer queue, see
+  // https://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+  // producers only touch tail, head is owned by the work thread.
+  struct Lane {
+    alignas(64) std::atomic<Node *> tail;
+    alignas(64) Node *head;
+    Node stub;
+
+    Lane() : tail(&stub), head(&stub) {}
+
+    void push(Node *node) {
+      node->next.store(nullptr, std::memory_order_relaxed);
+      auto prev = tail.exchange(node);
+      prev->next.store(node, std::memory_order_release);
+    }
+
+    // called by the work thread only.
+    Node *pop() {
+      auto current = head;
+      auto next = current->next.load(std::memory_order_acquire);
+      if (current == &stub) {
+        if (!next) return nullptr;
+        head = next;
+        current = next;
+        next = next->next.load(std::memory_order_acquire);
+      }
+      if (next) {
+        head = next;
+        return current;
+      }
+      if (current != tail.load()) {
+        // a producer has swapped tail but not linked its node yet.
+        return nullptr;
+      }
+      push(&stub);
+      next = current->next.load(std::memory_order_acquire);
+      if (next) {
+        head = next;
+        return current;
+      }
+      return nullptr;
+    }
+
+    // called by the work thread only.
+    bool is_empty() {
+      return head == &stub && tail.load() == &stub;
+    }
+  };
+
+  // a lower lane passed over this many times in a row while it has work gets the next turn, so
+  // a busy higher lane slows it down but cannot starve it.
+  static constexpr uint32_t kStarvationLimit = 16;
+
+  // indexed by lane_of(priority), highest first.
+  Lane lanes[kTaskPriorityCount];
+  // owned by the work thread.
+  uint32_t passed_over[kTaskPriorityCount] = {};
+
+  // 1 only while the work thread is blocked in park(), a futex so that it can wait with a timeout.
+  alignas(64) std::atomic<uint32_t> is_parked{0};
+  std::atomic<bool> discard_pending{false};
+
+  // timers of the executor, owned by the work thread.
+  HeapTimerQueue timers;
+  std::vector<Executable> expired_timers;
+  std::vector<TimerClock::time_point> scheduled_times;
 
   std::atomic<bool> is_active;
   std::thread work_thread;
 
+  ExecutorMetricsSlot metrics;
+
+  // called by the work thread only: the highest lane with work, unless a lower one is starving.
+  Node *pop(size_t &lane) {
+    for (lane = kTaskPriorityCount; lane-- > 1;) {
+      if (passed_over[lane] >= kStarvationLimit) {
+        passed_over[lane] = 0;
+        if (auto node = lanes[lane].pop()) return node;
+      }
+    }
+    for (lane = 0; lane < kTaskPriorityCount; ++lane) {
+      if (auto node = lanes[lane].pop()) {
+        for (auto lower = lane + 1; lower < kTaskPriorityCount; ++lower) {
+          if (!lanes[lower].is_empty()) ++passed_over[lower];
+        }
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  // called by the work thread only.
+  bool is_empty() {
+    for (auto &lane : lanes) {
+      if (!lane.is_empty()) return false;
+    }
+    return true;
+  }
+
+  void wake_up() {
+    if (is_parked.load() && is_parked.exchange(0)) {
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&is_parked), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+  }
+
+  // blocks while is_parked is 1, until the deadline if there is one. steady_clock is CLOCK_MONOTONIC.
+  void park(const TimerClock::time_point *deadline) {
+    timespec timeout{};
+    if (deadline) {
+      auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline->time_since_epoch()).count();
+      timeout.tv_sec = static_cast<time_t>(nanoseconds / 1000000000);
+      timeout.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+    }
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&is_parked), FUTEX_WAIT_BITSET_PRIVATE, 1,
+            deadline ? &timeout : nullptr, nullptr, FUTEX_BITSET_MATCH_ANY);
+  }
+
+  // called by the work thread only.
+  void run_expired_timers() {
+    auto now = TimerClock::now();
+    if (timers.next_deadline() > now) {
+      return;
+    }
+    auto current_metrics = metrics.get();
+    timers.pop_expired(now, expired_timers, current_metrics ? &scheduled_times : nullptr);
+    for (size_t i = 0; i < expired_timers.size(); ++i) {
+      if (discard_pending.load(std::memory_order_relaxed)) break;
+      if (current_metrics) {
+        current_metrics->thread(0).timer_lateness.record(TimerClock::now() - scheduled_times[i]);
+      }
+      expired_timers[i]();
+    }
+    expired_timers.clear();
+    scheduled_times.clear();
+  }
+
+  void run_measured(Node *node, size_t lane) {
+    auto current_metrics = metrics.get();
+    current_metrics->on_dequeue();
+    if (discard_pending.load(std::memory_order_relaxed)) {
+      return;
+    }
+    auto &histograms = current_metrics->thread(0);
+    auto start = MetricsClock::now();
+    histograms.schedule_delay.record(start - node->enqueued_at);
+    histograms.lane_schedule_delay[lane].record(start - node->enqueued_at);
+    node->func();
+    histograms.run_time.record(MetricsClock::now() - start);
+  }
+
   void run_loop() {
-    while (is_active.load(std::memory_order_relaxed) || !executable_queue.empty()) {
-      std::unique_lock lock(queue_lock);
-      if (executable_queue.empty()) {
-        queue_condition.wait(lock);
-        if (executable_queue.empty()) {
-          continue;
+    is_loop_thread() = true;
+    // timed waits end within the default slack of 50us, too coarse for short sleeps.
+    prctl(PR_SET_TIMERSLACK, 1UL);
+    while (true) {
+      if (!timers.empty()) {
+        run_expired_timers();
+      }
+      size_t lane;
+      auto node = pop(lane);
+      if (node) {
+        if (node->enqueued_at != MetricsClock::time_point()) {
+          run_measured(node, lane);
+        } else if (!discard_pending.load(std::memory_order_relaxed)) {
+          node->func();
         }
+        recycle_node(node);
+        continue;
       }
-      auto func = executable_queue.front();
-      executable_queue.pop();
-      lock.unlock();
 
-      func();
+      if (is_empty()) {
+        if (!is_active.load()) break;
+
+        // pairs with the tail exchange in push: either execute sees us parked,
+        // or we see its node here.
+        is_parked.store(1);
+        if (is_empty() && is_active.load()) {
+          if (timers.empty()) {
+            park(nullptr);
+          } else if (auto deadline = timers.next_deadline(); deadline > TimerClock::now()) {
+            park(&deadline);
+          }
+        }
+        is_parked.store(0, std::memory_order_relaxed);
+      }
     }
     debug("run_loop exit.");
   }
@@ -97,37 +342,325 @@ class LooperExecutor : public AbstractExecutor {
     if (work_thread.joinable()) {
       work_thread.join();
     }
+    // executables pushed while the loop was exiting.
+    for (auto &lane : lanes) {
+      while (auto node = lane.pop()) {
+        delete node;
+      }
+    }
+    auto node = free_nodes.exchange(nullptr);
+    while (node) {
+      delete std::exchange(node, node->next.load(std::memory_order_relaxed));
+    }
   }
 
-  void execute(std::function<void()> &&func) override {
-    std::unique_lock lock(queue_lock);
+  using AbstractExecutor::execute;
+
+  void execute(Executable &&func) override {
+    execute_in_lane(std::move(func), TaskPriority::kNormal);
+  }
+
+  // lanes run highest first, see kStarvationLimit.
+  void execute_in_lane(Executable &&func, TaskPriority priority) override {
     if (is_active.load(std::memory_order_relaxed)) {
-      executable_queue.push(func);
-      lock.unlock();
-      queue_condition.notify_one();
+      auto node = obtain_node();
+      node->func = std::move(func);
+      if (auto current_metrics = metrics.get()) {
+        node->enqueued_at = MetricsClock::now();
+        current_metrics->on_enqueue();
+      } else {
+        node->enqueued_at = MetricsClock::time_point();
+      }
+      lanes[lane_of(priority)].push(node);
+      wake_up();
     }
   }
 
+  // timers run on the work thread between executables, it sleeps until the next deadline.
+  bool execute_after(Executable &&func, TimerClock::duration delay) override {
+    auto deadline = TimerClock::now() + std::max(delay, TimerClock::duration::zero());
+    if (is_executor_thread()) {
+      timers.push(std::move(func), deadline);
+    } else {
+      execute([this, func = std::move(func), deadline]() mutable {
+        timers.push(std::move(func), deadline);
+      });
+    }
+    return true;
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return std::this_thread::get_id() == work_thread.get_id();
+  }
+
+  [[nodiscard]] bool joins_on_destruction() const override {
+    return true;
+  }
+
+  void enable_metrics() override {
+    metrics.enable();
+  }
+
+  [[nodiscard]] std::optional<ExecutorMetricsSnapshot> metrics_snapshot() override {
+    return metrics.snapshot();
+  }
+
   void shutdown(bool wait_for_complete = true) {
-    is_active.store(false, std::memory_order_relaxed);
+    is_active.store(false);
     if (!wait_for_complete) {
-      // clear queue.
-      std::unique_lock lock(queue_lock);
-      decltype(executable_queue) empty_queue;
-      std::swap(executable_queue, empty_queue);
-      lock.unlock();
+      // drop the queued executables, the work thread releases them.
+      discard_pending.store(true, std::memory_order_relaxed);
     }
 
-    queue_condition.notify_all();
+    is_parked.store(0);
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&is_parked), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
   }
 };
 
 class SharedLooperExecutor : public AbstractExecutor {
  public:
-  void execute(std::function<void()> &&func) override {
+  static LooperExecutor &shared_executor() {
     static LooperExecutor sharedLooperExecutor;
-    sharedLooperExecutor.execute(std::move(func));
+    return sharedLooperExecutor;
+  }
+
+  using AbstractExecutor::execute;
+
+  void execute(Executable &&func) override {
+    shared_executor().execute(std::move(func));
+  }
+
+  void execute_in_lane(Executable &&func, TaskPriority priority) override {
+    shared_executor().execute_in_lane(std::move(func), priority);
+  }
+
+  bool execute_after(Executable &&func, TimerClock::duration delay) override {
+    return shared_executor().execute_after(std::move(func), delay);
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return shared_executor().is_executor_thread();
+  }
+
+  void enable_metrics() override {
+    shared_executor().enable_metrics();
+  }
+
+  [[nodiscard]] std::optional<ExecutorMetricsSnapshot> metrics_snapshot() override {
+    return shared_executor().metrics_snapshot();
+  }
+};
+
+// what BlockingPoolExecutor does with an executable while every thread is busy and its queue is full.
+enum class RejectionPolicy {
+  // the caller waits for room in the queue, unless it is a loop thread, see is_loop_thread.
+  kBlock,
+  // the caller runs the executable itself, which slows down whoever submits too much.
+  kCallerRuns,
+  // execute throws RejectedExecutionException.
+  kThrow,
+};
+
+struct RejectedExecutionException : std::exception {
+  [[nodiscard]] const char *what() const noexcept override {
+    return "blocking pool is saturated";
   }
 };
 
+struct BlockingPoolOptions {
+  size_t min_threads = 0;
+  size_t max_threads = 64;
+  // idle threads above min_threads exit after this long without work.
+  std::chrono::milliseconds keep_alive = std::chrono::seconds(10);
+  size_t queue_capacity = 1024;
+  RejectionPolicy rejection_policy = RejectionPolicy::kBlock;
+};
+
+/**
+ * Runs blocking calls and CPU-heavy work away from the executors of coroutines, see
+ * spawn_blocking. A new thread is started while executables wait and no thread is idle, up to
+ * max_threads, and threads above min_threads exit after keep_alive without work. Once max_threads
+ * are busy, up to queue_capacity executables wait in the queue and the rejection policy applies
+ * to the next ones.
+ *
+ * Threads are detached, the destructor drops queued executables and waits for the running ones.
+ */
+class BlockingPoolExecutor : public AbstractExecutor {
+ public:
+  explicit BlockingPoolExecutor(BlockingPoolOptions options = {}) : options(options) {
+    this->options.max_threads = std::max<size_t>(this->options.max_threads, 1);
+    this->options.min_threads = std::min(this->options.min_threads, this->options.max_threads);
+    std::lock_guard lock(pool_lock);
+    while (thread_count < this->options.min_threads) {
+      start_thread();
+    }
+  }
+
+  ~BlockingPoolExecutor() {
+    shutdown(false);
+    std::unique_lock lock(pool_lock);
+    exit_condition.wait(lock, [this]() { return thread_count == 0; });
+  }
+
+  void execute(Executable &&func) override {
+    std::unique_lock lock(pool_lock);
+    while (is_active) {
+      if (idle_count > queue.size()) {
+        queue.push_back(std::move(func));
+        work_condition.notify_one();
+        return;
+      }
+      if (thread_count < options.max_threads) {
+        queue.push_back(std::move(func));
+        start_thread();
+        return;
+      }
+      if (queue.size() < options.queue_capacity) {
+        queue.push_back(std::move(func));
+        return;
+      }
+      switch (options.rejection_policy) {
+        case RejectionPolicy::kBlock:
+          // a loop thread waiting here would stall everything it runs, like the timers of the
+          // Scheduler, or deadlock on a queue only its own pool drains.
+          if (is_executor_thread() || is_loop_thread()) {
+            queue.push_back(std::move(func));
+            return;
+          }
+          space_condition.wait(lock);
+          break;
+        case RejectionPolicy::kCallerRuns:
+          lock.unlock();
+          func();
+          return;
+        case RejectionPolicy::kThrow:
+          throw RejectedExecutionException();
+      }
+    }
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return current_pool() == this;
+  }
+
+  [[nodiscard]] bool joins_on_destruction() const override {
+    return true;
+  }
+
+  [[nodiscard]] size_t live_threads() {
+    std::lock_guard lock(pool_lock);
+    return thread_count;
+  }
+
+  [[nodiscard]] size_t peak_threads() {
+    std::lock_guard lock(pool_lock);
+    return peak_thread_count;
+  }
+
+  void shutdown(bool wait_for_complete = true) {
+    std::unique_lock lock(pool_lock);
+    is_active = false;
+    if (!wait_for_complete) {
+      queue.clear();
+    }
+    lock.unlock();
+    work_condition.notify_all();
+    space_condition.notify_all();
+  }
+
+ private:
+  BlockingPoolOptions options;
+
+  std::mutex pool_lock;
+  std::condition_variable work_condition;
+  std::condition_variable space_condition;
+  std::condition_variable exit_condition;
+  std::deque<Executable> queue;
+  size_t thread_count = 0;
+  size_t peak_thread_count = 0;
+  size_t idle_count = 0;
+  bool is_active = true;
+
+  static BlockingPoolExecutor *&current_pool() {
+    thread_local BlockingPoolExecutor *pool = nullptr;
+    return pool;
+  }
+
+  // called with pool_lock held.
+  void start_thread() {
+    std::thread(&BlockingPoolExecutor::run_loop, this).detach();
+    peak_thread_count = std::max(peak_thread_count, ++thread_count);
+  }
+
+  void run_loop() {
+    current_pool() = this;
+    is_loop_thread() = true;
+    std::unique_lock lock(pool_lock);
+    while (true) {
+      if (!queue.empty()) {
+        auto func = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        space_condition.notify_one();
+        func();
+        func = nullptr;
+        lock.lock();
+        continue;
+      }
+      if (!is_active) break;
+
+      auto has_work = [this]() { return !queue.empty() || !is_active; };
+      ++idle_count;
+      bool is_woken_up = true;
+      if (thread_count > options.min_threads) {
+        is_woken_up = work_condition.wait_for(lock, options.keep_alive, has_work);
+      } else {
+        work_condition.wait(lock, has_work);
+      }
+      --idle_count;
+      if (!is_woken_up && thread_count > options.min_threads) break;
+    }
+    debug("run_loop exit.");
+    // the pool may be destroyed as soon as the lock is released, nothing is touched after that.
+    --thread_count;
+    exit_condition.notify_all();
+  }
+};
+
+/**
+ * The pool shared by spawn_blocking and by tasks on SharedBlockingPoolExecutor. Call set_options
+ * before it is first used. Its queue is unbounded unless configured otherwise, like the thread
+ * per executable that NewThreadExecutor and AsyncExecutor used to start.
+ */
+class SharedBlockingPoolExecutor : public AbstractExecutor {
+ public:
+  static void set_options(BlockingPoolOptions options) {
+    configured_options() = options;
+  }
+
+  static BlockingPoolExecutor &shared_executor() {
+    // never destroyed, its threads may be blocked in calls that do not return before exit.
+    static auto sharedBlockingPoolExecutor = new BlockingPoolExecutor(configured_options());
+    return *sharedBlockingPoolExecutor;
+  }
+
+  void execute(Executable &&func) override {
+    shared_executor().execute(std::move(func));
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return shared_executor().is_executor_thread();
+  }
+
+ private:
+  static BlockingPoolOptions &configured_options() {
+    static BlockingPoolOptions options{.queue_capacity = std::numeric_limits<size_t>::max()};
+    return options;
+  }
+};
+
+// both used to start a thread for every executable, they run on the shared blocking pool now.
+using NewThreadExecutor = SharedBlockingPoolExecutor;
+using AsyncExecutor = SharedBlockingPoolExecutor;
+
 #endif //CPPCOROUTINES_04_TASK_EXECUTOR_H_
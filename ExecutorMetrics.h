@@ -0,0 +1,227 @@
+//
+// Created by benny on 2022/4/8.
+//
+
+#ifndef CPPCOROUTINES_TASKS_09_EXECUTOR_EXECUTORMETRICS_H_
+#define CPPCOROUTINES_TASKS_09_EXECUTOR_EXECUTORMETRICS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "TaskPriority.h"
+
+using MetricsClock = std::chrono::steady_clock;
+
+struct HistogramSnapshot;
+
+/**
+ * Log-linear histogram in the style of HdrHistogram: 16 linear sub-buckets per power of two,
+ * so every value is reported within 1/16 of itself. Recording is lock-free but meant for a
+ * single thread, readers may run concurrently.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr size_t kSubBucketHalf = size_t(1) << (kSubBucketBits - 1);
+  static constexpr size_t kBucketCount = (64 - kSubBucketBits + 2) * kSubBucketHalf;
+
+  static size_t index_of(uint64_t value) {
+    auto shift = std::max(static_cast<int>(std::bit_width(value)), kSubBucketBits) - kSubBucketBits;
+    return shift * kSubBucketHalf + static_cast<size_t>(value >> shift);
+  }
+
+  // the highest value that lands in the bucket.
+  static uint64_t upper_bound_of(size_t index) {
+    size_t shift = index < 2 * kSubBucketHalf ? 0 : index / kSubBucketHalf - 1;
+    auto sub_bucket = static_cast<uint64_t>(index - shift * kSubBucketHalf);
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+  void record(uint64_t value) {
+    increase(counts[index_of(value)], 1);
+    increase(total, 1);
+    increase(sum, value);
+    if (value > max.load(std::memory_order_relaxed)) {
+      max.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  // negative durations are recorded as 0.
+  void record(MetricsClock::duration duration) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    record(static_cast<uint64_t>(std::max<decltype(ns)>(ns, 0)));
+  }
+
+  void add_to(HistogramSnapshot &snapshot) const;
+
+ private:
+  std::array<std::atomic<uint64_t>, kBucketCount> counts{};
+  std::atomic<uint64_t> total{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+
+  // the recording thread is the only writer, no read-modify-write needed.
+  static void increase(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+};
+
+/**
+ * Values since the histogram was enabled, in nanoseconds.
+ */
+struct HistogramSnapshot {
+  std::vector<uint64_t> counts = std::vector<uint64_t>(LatencyHistogram::kBucketCount);
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t max = 0;
+
+  [[nodiscard]] double mean() const {
+    return count ? static_cast<double>(sum) / static_cast<double>(count) : 0;
+  }
+
+  // p in [0, 1], returns the upper bound of the bucket holding that quantile.
+  [[nodiscard]] uint64_t percentile(double p) const {
+    if (count == 0) {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(p * static_cast<double>(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return std::min(LatencyHistogram::upper_bound_of(i), max);
+      }
+    }
+    return max;
+  }
+};
+
+inline void LatencyHistogram::add_to(HistogramSnapshot &snapshot) const {
+  for (size_t i = 0; i < kBucketCount; ++i) {
+    snapshot.counts[i] += counts[i].load(std::memory_order_relaxed);
+  }
+  snapshot.count += total.load(std::memory_order_relaxed);
+  snapshot.sum += sum.load(std::memory_order_relaxed);
+  snapshot.max = std::max(snapshot.max, max.load(std::memory_order_relaxed));
+}
+
+struct ExecutorMetricsSnapshot {
+  size_t queue_depth = 0;
+  // the highest depth since the previous snapshot.
+  size_t peak_queue_depth = 0;
+  // from execute() until the executable starts running.
+  HistogramSnapshot schedule_delay;
+  HistogramSnapshot run_time;
+  // from the scheduled time until the executable starts running, Scheduler only.
+  HistogramSnapshot timer_lateness;
+  // schedule_delay by the lane the executable was queued in, executors with priority lanes only.
+  std::array<HistogramSnapshot, kTaskPriorityCount> lane_schedule_delay;
+};
+
+/**
+ * Counters of one executor. Each thread that runs executables records into its own histograms.
+ */
+class ExecutorMetrics {
+ public:
+  struct ThreadHistograms {
+    LatencyHistogram schedule_delay;
+    LatencyHistogram run_time;
+    LatencyHistogram timer_lateness;
+    std::array<LatencyHistogram, kTaskPriorityCount> lane_schedule_delay;
+  };
+
+  explicit ExecutorMetrics(size_t thread_count = 1)
+      : thread_count(thread_count), threads(new ThreadHistograms[thread_count]) {}
+
+  ThreadHistograms &thread(size_t index) {
+    return threads[index];
+  }
+
+  void on_enqueue() {
+    record_depth(queue_depth.fetch_add(1, std::memory_order_relaxed) + 1);
+  }
+
+  void on_dequeue() {
+    queue_depth.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // for executors that know their depth without on_enqueue/on_dequeue.
+  void record_depth(size_t depth) {
+    auto peak = peak_queue_depth.load(std::memory_order_relaxed);
+    while (depth > peak && !peak_queue_depth.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+  }
+
+  ExecutorMetricsSnapshot snapshot() {
+    ExecutorMetricsSnapshot snapshot;
+    snapshot.queue_depth = queue_depth.load(std::memory_order_relaxed);
+    snapshot.peak_queue_depth = std::max(
+        peak_queue_depth.exchange(snapshot.queue_depth, std::memory_order_relaxed), snapshot.queue_depth);
+    for (size_t i = 0; i < thread_count; ++i) {
+      threads[i].schedule_delay.add_to(snapshot.schedule_delay);
+      threads[i].run_time.add_to(snapshot.run_time);
+      threads[i].timer_lateness.add_to(snapshot.timer_lateness);
+      for (size_t lane = 0; lane < kTaskPriorityCount; ++lane) {
+        threads[i].lane_schedule_delay[lane].add_to(snapshot.lane_schedule_delay[lane]);
+      }
+    }
+    return snapshot;
+  }
+
+ private:
+  alignas(64) std::atomic<size_t> queue_depth{0};
+  std::atomic<size_t> peak_queue_depth{0};
+  size_t thread_count;
+  std::unique_ptr<ThreadHistograms[]> threads;
+};
+
+/**
+ * Holds the metrics of an executor once enable_metrics is called. Until then the executor pays
+ * one load per executable, afterwards two clock reads and a few relaxed stores.
+ */
+class ExecutorMetricsSlot {
+ public:
+  ExecutorMetricsSlot() = default;
+
+  ExecutorMetricsSlot(ExecutorMetricsSlot &) = delete;
+
+  ExecutorMetricsSlot &operator=(ExecutorMetricsSlot &) = delete;
+
+  ~ExecutorMetricsSlot() {
+    delete metrics.load(std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] ExecutorMetrics *get() const {
+    return metrics.load(std::memory_order_acquire);
+  }
+
+  void enable(size_t thread_count = 1) {
+    if (get()) {
+      return;
+    }
+    auto created = new ExecutorMetrics(thread_count);
+    ExecutorMetrics *expected = nullptr;
+    if (!metrics.compare_exchange_strong(expected, created, std::memory_order_acq_rel)) {
+      delete created;
+    }
+  }
+
+  [[nodiscard]] std::optional<ExecutorMetricsSnapshot> snapshot() const {
+    auto current = get();
+    if (!current) {
+      return std::nullopt;
+    }
+    return current->snapshot();
+  }
+
+ private:
+  std::atomic<ExecutorMetrics *> metrics{nullptr};
+};
+
+#endif //CPPCOROUTINES_TASKS_09_EXECUTOR_EXECUTORMETRICS_H_
@@ -0,0 +1,239 @@
+//
+// Created by benny on 2022/4/5.
+//
+
+#ifndef CPPCOROUTINES_TASKS_04_TASK_FRAMEPOOL_H_
+#define CPPCOROUTINES_TASKS_04_TASK_FRAMEPOOL_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * User supplied storage for coroutine frames, see PooledFramePromise.
+ */
+class FrameArena {
+ public:
+  virtual ~FrameArena() = default;
+
+  virtual void *allocate(size_t size) = 0;
+
+  virtual void deallocate(void *p, size_t size) = 0;
+};
+
+struct FramePoolStatistics {
+  // pooled allocations served from a free list.
+  uint64_t hits = 0;
+  // pooled allocations that went to operator new.
+  uint64_t misses = 0;
+  // frames too large for the pool, or allocated while it was disabled.
+  uint64_t bypassed = 0;
+  uint64_t arena_allocations = 0;
+};
+
+/**
+ * Size-class free lists for coroutine frames, one set per thread, so the allocation fast path
+ * takes no lock. A frame freed on another thread goes to that thread's lists.
+ */
+class FramePool {
+ public:
+  static constexpr size_t kGranularity = 64;
+  static constexpr size_t kMaxPooledSize = 4096;
+  static constexpr size_t kClassCount = kMaxPooledSize / kGranularity;
+  static constexpr size_t kMaxBlocksPerClass = 1024;
+
+  static void set_enabled(bool enabled) {
+    is_enabled().store(enabled, std::memory_order_relaxed);
+  }
+
+  static bool enabled() {
+    return is_enabled().load(std::memory_order_relaxed);
+  }
+
+  static void *allocate(size_t size, FrameArena *arena) {
+    // null once the thread's cache has been destroyed, frames then bypass the pool uncounted.
+    auto cache = local_cache();
+    auto total = size + sizeof(Header);
+    void *block;
+    uint32_t size_class = kNotPooled;
+    if (arena) {
+      block = arena->allocate(total);
+      if (cache) cache->increase(cache->arena_allocations);
+    } else if (cache && total <= kMaxPooledSize && enabled()) {
+      size_class = static_cast<uint32_t>((total - 1) / kGranularity);
+      auto &free_list = cache->free_lists[size_class];
+      if (free_list.head) {
+        block = free_list.head;
+        free_list.head = free_list.head->next;
+        --free_list.count;
+        cache->increase(cache->hits);
+      } else {
+        block = ::operator new((size_class + 1) * kGranularity);
+        cache->increase(cache->misses);
+      }
+    } else {
+      block = ::operator new(total);
+      if (cache) cache->increase(cache->bypassed);
+    }
+    auto header = static_cast<Header *>(block);
+    header->arena = arena;
+    header->size_class = size_class;
+    header->frame_size = static_cast<uint32_t>(size);
+    return header + 1;
+  }
+
+  // the size the compiler asked for. A coroutine handle's address() is its frame on GCC and Clang.
+  static size_t frame_size(const void *frame) {
+    return (static_cast<const Header *>(frame) - 1)->frame_size;
+  }
+
+  static void deallocate(void *frame, size_t size) {
+    auto header = static_cast<Header *>(frame) - 1;
+    if (header->arena) {
+      header->arena->deallocate(header, size + sizeof(Header));
+      return;
+    }
+    auto cache = header->size_class != kNotPooled ? local_cache() : nullptr;
+    if (cache) {
+      auto &free_list = cache->free_lists[header->size_class];
+      if (free_list.count < kMaxBlocksPerClass) {
+        auto block = reinterpret_cast<FreeBlock *>(header);
+        block->next = free_list.head;
+        free_list.head = block;
+        ++free_list.count;
+        return;
+      }
+    }
+    ::operator delete(header);
+  }
+
+  static FramePoolStatistics statistics() {
+    auto &registry = cache_registry();
+    std::lock_guard lock(registry.lock);
+    auto result = registry.retired;
+    for (auto cache : registry.caches) {
+      cache->add_to(result);
+    }
+    return result;
+  }
+
+ private:
+  static constexpr uint32_t kNotPooled = UINT32_MAX;
+
+  struct alignas(std::max_align_t) Header {
+    FrameArena *arena;
+    uint32_t size_class;
+    uint32_t frame_size;
+  };
+
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+
+  struct FreeList {
+    FreeBlock *head = nullptr;
+    size_t count = 0;
+  };
+
+  struct ThreadCache;
+
+  struct CacheRegistry {
+    std::mutex lock;
+    std::vector<ThreadCache *> caches;
+    FramePoolStatistics retired;
+  };
+
+  struct ThreadCache {
+    FreeList free_lists[kClassCount];
+    // written by the owning thread only, read by statistics().
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> bypassed{0};
+    std::atomic<uint64_t> arena_allocations{0};
+
+    ThreadCache() {
+      auto &registry = cache_registry();
+      std::lock_guard lock(registry.lock);
+      registry.caches.push_back(this);
+    }
+
+    ~ThreadCache() {
+      // frames freed later on this thread, by other thread_locals or static destructors, go
+      // straight to operator delete.
+      local_cache_pointer = nullptr;
+      is_cache_released = true;
+      for (auto &free_list : free_lists) {
+        while (free_list.head) {
+          ::operator delete(std::exchange(free_list.head, free_list.head->next));
+        }
+      }
+      auto &registry = cache_registry();
+      std::lock_guard lock(registry.lock);
+      add_to(registry.retired);
+      std::erase(registry.caches, this);
+    }
+
+    static void increase(std::atomic<uint64_t> &counter) {
+      counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void add_to(FramePoolStatistics &statistics) const {
+      statistics.hits += hits.load(std::memory_order_relaxed);
+      statistics.misses += misses.load(std::memory_order_relaxed);
+      statistics.bypassed += bypassed.load(std::memory_order_relaxed);
+      statistics.arena_allocations += arena_allocations.load(std::memory_order_relaxed);
+    }
+  };
+
+  static std::atomic<bool> &is_enabled() {
+    static std::atomic<bool> enabled{true};
+    return enabled;
+  }
+
+  static CacheRegistry &cache_registry() {
+    // never destroyed, thread caches may outlive static destruction.
+    static auto registry = new CacheRegistry;
+    return *registry;
+  }
+
+  static inline thread_local constinit ThreadCache *local_cache_pointer = nullptr;
+  static inline thread_local constinit bool is_cache_released = false;
+
+  static ThreadCache *local_cache() {
+    // a trivially initialized pointer keeps the TLS guard off the fast path.
+    if (!local_cache_pointer && !is_cache_released) [[unlikely]] {
+      thread_local ThreadCache cache;
+      local_cache_pointer = &cache;
+    }
+    return local_cache_pointer;
+  }
+};
+
+/**
+ * Base of promise types whose frames come from FramePool. A coroutine taking
+ * (std::allocator_arg_t, FrameArena &, ...) as its leading parameters gets its frame from
+ * that arena instead; the arena must outlive the frame.
+ */
+struct PooledFramePromise {
+  static void *operator new(size_t size) {
+    return FramePool::allocate(size, nullptr);
+  }
+
+  // inlined so the frame's allocation is never a call to a template specialization, gcc would
+  // pair that by name with the usual operator delete below and warn -Wmismatched-new-delete.
+  template<typename... Args>
+  [[gnu::always_inline]] static void *operator new(size_t size, std::allocator_arg_t, FrameArena &arena, Args &&...) {
+    return FramePool::allocate(size, &arena);
+  }
+
+  static void operator delete(void *frame, size_t size) {
+    FramePool::deallocate(frame, size);
+  }
+};
+
+#endif //CPPCOROUTINES_TASKS_04_TASK_FRAMEPOOL_H_
@@ -8,30 +8,162 @@
 #include "coroutine_common.h"
 #include "Executor.h"
 #include "CommonAwaiter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 #include <thread>
+#include <vector>
 
+// a future waited for by FutureBridge.
+class WatchedFuture {
+ public:
+  // true once the future is ready and its awaiter has been resumed, it is dropped then.
+  virtual bool try_complete() = 0;
+
+ protected:
+  ~WatchedFuture() = default;
+};
+
+/**
+ * std::future cannot notify anybody, so one thread polls all the futures being awaited. It
+ * checks them right away when there is work, then backs off exponentially from kMinBackoff to
+ * kMaxBackoff while none of them gets ready, and sleeps without a timeout when there is nothing
+ * to watch. A future becomes ready for its awaiter at most kMaxBackoff late.
+ */
+class FutureBridge {
+ public:
+  static constexpr auto kMinBackoff = std::chrono::microseconds(20);
+  static constexpr auto kMaxBackoff = std::chrono::milliseconds(2);
+
+  FutureBridge() {
+    is_active.store(true, std::memory_order_relaxed);
+    work_thread = std::thread(&FutureBridge::run_loop, this);
+  }
+
+  ~FutureBridge() {
+    std::unique_lock lock(watch_lock);
+    is_active.store(false, std::memory_order_relaxed);
+    lock.unlock();
+    watch_condition.notify_one();
+    if (work_thread.joinable()) {
+      work_thread.join();
+    }
+  }
+
+  // shared by all FutureAwaiters.
+  static FutureBridge &shared_bridge() {
+    static FutureBridge bridge;
+    return bridge;
+  }
+
+  void watch(WatchedFuture *future) {
+    std::unique_lock lock(watch_lock);
+    incoming.push_back(future);
+    // a polling loop picks it up on its next round, only an idle one has to be woken up.
+    bool need_notify = is_idle;
+    is_idle = false;
+    lock.unlock();
+    if (need_notify) {
+      watch_condition.notify_one();
+    }
+  }
+
+ private:
+  std::mutex watch_lock;
+  std::condition_variable watch_condition;
+  std::vector<WatchedFuture *> incoming;
+  bool is_idle = true;
+
+  std::atomic<bool> is_active;
+  std::thread work_thread;
+
+  void run_loop() {
+    is_loop_thread() = true;
+    std::vector<WatchedFuture *> watched;
+    auto backoff = std::chrono::duration_cast<std::chrono::nanoseconds>(kMinBackoff);
+    std::unique_lock lock(watch_lock);
+    while (is_active.load(std::memory_order_relaxed)) {
+      watched.insert(watched.end(), incoming.begin(), incoming.end());
+      incoming.clear();
+      if (watched.empty()) {
+        is_idle = true;
+        watch_condition.wait(lock, [this]() { return !is_idle || !is_active.load(std::memory_order_relaxed); });
+        backoff = kMinBackoff;
+        continue;
+      }
+      lock.unlock();
+
+      // an awaiter without an executor resumes right here, it must not be touched afterwards.
+      auto completed = std::erase_if(watched, [](WatchedFuture *future) { return future->try_complete(); });
+      if (completed > 0) {
+        backoff = kMinBackoff;
+      } else {
+        backoff = std::min<std::chrono::nanoseconds>(backoff * 2, kMaxBackoff);
+      }
+
+      lock.lock();
+      if (incoming.empty() && is_active.load(std::memory_order_relaxed)) {
+        watch_condition.wait_for(lock, backoff);
+      }
+    }
+    debug("run_loop exit.");
+  }
+};
+
+/**
+ * Awaits a std::future without blocking a thread of its own: a future that is ready, or deferred,
+ * is taken right away, the others are watched by the shared FutureBridge and resumed through the
+ * executor of the awaiting coroutine. Prefer AsyncPromise where the producer can be changed, it
+ * resumes the awaiter without any polling.
+ */
 template<typename R>
-struct FutureAwaiter : public Awaiter<R> {
+struct FutureAwaiter : public Awaiter<R>, WatchedFuture {
   explicit FutureAwaiter(std::future<R> &&future) noexcept
       : _future(std::move(future)) {}
 
   FutureAwaiter(FutureAwaiter &&awaiter) noexcept
-      : Awaiter<R>(awaiter), _future(std::move(awaiter._future)) {}
+      : Awaiter<R>(std::move(awaiter)), _future(std::move(awaiter._future)) {}
 
   FutureAwaiter(FutureAwaiter &) = delete;
 
   FutureAwaiter &operator=(FutureAwaiter &) = delete;
 
+  bool await_ready() {
+    return !is_pending();
+  }
+
+  bool try_complete() override {
+    if (is_pending()) {
+      return false;
+    }
+    this->resume_unsafe();
+    return true;
+  }
+
  protected:
   void after_suspend() override {
-    std::thread([this](){
-      this->resume(this->_future.get());
-    }).detach();
+    FutureBridge::shared_bridge().watch(this);
+  }
+
+  // the future is ready, get does not block.
+  void before_resume() override {
+    if constexpr (std::is_void_v<R>) {
+      _future.get();
+      this->_result = Result<void>();
+    } else {
+      this->_result.emplace(_future.get());
+    }
   }
 
  private:
   std::future<R> _future;
+
+  bool is_pending() {
+    return _future.wait_for(std::chrono::seconds(0)) == std::future_status::timeout;
+  }
 };
 
 #endif //CPPCOROUTINES_04_TASK_FUTUREAWAITER_H_
@@ -0,0 +1,120 @@
+//
+// Created by benny on 2022/3/28.
+//
+
+#ifndef CPPCOROUTINES_TASKS_07_CHANNEL_INTRUSIVELIST_H_
+#define CPPCOROUTINES_TASKS_07_CHANNEL_INTRUSIVELIST_H_
+
+#include <cstddef>
+#include <utility>
+
+/**
+ * Links embedded in the element, so that a suspended awaiter can wait in a list
+ * without allocating a list node. An element can be in one list at a time.
+ */
+template<typename T>
+struct IntrusiveListNode {
+  T *prev = nullptr;
+  T *next = nullptr;
+
+  IntrusiveListNode() = default;
+
+  // links belong to the list, never to a copy of the element.
+  IntrusiveListNode(const IntrusiveListNode &) noexcept {}
+
+  IntrusiveListNode &operator=(const IntrusiveListNode &) noexcept { return *this; }
+};
+
+template<typename T>
+class IntrusiveList {
+ public:
+  IntrusiveList() = default;
+
+  // takes over the elements, the other list is left empty.
+  IntrusiveList(IntrusiveList &&other) noexcept
+      : head(std::exchange(other.head, nullptr)),
+        tail(std::exchange(other.tail, nullptr)),
+        count(std::exchange(other.count, 0)) {}
+
+  IntrusiveList(const IntrusiveList &) = delete;
+
+  IntrusiveList &operator=(const IntrusiveList &) = delete;
+
+  [[nodiscard]] bool empty() const {
+    return !head;
+  }
+
+  [[nodiscard]] size_t size() const {
+    return count;
+  }
+
+  T *front() const {
+    return head;
+  }
+
+  void push_back(T *element) {
+    element->prev = tail;
+    element->next = nullptr;
+    if (tail) {
+      tail->next = element;
+    } else {
+      head = element;
+    }
+    tail = element;
+    ++count;
+  }
+
+  T *pop_front() {
+    auto element = head;
+    if (element) {
+      unlink(element);
+    }
+    return element;
+  }
+
+  // returns the number of removed elements, 0 or 1, like std::list::remove.
+  size_t remove(T *element) {
+    if (element->prev || head == element) {
+      unlink(element);
+      return 1;
+    }
+    return 0;
+  }
+
+  template<typename Func>
+  void for_each(Func &&func) {
+    for (auto element = head; element;) {
+      // func may relink or resume the element.
+      auto next = element->next;
+      func(element);
+      element = next;
+    }
+  }
+
+  void clear() {
+    while (pop_front()) {}
+  }
+
+ private:
+  T *head = nullptr;
+  T *tail = nullptr;
+  size_t count = 0;
+
+  void unlink(T *element) {
+    if (element->prev) {
+      element->prev->next = element->next;
+    } else {
+      head = element->next;
+    }
+    if (element->next) {
+      element->next->prev = element->prev;
+    } else {
+      tail = element->prev;
+    }
+    element->prev = nullptr;
+    element->next = nullptr;
+    --count;
+  }
+};
+
+#endif //CPPCOROUTINES_TASKS_07_CHANNEL_INTRUSIVELIST_H_
@@ -0,0 +1,271 @@
+//
+// Created by benny on 2022/4/9.
+//
+
+#ifndef CPPCOROUTINES__LOGGER_H_
+#define CPPCOROUTINES__LOGGER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum class LogLevel : uint8_t {
+  kTrace, kDebug, kInfo, kWarn, kError, kOff
+};
+
+// the lowest level compiled in, calls below it are type checked but generate no code.
+#ifndef COROUTINE_LOG_LEVEL
+#define COROUTINE_LOG_LEVEL 1
+#endif
+
+constexpr auto kCompiledLogLevel = static_cast<LogLevel>(COROUTINE_LOG_LEVEL);
+
+/**
+ * One log call, arguments encoded as a type tag followed by the raw value. Strings are copied
+ * since they may not outlive the call, file and function names are literals and kept as pointers.
+ */
+struct LogRecord {
+  static constexpr size_t kSize = 256;
+
+  enum class ArgType : uint8_t {
+    kBool, kChar, kSigned, kUnsigned, kDouble, kPointer, kString
+  };
+
+  int64_t timestamp_ns;
+  const char *file;
+  const char *function;
+  uint32_t line;
+  LogLevel level;
+  bool is_truncated;
+  uint16_t size;
+  char payload[kSize - 32];
+};
+
+static_assert(sizeof(LogRecord) == LogRecord::kSize);
+
+/**
+ * Writes each thread's records into its own single-producer ring without locks. A background
+ * flusher drains all rings every few milliseconds, orders the records by time, formats them and
+ * writes the batch to std::cout at once. A thread that finds its ring full flushes inline, so
+ * nothing is dropped. Once exit starts, every call is flushed before it returns.
+ */
+class Logger {
+ public:
+  static void set_level(LogLevel level) {
+    runtime_level.store(level, std::memory_order_relaxed);
+  }
+
+  static bool is_enabled(LogLevel level) {
+    return level >= runtime_level.load(std::memory_order_relaxed);
+  }
+
+  template<typename ... Args>
+  static void log(LogLevel level, const char *file, int line, const char *function, const Args &... args) {
+    auto ring = local_ring();
+    if (!ring) [[unlikely]] {
+      // the thread is exiting and has released its ring.
+      LogRecord record;
+      fill(record, level, file, line, function, args...);
+      instance().write_unbuffered(record);
+      return;
+    }
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail - ring->head.load(std::memory_order_acquire) == ThreadRing::kCapacity) [[unlikely]] {
+      instance().flush_rings();
+    }
+    fill(ring->records[tail & (ThreadRing::kCapacity - 1)], level, file, line, function, args...);
+    ring->tail.store(tail + 1, std::memory_order_release);
+
+    auto &logger = instance();
+    if (logger.is_exiting.load(std::memory_order_relaxed)) [[unlikely]] {
+      logger.flush_rings();
+    } else if (!logger.is_pending.load(std::memory_order_relaxed)) {
+      logger.request_flush();
+    }
+  }
+
+  // writes everything logged so far.
+  static void flush() {
+    instance().flush_rings();
+  }
+
+ private:
+  struct ThreadRing {
+    static constexpr size_t kCapacity = 256;
+
+    std::unique_ptr<LogRecord[]> records{new LogRecord[kCapacity]};
+    std::string thread_name;
+    // set when the owning thread exits, the flusher drops the ring once it is drained.
+    std::atomic<bool> is_retired{false};
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+
+    ThreadRing();
+  };
+
+  struct RingOwner {
+    std::shared_ptr<ThreadRing> ring = std::make_shared<ThreadRing>();
+
+    RingOwner();
+
+    ~RingOwner();
+  };
+
+  static inline std::atomic<LogLevel> runtime_level{LogLevel::kTrace};
+
+  std::mutex ring_lock;
+  std::vector<std::shared_ptr<ThreadRing>> rings;
+
+  // held while draining and writing, keeps the single consumer per ring. Guards the members below.
+  std::mutex output_lock;
+  std::vector<std::shared_ptr<ThreadRing>> draining_rings;
+  std::vector<size_t> drained_tails;
+  std::vector<std::pair<const LogRecord *, const ThreadRing *>> batch;
+  std::string output_buffer;
+  int64_t cached_second = -1;
+  char cached_time[16] = {};
+
+  std::mutex flusher_lock;
+  std::condition_variable flusher_condition;
+  std::atomic<bool> is_pending{false};
+  std::atomic<bool> is_exiting{false};
+  std::thread flusher;
+
+  Logger();
+
+  static Logger &instance() {
+    // never destroyed, threads may log during static destruction.
+    static auto logger = new Logger;
+    return *logger;
+  }
+
+  static inline thread_local constinit ThreadRing *local_ring_pointer = nullptr;
+  static inline thread_local constinit bool is_ring_released = false;
+
+  static ThreadRing *local_ring() {
+    // a trivially initialized pointer keeps the TLS guard off the fast path.
+    if (!local_ring_pointer && !is_ring_released) [[unlikely]] {
+      thread_local RingOwner owner;
+      local_ring_pointer = owner.ring.get();
+    }
+    return local_ring_pointer;
+  }
+
+  void request_flush();
+
+  void run_loop();
+
+  void flush_rings();
+
+  void write_unbuffered(const LogRecord &record);
+
+  void format(const LogRecord &record, std::string_view thread_name);
+
+  void append_time(int64_t timestamp_ns);
+
+  void append_args(const LogRecord &record);
+
+  void write_output();
+
+  template<typename ... Args>
+  static void fill(LogRecord &record, LogLevel level, const char *file, int line, const char *function,
+                   const Args &... args) {
+    record.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    record.file = file;
+    record.function = function;
+    record.line = static_cast<uint32_t>(line);
+    record.level = level;
+    record.is_truncated = false;
+    record.size = 0;
+    (put(record, args) && ...);
+  }
+
+  static bool put_bytes(LogRecord &record, LogRecord::ArgType type, const void *value, size_t size) {
+    if (record.size + 1 + size > sizeof(record.payload)) {
+      record.is_truncated = true;
+      return false;
+    }
+    record.payload[record.size] = static_cast<char>(type);
+    std::memcpy(record.payload + record.size + 1, value, size);
+    record.size += 1 + size;
+    return true;
+  }
+
+  static bool put_string(LogRecord &record, std::string_view value) {
+    constexpr size_t kHeader = 1 + sizeof(uint16_t);
+    if (record.size + kHeader > sizeof(record.payload)) {
+      record.is_truncated = true;
+      return false;
+    }
+    auto length = std::min(value.size(), sizeof(record.payload) - record.size - kHeader);
+    auto length16 = static_cast<uint16_t>(length);
+    record.payload[record.size] = static_cast<char>(LogRecord::ArgType::kString);
+    std::memcpy(record.payload + record.size + 1, &length16, sizeof(length16));
+    std::memcpy(record.payload + record.size + kHeader, value.data(), length);
+    record.size += kHeader + length;
+    if (length < value.size()) {
+      record.is_truncated = true;
+      return false;
+    }
+    return true;
+  }
+
+  template<typename T>
+  static bool put(LogRecord &record, const T &value) {
+    using ArgType = LogRecord::ArgType;
+    if constexpr (std::is_same_v<T, bool>) {
+      return put_bytes(record, ArgType::kBool, &value, sizeof(value));
+    } else if constexpr (std::is_same_v<T, char>) {
+      return put_bytes(record, ArgType::kChar, &value, sizeof(value));
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+      auto widened = static_cast<int64_t>(value);
+      return put_bytes(record, ArgType::kSigned, &widened, sizeof(widened));
+    } else if constexpr (std::is_integral_v<T>) {
+      auto widened = static_cast<uint64_t>(value);
+      return put_bytes(record, ArgType::kUnsigned, &widened, sizeof(widened));
+    } else if constexpr (std::is_floating_point_v<T>) {
+      auto widened = static_cast<double>(value);
+      return put_bytes(record, ArgType::kDouble, &widened, sizeof(widened));
+    } else if constexpr (std::is_convertible_v<const T &, const char *>) {
+      const char *string = value;
+      return put_string(record, string ? std::string_view(string) : std::string_view("(null)"));
+    } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+      return put_string(record, std::string_view(value));
+    } else if constexpr (std::is_pointer_v<T>) {
+      auto address = reinterpret_cast<uintptr_t>(value);
+      return put_bytes(record, ArgType::kPointer, &address, sizeof(address));
+    } else {
+      // anything else printable is formatted on the calling thread.
+      std::ostringstream stream;
+      stream << value;
+      return put_string(record, stream.str());
+    }
+  }
+};
+
+#define COROUTINE_LOG(level, ...) \
+do {                              \
+if constexpr ((level) >= kCompiledLogLevel) { \
+if (Logger::is_enabled(level)) Logger::log((level), __FILE__, __LINE__, __func__, __VA_ARGS__); \
+}                                 \
+} while(0)
+
+#define log_trace(...) COROUTINE_LOG(LogLevel::kTrace, __VA_ARGS__)
+#define debug(...) COROUTINE_LOG(LogLevel::kDebug, __VA_ARGS__)
+#define log_info(...) COROUTINE_LOG(LogLevel::kInfo, __VA_ARGS__)
+#define log_warn(...) COROUTINE_LOG(LogLevel::kWarn, __VA_ARGS__)
+#define log_error(...) COROUTINE_LOG(LogLevel::kError, __VA_ARGS__)
+
+#endif //CPPCOROUTINES__LOGGER_H_
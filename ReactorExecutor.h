@@ -0,0 +1,369 @@
+//
+// Created by benny on 2022/4/2.
+//
+
+#ifndef CPPCOROUTINES_TASKS_10_IO_REACTOREXECUTOR_H_
+#define CPPCOROUTINES_TASKS_10_IO_REACTOREXECUTOR_H_
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Executor.h"
+#include "TimerQueue.h"
+
+/**
+ * A pending socket operation. attempt and complete are called on the reactor thread.
+ */
+struct IoOperation {
+  // performs the non-blocking syscall, returns false if it would block.
+  virtual bool attempt() = 0;
+
+  // reports the outcome of the last successful attempt.
+  virtual void complete() = 0;
+
+  // completes the operation with error instead, it will not be attempted again.
+  virtual void fail(int error) = 0;
+};
+
+class ReactorExecutor;
+
+/**
+ * Registration of one fd in the reactor, with at most one pending reader and one pending writer.
+ * Owned by Socket, released on the reactor thread.
+ */
+struct IoChannel {
+  enum Direction { kRead, kWrite };
+
+  ReactorExecutor *reactor;
+  int fd;
+  IoOperation *operations[2]{nullptr, nullptr};
+};
+
+/**
+ * An executor whose loop thread waits in epoll: executables from other threads wake it through an
+ * eventfd, delayed executables through a timerfd, and socket readiness resumes the IoOperation
+ * waiting on it. See SocketAwaiter.h.
+ */
+class ReactorExecutor : public AbstractExecutor {
+ private:
+  int epoll_fd;
+  int event_fd;
+  int timer_fd;
+
+  std::mutex queue_lock;
+  std::vector<Executable> executable_queue;
+  // true while the loop may block in epoll_wait, execute only writes the eventfd then.
+  std::atomic<bool> is_polling{false};
+
+  // owned by the loop thread.
+  HeapTimerQueue timer_queue;
+  TimerClock::time_point armed_deadline = TimerClock::time_point::max();
+
+  std::atomic<bool> is_active;
+  std::atomic<bool> discard_pending{false};
+  std::thread work_thread;
+
+  // unregistered after the loop stopped taking executables, released once it has exited.
+  std::vector<IoChannel *> released_after_join;
+
+  static void check(int result, const char *what) {
+    if (result < 0) {
+      throw std::system_error(errno, std::generic_category(), what);
+    }
+  }
+
+  void add_to_epoll(int fd, uint32_t events, void *data) {
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = data;
+    check(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event), "epoll_ctl");
+  }
+
+  void arm_timer() {
+    auto deadline = timer_queue.empty() ? TimerClock::time_point::max() : timer_queue.next_deadline();
+    if (deadline == armed_deadline) {
+      return;
+    }
+    armed_deadline = deadline;
+
+    itimerspec spec{};
+    if (deadline != TimerClock::time_point::max()) {
+      // steady_clock is CLOCK_MONOTONIC, a zero it_value would disarm the timer instead.
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+      if (ns <= 0) ns = 1;
+      spec.it_value.tv_sec = ns / 1000000000;
+      spec.it_value.tv_nsec = ns % 1000000000;
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+  }
+
+  void run_timers(std::vector<Executable> &expired) {
+    if (timer_queue.empty()) {
+      return;
+    }
+    timer_queue.pop_expired(TimerClock::now(), expired);
+    arm_timer();
+    for (auto &executable : expired) {
+      if (!discard_pending.load(std::memory_order_relaxed)) {
+        executable();
+      }
+    }
+    expired.clear();
+  }
+
+  bool run_queued(std::vector<Executable> &executables) {
+    std::unique_lock lock(queue_lock);
+    std::swap(executables, executable_queue);
+    lock.unlock();
+    if (executables.empty()) {
+      return false;
+    }
+    for (auto &executable : executables) {
+      if (!discard_pending.load(std::memory_order_relaxed)) {
+        executable();
+      }
+    }
+    executables.clear();
+    return true;
+  }
+
+  bool has_queued() {
+    std::lock_guard lock(queue_lock);
+    return !executable_queue.empty();
+  }
+
+  void dispatch_io(IoChannel *channel, uint32_t events) {
+    constexpr uint32_t kFailure = EPOLLERR | EPOLLHUP;
+    if (events & (EPOLLIN | EPOLLRDHUP | kFailure)) {
+      try_complete(channel, IoChannel::kRead);
+    }
+    if (events & (EPOLLOUT | kFailure)) {
+      try_complete(channel, IoChannel::kWrite);
+    }
+  }
+
+  // fails the pending operations, then closes the fd. Called on the loop thread or after join.
+  static void release(IoChannel *channel) {
+    for (auto &operation : channel->operations) {
+      if (auto pending = std::exchange(operation, nullptr)) {
+        pending->fail(ECANCELED);
+      }
+    }
+    close(channel->fd);
+    delete channel;
+  }
+
+  static void try_complete(IoChannel *channel, IoChannel::Direction direction) {
+    auto operation = channel->operations[direction];
+    if (operation && operation->attempt()) {
+      channel->operations[direction] = nullptr;
+      operation->complete();
+    }
+  }
+
+  void run_loop() {
+    is_loop_thread() = true;
+    constexpr int kMaxEvents = 128;
+    epoll_event events[kMaxEvents];
+    std::vector<Executable> executables;
+    std::vector<Executable> expired;
+
+    while (true) {
+      bool has_run = run_queued(executables);
+      run_timers(expired);
+      if (has_run) {
+        continue;
+      }
+
+      if (!is_active.load()) {
+        // keep polling only for the timers shutdown(true) waits for.
+        if (discard_pending.load(std::memory_order_relaxed) || (timer_queue.empty() && !has_queued())) break;
+      }
+
+      // pairs with the push in execute: either it sees us polling or we see its executable.
+      is_polling.store(true);
+      int timeout = has_queued() ? 0 : -1;
+      int count = epoll_wait(epoll_fd, events, kMaxEvents, timeout);
+      is_polling.store(false, std::memory_order_relaxed);
+
+      for (int i = 0; i < count; ++i) {
+        auto data = events[i].data.ptr;
+        if (data == &event_fd) {
+          uint64_t value;
+          [[maybe_unused]] auto n = read(event_fd, &value, sizeof(value));
+        } else if (data == &timer_fd) {
+          uint64_t value;
+          [[maybe_unused]] auto n = read(timer_fd, &value, sizeof(value));
+          armed_deadline = TimerClock::time_point::max();
+        } else {
+          dispatch_io(static_cast<IoChannel *>(data), events[i].events);
+        }
+      }
+    }
+    debug("run_loop exit.");
+  }
+
+  void wake_up() {
+    if (is_polling.load() && is_polling.exchange(false)) {
+      uint64_t value = 1;
+      [[maybe_unused]] auto n = write(event_fd, &value, sizeof(value));
+    }
+  }
+
+  // runs func on the loop thread, returns false if the reactor does not accept executables anymore.
+  template<typename Func>
+  bool run_in_loop(Func &&func) {
+    if (is_executor_thread()) {
+      func();
+      return true;
+    }
+    if (!is_active.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    execute(std::forward<Func>(func));
+    return true;
+  }
+
+ public:
+
+  ReactorExecutor() {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    check(epoll_fd, "epoll_create1");
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    check(event_fd, "eventfd");
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    check(timer_fd, "timerfd_create");
+    add_to_epoll(event_fd, EPOLLIN, &event_fd);
+    add_to_epoll(timer_fd, EPOLLIN, &timer_fd);
+
+    is_active.store(true, std::memory_order_relaxed);
+    work_thread = std::thread(&ReactorExecutor::run_loop, this);
+  }
+
+  ~ReactorExecutor() {
+    shutdown(false);
+    join();
+    for (auto channel : released_after_join) {
+      release(channel);
+    }
+    close(timer_fd);
+    close(event_fd);
+    close(epoll_fd);
+  }
+
+  void execute(Executable &&func) override {
+    if (is_active.load(std::memory_order_relaxed)) {
+      std::unique_lock lock(queue_lock);
+      executable_queue.push_back(std::move(func));
+      lock.unlock();
+      wake_up();
+    }
+  }
+
+  // runs func on the loop thread after delay, false if the reactor is shut down.
+  bool execute(Executable &&func, TimerClock::duration delay) {
+    auto scheduled_time = TimerClock::now() + delay;
+    return run_in_loop([this, scheduled_time, func = std::move(func)]() mutable {
+      timer_queue.push(std::move(func), scheduled_time);
+      arm_timer();
+    });
+  }
+
+  // sleeps on the reactor fire from its timerfd instead of the shared Scheduler.
+  bool execute_after(Executable &&func, TimerClock::duration delay) override {
+    return execute(std::move(func), delay);
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return std::this_thread::get_id() == work_thread.get_id();
+  }
+
+  [[nodiscard]] bool joins_on_destruction() const override {
+    return true;
+  }
+
+  IoChannel *register_fd(int fd) {
+    auto channel = new IoChannel{this, fd};
+    try {
+      add_to_epoll(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, channel);
+    } catch (...) {
+      delete channel;
+      throw;
+    }
+    return channel;
+  }
+
+  // stops watching the fd, then fails its pending operations with ECANCELED, closes it and
+  // releases the channel on the loop thread, once no event can refer to it.
+  void unregister_fd(IoChannel *channel) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, channel->fd, nullptr);
+    // the events of the current epoll batch are dispatched before queued executables.
+    if (!run_in_loop([channel]() { release(channel); })) {
+      // the loop may still be running, the destructor releases the channel after join.
+      std::lock_guard lock(queue_lock);
+      released_after_join.push_back(channel);
+    }
+  }
+
+  // attempts the operation once more on the loop thread and parks it until the fd is ready.
+  void submit(IoChannel *channel, IoChannel::Direction direction, IoOperation *operation) {
+    bool submitted = run_in_loop([channel, direction, operation]() {
+      if (operation->attempt()) {
+        operation->complete();
+      } else {
+        channel->operations[direction] = operation;
+      }
+    });
+    if (!submitted) {
+      // the reactor is shut down, nothing would ever complete the operation.
+      operation->fail(ECANCELED);
+    }
+  }
+
+  void shutdown(bool wait_for_complete = true) {
+    is_active.store(false);
+    if (!wait_for_complete) {
+      discard_pending.store(true, std::memory_order_relaxed);
+    }
+    uint64_t value = 1;
+    [[maybe_unused]] auto n = write(event_fd, &value, sizeof(value));
+  }
+
+  void join() {
+    if (work_thread.joinable() && !is_executor_thread()) {
+      work_thread.join();
+    }
+  }
+};
+
+class SharedReactorExecutor : public AbstractExecutor {
+ public:
+  static ReactorExecutor &shared_executor() {
+    static ReactorExecutor sharedReactorExecutor;
+    return sharedReactorExecutor;
+  }
+
+  void execute(Executable &&func) override {
+    shared_executor().execute(std::move(func));
+  }
+
+  bool execute_after(Executable &&func, TimerClock::duration delay) override {
+    return shared_executor().execute_after(std::move(func), delay);
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return shared_executor().is_executor_thread();
+  }
+};
+
+#endif //CPPCOROUTINES_TASKS_10_IO_REACTOREXECUTOR_H_
@@ -6,25 +6,42 @@
 #define CPPCOROUTINES_04_TASK_RESULT_H_
 
 #include <exception>
+#include <optional>
+#include <utility>
 
+/**
+ * Holds a value or an exception. T needs neither a default constructor nor a copy constructor,
+ * get_or_throw on an rvalue Result moves the value out.
+ */
 template<typename T>
 struct Result {
 
-  explicit Result() = default;
+  explicit Result(T &&value) : _value(std::move(value)) {}
 
-  explicit Result(T &&value) : _value(value) {}
+  explicit Result(const T &value) : _value(value) {}
 
   explicit Result(std::exception_ptr &&exception_ptr) : _exception_ptr(exception_ptr) {}
 
-  T get_or_throw() {
+  T get_or_throw() & {
+    if (_exception_ptr) {
+      std::rethrow_exception(_exception_ptr);
+    }
+    return *_value;
+  }
+
+  T get_or_throw() && {
     if (_exception_ptr) {
       std::rethrow_exception(_exception_ptr);
     }
-    return _value;
+    return std::move(*_value);
+  }
+
+  [[nodiscard]] std::exception_ptr exception() const {
+    return _exception_ptr;
   }
 
  private:
-  T _value{};
+  std::optional<T> _value;
   std::exception_ptr _exception_ptr;
 };
 
@@ -41,6 +58,10 @@ struct Result<void> {
     }
   }
 
+  [[nodiscard]] std::exception_ptr exception() const {
+    return _exception_ptr;
+  }
+
  private:
   std::exception_ptr _exception_ptr;
 };
@@ -0,0 +1,342 @@
+//
+// Created by benny on 2022/4/6.
+//
+
+#ifndef CPPCOROUTINES_TASKS_07_CHANNEL_RINGCHANNEL_H_
+#define CPPCOROUTINES_TASKS_07_CHANNEL_RINGCHANNEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+
+#include "coroutine_common.h"
+#include "ChannelAwaiter.h"
+#include "IntrusiveList.h"
+
+template<typename ValueType>
+struct RingSlot {
+  std::atomic<size_t> sequence;
+  alignas(ValueType) unsigned char storage[sizeof(ValueType)];
+
+  ValueType *value() {
+    return std::launder(reinterpret_cast<ValueType *>(storage));
+  }
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue after Dmitry Vyukov: each slot carries a sequence
+ * number telling whether it is free for the producer or filled for the consumer of a lap,
+ * so producers and consumers only contend on their own position counter.
+ */
+template<typename ValueType>
+class MpmcRing {
+ public:
+  explicit MpmcRing(size_t capacity) : mask(capacity - 1), slots(new RingSlot<ValueType>[capacity]) {
+    for (size_t i = 0; i < capacity; ++i) {
+      slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MpmcRing() {
+    while (try_pop()) {}
+  }
+
+  // moves value into the ring, leaves it untouched if the ring is full.
+  bool try_push(ValueType &value) {
+    auto position = enqueue_position.load(std::memory_order_relaxed);
+    while (true) {
+      auto &slot = slots[position & mask];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (diff == 0) {
+        if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          new(slot.storage) ValueType(std::move(value));
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = enqueue_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  std::optional<ValueType> try_pop() {
+    auto position = dequeue_position.load(std::memory_order_relaxed);
+    while (true) {
+      auto &slot = slots[position & mask];
+      auto sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+      if (diff == 0) {
+        if (dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          std::optional<ValueType> value(std::move(*slot.value()));
+          slot.value()->~ValueType();
+          slot.sequence.store(position + mask + 1, std::memory_order_release);
+          return value;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;
+      } else {
+        position = dequeue_position.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+ private:
+  size_t mask;
+  std::unique_ptr<RingSlot<ValueType>[]> slots;
+  alignas(64) std::atomic<size_t> enqueue_position{0};
+  alignas(64) std::atomic<size_t> dequeue_position{0};
+};
+
+/**
+ * Bounded queue for exactly one producer and one consumer at a time, no read-modify-write on
+ * the fast path.
+ */
+template<typename ValueType>
+class SpscRing {
+ public:
+  explicit SpscRing(size_t capacity) : mask(capacity - 1), slots(new RingSlot<ValueType>[capacity]) {}
+
+  ~SpscRing() {
+    while (try_pop()) {}
+  }
+
+  bool try_push(ValueType &value) {
+    auto tail = tail_position.load(std::memory_order_relaxed);
+    if (tail - head_position.load(std::memory_order_acquire) > mask) {
+      return false;
+    }
+    new(slots[tail & mask].storage) ValueType(std::move(value));
+    tail_position.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<ValueType> try_pop() {
+    auto head = head_position.load(std::memory_order_relaxed);
+    if (head == tail_position.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    auto &slot = slots[head & mask];
+    std::optional<ValueType> value(std::move(*slot.value()));
+    slot.value()->~ValueType();
+    head_position.store(head + 1, std::memory_order_release);
+    return value;
+  }
+
+  // exact for the consumer, a hint for anybody else.
+  [[nodiscard]] bool empty() const {
+    return head_position.load(std::memory_order_relaxed) == tail_position.load(std::memory_order_acquire);
+  }
+
+ private:
+  size_t mask;
+  std::unique_ptr<RingSlot<ValueType>[]> slots;
+  alignas(64) std::atomic<size_t> head_position{0};
+  alignas(64) std::atomic<size_t> tail_position{0};
+};
+
+/**
+ * A buffered channel on a lock-free ring. write and read complete without suspending while the
+ * ring has room or values, the waiter lists and their lock are only used by coroutines that
+ * have to wait and by whoever wakes them up. Waiting writers may be overtaken by writers that
+ * find room in the ring.
+ *
+ * The capacity is rounded up to a power of two of at least 2, use Channel for rendezvous.
+ * With SpscRing at most one coroutine may write and one may read at a time.
+ */
+template<typename ValueType, typename Ring = MpmcRing<ValueType>>
+class RingChannel {
+ public:
+  using Writer = WriterAwaiter<ValueType, RingChannel>;
+  using Reader = ReaderAwaiter<ValueType, RingChannel>;
+
+  struct ChannelClosedException : std::exception {
+    const char *what() const noexcept override {
+      return "Channel is closed.";
+    }
+  };
+
+  void check_closed() {
+    if (!_is_active.load(std::memory_order_relaxed)) {
+      throw ChannelClosedException();
+    }
+  }
+
+  // moves value into the channel unless it is full.
+  bool try_write(ValueType &value) {
+    if (!ring.try_push(value)) {
+      return false;
+    }
+    // pairs with the fence in try_push_reader: either we see the reader or it sees our value.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (reader_waiting.load(std::memory_order_relaxed) > 0) {
+      std::unique_lock lock(waiter_lock);
+      transfer(lock);
+    }
+    return true;
+  }
+
+  std::optional<ValueType> try_read() {
+    auto value = ring.try_pop();
+    if (value) {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (writer_waiting.load(std::memory_order_relaxed) > 0) {
+        std::unique_lock lock(waiter_lock);
+        transfer(lock);
+      }
+    }
+    return value;
+  }
+
+  void try_push_writer(Writer *writer_awaiter) {
+    std::unique_lock lock(waiter_lock);
+    check_closed();
+    writer_list.push_back(writer_awaiter);
+    writer_waiting.store(writer_list.size(), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    transfer(lock);
+  }
+
+  void try_push_reader(Reader *reader_awaiter) {
+    std::unique_lock lock(waiter_lock);
+    check_closed();
+    reader_list.push_back(reader_awaiter);
+    reader_waiting.store(reader_list.size(), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    transfer(lock);
+  }
+
+  void remove_writer(Writer *writer_awaiter) {
+    std::lock_guard lock(waiter_lock);
+    auto size = writer_list.remove(writer_awaiter);
+    writer_waiting.store(writer_list.size(), std::memory_order_relaxed);
+    debug("remove writer ", size);
+  }
+
+  void remove_reader(Reader *reader_awaiter) {
+    std::lock_guard lock(waiter_lock);
+    auto size = reader_list.remove(reader_awaiter);
+    reader_waiting.store(reader_list.size(), std::memory_order_relaxed);
+    debug("remove reader ", size);
+  }
+
+  auto write(ValueType value) {
+    check_closed();
+    return Writer{this, std::move(value)};
+  }
+
+  auto operator<<(ValueType value) {
+    return write(std::move(value));
+  }
+
+  auto read() {
+    check_closed();
+    return Reader{this};
+  }
+
+  auto operator>>(ValueType &value_ref) {
+    auto awaiter = read();
+    awaiter.p_value = &value_ref;
+    return awaiter;
+  }
+
+  void close() {
+    bool expect = true;
+    if (_is_active.compare_exchange_strong(expect, false, std::memory_order_relaxed)) {
+      clean_up();
+    }
+  }
+
+  explicit RingChannel(size_t capacity) : ring(std::bit_ceil(std::max<size_t>(capacity, 2))) {
+    _is_active.store(true, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] bool is_active() const {
+    return _is_active.load(std::memory_order_relaxed);
+  }
+
+  RingChannel(RingChannel &&channel) = delete;
+
+  RingChannel(RingChannel &) = delete;
+
+  RingChannel &operator=(RingChannel &) = delete;
+
+  ~RingChannel() {
+    close();
+  }
+
+ private:
+  Ring ring;
+
+  std::mutex waiter_lock;
+  // holds Writer and Reader awaiters only.
+  IntrusiveList<PendingWriter<ValueType>> writer_list;
+  IntrusiveList<PendingReader<ValueType>> reader_list;
+  // list sizes, read without the lock by the fast paths.
+  std::atomic<size_t> writer_waiting{0};
+  std::atomic<size_t> reader_waiting{0};
+
+  std::atomic<bool> _is_active;
+
+  // moves values of waiting writers into the ring and values of the ring to waiting readers,
+  // then resumes them without the lock, they may run inline and use the channel again.
+  void transfer(std::unique_lock<std::mutex> &lock) {
+    IntrusiveList<PendingWriter<ValueType>> resumed_writers;
+    IntrusiveList<PendingReader<ValueType>> resumed_readers;
+    bool has_progress = true;
+    while (has_progress) {
+      has_progress = false;
+      while (!writer_list.empty() && ring.try_push(static_cast<Writer *>(writer_list.front())->_value)) {
+        resumed_writers.push_back(writer_list.pop_front());
+        has_progress = true;
+      }
+      while (!reader_list.empty()) {
+        auto value = ring.try_pop();
+        if (!value) break;
+        auto reader = reader_list.pop_front();
+        reader->give(std::move(*value));
+        resumed_readers.push_back(reader);
+        has_progress = true;
+      }
+    }
+    writer_waiting.store(writer_list.size(), std::memory_order_relaxed);
+    reader_waiting.store(reader_list.size(), std::memory_order_relaxed);
+    lock.unlock();
+
+    while (auto writer = resumed_writers.pop_front()) {
+      writer->wake();
+    }
+    while (auto reader = resumed_readers.pop_front()) {
+      reader->wake();
+    }
+  }
+
+  void clean_up() {
+    std::unique_lock lock(waiter_lock);
+    auto writers = std::move(writer_list);
+    auto readers = std::move(reader_list);
+    writer_waiting.store(0, std::memory_order_relaxed);
+    reader_waiting.store(0, std::memory_order_relaxed);
+    lock.unlock();
+
+    while (auto writer = writers.pop_front()) {
+      writer->wake();
+    }
+    while (auto reader = readers.pop_front()) {
+      reader->wake();
+    }
+  }
+};
+
+template<typename ValueType>
+using SpscChannel = RingChannel<ValueType, SpscRing<ValueType>>;
+
+#endif //CPPCOROUTINES_TASKS_07_CHANNEL_RINGCHANNEL_H_
@@ -7,103 +7,107 @@
 
 #include <mutex>
 #include <condition_variable>
-#include <queue>
-#include <functional>
+#include <atomic>
 #include <chrono>
+#include <thread>
+#include <vector>
 
+#include "Executable.h"
+#include "ExecutorMetrics.h"
+#include "TimerQueue.h"
 #include "io_utils.h"
 
-class DelayedExecutable {
- public:
-  DelayedExecutable(std::function<void()> &&func, long long delay) : func(std::move(func)) {
-    using namespace std;
-    using namespace std::chrono;
-    auto now = system_clock::now();
-    auto current = duration_cast<milliseconds>(now.time_since_epoch()).count();
-
-    scheduled_time = current + delay;
-  }
-
-  long long delay() const {
-    using namespace std;
-    using namespace std::chrono;
-
-    auto now = system_clock::now();
-    auto current = duration_cast<milliseconds>(now.time_since_epoch()).count();
-    return scheduled_time - current;
-  }
-
-  long long get_scheduled_time() const {
-    return scheduled_time;
-  }
-
-  void operator()() {
-    func();
-  }
-
- private:
-  long long scheduled_time;
-  std::function<void()> func;
-};
-
-class DelayedExecutableCompare {
- public:
-  bool operator()(DelayedExecutable &left, DelayedExecutable &right) {
-    return left.get_scheduled_time() > right.get_scheduled_time();
-  }
-};
-
-class Scheduler {
+/**
+ * Runs executables after a delay on its own thread. TimerQueue is HeapTimerQueue or
+ * TimingWheelTimerQueue, see TimerQueue.h.
+ */
+template<typename TimerQueue>
+class BasicScheduler {
  private:
   std::condition_variable queue_condition;
   std::mutex queue_lock;
-  std::priority_queue<DelayedExecutable, std::vector<DelayedExecutable>, DelayedExecutableCompare> executable_queue;
+  TimerQueue executable_queue;
+  // the time the loop is sleeping until, a new executable due earlier has to wake it up.
+  TimerClock::time_point wake_time = TimerClock::time_point::max();
 
   std::atomic<bool> is_active;
   std::thread work_thread;
 
+  ExecutorMetricsSlot metrics;
+
   void run_loop() {
+    is_loop_thread() = true;
+    std::vector<Executable> expired;
+    std::vector<TimerClock::time_point> scheduled_times;
+    std::unique_lock lock(queue_lock);
     while (is_active.load(std::memory_order_relaxed) || !executable_queue.empty()) {
-      std::unique_lock lock(queue_lock);
       if (executable_queue.empty()) {
+        wake_time = TimerClock::time_point::max();
         queue_condition.wait(lock);
-        if (executable_queue.empty()) {
-          continue;
-        }
+        continue;
       }
-      auto executable = executable_queue.top();
-      long long delay = executable.delay();
-      if (delay > 0) {
-        auto status = queue_condition.wait_for(lock, std::chrono::milliseconds(delay));
-        if (status != std::cv_status::timeout) {
-          // a new executable should be executed before.
-          continue;
-        }
+
+      auto now = TimerClock::now();
+      auto deadline = executable_queue.next_deadline();
+      if (deadline > now) {
+        wake_time = deadline;
+        // woken up early if a new executable should be executed before.
+        queue_condition.wait_until(lock, deadline);
+        continue;
       }
-      executable_queue.pop();
+
+      wake_time = TimerClock::time_point::min();
+      auto current_metrics = metrics.get();
+      executable_queue.pop_expired(now, expired, current_metrics ? &scheduled_times : nullptr);
       lock.unlock();
-      executable();
+      if (current_metrics) {
+        run_measured(current_metrics, expired, scheduled_times);
+      } else {
+        for (auto &executable : expired) {
+          executable();
+        }
+      }
+      expired.clear();
+      scheduled_times.clear();
+      lock.lock();
     }
     debug("run_loop exit.");
   }
+
+  static void run_measured(ExecutorMetrics *current_metrics, std::vector<Executable> &expired,
+                           std::vector<TimerClock::time_point> &scheduled_times) {
+    auto &histograms = current_metrics->thread(0);
+    for (size_t i = 0; i < expired.size(); ++i) {
+      auto start = TimerClock::now();
+      histograms.timer_lateness.record(start - scheduled_times[i]);
+      expired[i]();
+      histograms.run_time.record(TimerClock::now() - start);
+    }
+  }
  public:
 
-  Scheduler() {
+  BasicScheduler() {
     is_active.store(true, std::memory_order_relaxed);
-    work_thread = std::thread(&Scheduler::run_loop, this);
+    work_thread = std::thread(&BasicScheduler::run_loop, this);
   }
 
-  ~Scheduler() {
+  ~BasicScheduler() {
     shutdown(false);
     join();
   }
 
-  void execute(std::function<void()> &&func, long long delay) {
-    delay = delay < 0 ? 0 : delay;
+  void execute(Executable &&func, TimerClock::duration delay) {
+    if (delay < TimerClock::duration::zero()) {
+      delay = TimerClock::duration::zero();
+    }
+    auto scheduled_time = TimerClock::now() + delay;
     std::unique_lock lock(queue_lock);
     if (is_active.load(std::memory_order_relaxed)) {
-      bool need_notify = executable_queue.empty() || executable_queue.top().delay() > delay;
-      executable_queue.push(DelayedExecutable(std::move(func), delay));
+      bool need_notify = scheduled_time < wake_time;
+      executable_queue.push(std::move(func), scheduled_time);
+      if (auto current_metrics = metrics.get()) {
+        current_metrics->record_depth(executable_queue.size());
+      }
       lock.unlock();
       if (need_notify) {
         queue_condition.notify_one();
@@ -111,15 +115,34 @@ class Scheduler {
     }
   }
 
+  // delay in milliseconds.
+  void execute(Executable &&func, long long delay) {
+    execute(std::move(func), std::chrono::milliseconds(delay));
+  }
+
+  void enable_metrics() {
+    metrics.enable();
+  }
+
+  // queue_depth is the number of pending executables, timer_lateness and run_time are recorded.
+  [[nodiscard]] std::optional<ExecutorMetricsSnapshot> metrics_snapshot() {
+    auto snapshot = metrics.snapshot();
+    if (snapshot) {
+      std::lock_guard lock(queue_lock);
+      snapshot->queue_depth = executable_queue.size();
+      snapshot->peak_queue_depth = std::max(snapshot->peak_queue_depth, snapshot->queue_depth);
+    }
+    return snapshot;
+  }
+
   void shutdown(bool wait_for_complete = true) {
     is_active.store(false, std::memory_order_relaxed);
+    std::unique_lock lock(queue_lock);
     if (!wait_for_complete) {
       // clear queue.
-      std::unique_lock lock(queue_lock);
-      decltype(executable_queue) empty_queue;
-      std::swap(executable_queue, empty_queue);
-      lock.unlock();
+      executable_queue.clear();
     }
+    lock.unlock();
 
     queue_condition.notify_all();
   }
@@ -131,4 +154,14 @@ class Scheduler {
   }
 };
 
+// define COROUTINE_TIMING_WHEEL_SCHEDULER to back sleeping coroutines with the timing wheel.
+#ifdef COROUTINE_TIMING_WHEEL_SCHEDULER
+using Scheduler = BasicScheduler<TimingWheelTimerQueue>;
+#else
+using Scheduler = BasicScheduler<HeapTimerQueue>;
+#endif
+
+using HeapScheduler = BasicScheduler<HeapTimerQueue>;
+using TimingWheelScheduler = BasicScheduler<TimingWheelTimerQueue>;
+
 #endif //CPPCOROUTINES_TASKS_04_TASK_SCHEDULER_H_
@@ -0,0 +1,376 @@
+//
+// Created by benny on 2022/4/11.
+//
+
+#ifndef CPPCOROUTINES_TASKS_08_CHANNEL_SELECT_H_
+#define CPPCOROUTINES_TASKS_08_CHANNEL_SELECT_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <variant>
+
+#include "Channel.h"
+#include "ChannelAwaiter.h"
+#include "CommonAwaiter.h"
+#include "SleepAwaiter.h"
+
+// the result of a select whose write case or timeout fired.
+struct SelectWritten {};
+struct SelectTimeout {};
+
+/**
+ * The case that won a select. A pending timeout shares it, since its timer may fire after the
+ * select has completed.
+ */
+struct SelectClaim {
+  static constexpr size_t kNone = SIZE_MAX;
+
+  std::atomic<size_t> winner{kNone};
+
+  // true if the case won, now or earlier.
+  bool try_claim(size_t index) {
+    auto expected = kNone;
+    return winner.compare_exchange_strong(expected, index, std::memory_order_acq_rel) || expected == index;
+  }
+};
+
+class SelectState {
+ public:
+  SelectClaim *claim = nullptr;
+
+  // the winning case and the end of the registration both report, the second one resumes.
+  void report() {
+    if (pending_reports.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      on_ready();
+    }
+  }
+
+ protected:
+  std::atomic<int> pending_reports{2};
+
+  virtual void on_ready() = 0;
+};
+
+template<typename ValueType>
+struct SelectReadCase : PendingReader<ValueType> {
+  using ResultType = ValueType;
+  using ChannelType = Channel<ValueType>;
+
+  ChannelType *channel;
+  SelectState *state = nullptr;
+  size_t index = 0;
+  std::optional<ValueType> value;
+  std::optional<typename ChannelType::ResumedWaiters> resumed;
+
+  explicit SelectReadCase(ReaderAwaiter<ValueType, ChannelType> &&awaiter)
+      : channel(std::exchange(awaiter.channel, nullptr)) {}
+
+  // cases are only moved before they are registered.
+  SelectReadCase(SelectReadCase &&other) noexcept: channel(other.channel) {}
+
+  bool claim() override {
+    return state->claim->try_claim(index);
+  }
+
+  size_t wanted() const override {
+    return value ? 0 : 1;
+  }
+
+  size_t missing() const override {
+    return wanted();
+  }
+
+  void give(ValueType &&new_value) override {
+    value.emplace(std::move(new_value));
+  }
+
+  void wake() override {
+    state->report();
+  }
+
+  std::mutex &mutex() {
+    return channel->select_mutex();
+  }
+
+  bool try_complete_locked() {
+    return channel->try_read_locked(this);
+  }
+
+  void push_locked() {
+    channel->push_reader_locked(this);
+  }
+
+  void cancel() {
+    channel->remove_reader(this);
+  }
+
+  ResultType take_result() {
+    // woken up without a value: the channel was closed.
+    if (!value) channel->check_closed();
+    return std::move(*value);
+  }
+};
+
+template<typename ValueType>
+struct SelectWriteCase : PendingWriter<ValueType> {
+  using ResultType = SelectWritten;
+  using ChannelType = Channel<ValueType>;
+
+  ChannelType *channel;
+  SelectState *state = nullptr;
+  size_t index = 0;
+  ValueType value;
+  bool is_taken = false;
+  std::optional<typename ChannelType::ResumedWaiters> resumed;
+
+  explicit SelectWriteCase(WriterAwaiter<ValueType, ChannelType> &&awaiter)
+      : channel(std::exchange(awaiter.channel, nullptr)), value(std::move(awaiter._value)) {}
+
+  SelectWriteCase(SelectWriteCase &&other) noexcept: channel(other.channel), value(std::move(other.value)) {}
+
+  bool claim() override {
+    return state->claim->try_claim(index);
+  }
+
+  size_t remaining() const override {
+    return is_taken ? 0 : 1;
+  }
+
+  ValueType &&take() override {
+    is_taken = true;
+    return std::move(value);
+  }
+
+  void wake() override {
+    state->report();
+  }
+
+  std::mutex &mutex() {
+    return channel->select_mutex();
+  }
+
+  bool try_complete_locked() {
+    return channel->try_write_locked(this);
+  }
+
+  void push_locked() {
+    channel->push_writer_locked(this);
+  }
+
+  void cancel() {
+    channel->remove_writer(this);
+  }
+
+  ResultType take_result() {
+    if (!is_taken) channel->check_closed();
+    return {};
+  }
+};
+
+struct SelectTimeoutCase {
+  using ResultType = SelectTimeout;
+
+  TimerClock::duration delay;
+
+  template<typename Rep, typename Period>
+  explicit SelectTimeoutCase(std::chrono::duration<Rep, Period> delay)
+      : delay(std::chrono::duration_cast<TimerClock::duration>(delay)) {}
+
+  void schedule(SelectState *state, std::shared_ptr<SelectClaim> claim, size_t index) {
+    // the select may be gone when the timer fires, only the claim is kept alive for it.
+    SleepAwaiter::current_scheduler().execute([state, claim = std::move(claim), index]() {
+      if (claim->try_claim(index)) {
+        state->report();
+      }
+    }, delay);
+  }
+
+  ResultType take_result() {
+    return {};
+  }
+};
+
+template<typename Case>
+concept SelectChannelCase = requires(Case &select_case) {
+  select_case.try_complete_locked();
+};
+
+template<typename Argument>
+struct SelectCaseOf;
+
+template<typename ValueType>
+struct SelectCaseOf<ReaderAwaiter<ValueType, Channel<ValueType>>> {
+  using type = SelectReadCase<ValueType>;
+};
+
+template<typename ValueType>
+struct SelectCaseOf<WriterAwaiter<ValueType, Channel<ValueType>>> {
+  using type = SelectWriteCase<ValueType>;
+};
+
+template<typename Rep, typename Period>
+struct SelectCaseOf<std::chrono::duration<Rep, Period>> {
+  using type = SelectTimeoutCase;
+};
+
+/**
+ * Waits for the first of several channel operations, like Go's select. The result is a variant
+ * whose index() is the case that fired: the value for a read, SelectWritten for a write and
+ * SelectTimeout for a timeout. The other cases do nothing, a losing write keeps its value.
+ *
+ * The select locks all of its channels in address order, completes the first case that is ready,
+ * in argument order, or else parks one waiter per case. A channel serving a parked case claims the
+ * select first and drops the waiter instead if another case has won, so every value either goes
+ * to the winner or stays in its channel. A closed channel fires its case with
+ * ChannelClosedException.
+ */
+template<typename ... Cases>
+class SelectAwaiter : public Awaiter<std::variant<typename Cases::ResultType...>>, SelectState {
+ public:
+  using ResultType = std::variant<typename Cases::ResultType...>;
+
+  template<typename ... Arguments>
+  explicit SelectAwaiter(Arguments &&... arguments) : cases(std::forward<Arguments>(arguments)...) {}
+
+  SelectAwaiter(SelectAwaiter &&other) noexcept
+      : Awaiter<ResultType>(std::move(other)), cases(std::move(other.cases)) {}
+
+  void after_suspend() override {
+    using namespace std;
+    claim = &local_claim;
+    if constexpr ((is_same_v<Cases, SelectTimeoutCase> || ...)) {
+      shared_claim = make_shared<SelectClaim>();
+      claim = shared_claim.get();
+    }
+    apply_cases([this]<size_t I>(auto &select_case) {
+      if constexpr (SelectChannelCase<remove_reference_t<decltype(select_case)>>) {
+        select_case.state = this;
+        select_case.index = I;
+      }
+    });
+
+    lock_channels();
+    size_t ready_case = SelectClaim::kNone;
+    apply_cases([&ready_case]<size_t I>(auto &select_case) {
+      if constexpr (SelectChannelCase<remove_reference_t<decltype(select_case)>>) {
+        if (ready_case == SelectClaim::kNone && select_case.try_complete_locked()) {
+          ready_case = I;
+        }
+      }
+    });
+    if (ready_case == SelectClaim::kNone) {
+      // no case can be fired before the locks are released.
+      apply_cases([]<size_t I>(auto &select_case) {
+        if constexpr (SelectChannelCase<remove_reference_t<decltype(select_case)>>) {
+          select_case.push_locked();
+        }
+      });
+      is_registered = true;
+    } else {
+      claim->winner.store(ready_case, memory_order_relaxed);
+    }
+    unlock_channels();
+
+    if (ready_case != SelectClaim::kNone) {
+      this->resume_unsafe();
+      return;
+    }
+    apply_cases([this]<size_t I>(auto &select_case) {
+      if constexpr (is_same_v<remove_reference_t<decltype(select_case)>, SelectTimeoutCase>) {
+        select_case.schedule(this, shared_claim, I);
+      }
+    });
+    report();
+  }
+
+  void before_resume() override {
+    using namespace std;
+    auto winner = claim->winner.load(memory_order_acquire);
+    if (is_registered) {
+      apply_cases([winner]<size_t I>(auto &select_case) {
+        if constexpr (SelectChannelCase<remove_reference_t<decltype(select_case)>>) {
+          if (I != winner) select_case.cancel();
+        }
+      });
+    }
+    apply_cases([this, winner]<size_t I>(auto &select_case) {
+      if (I == winner) {
+        this->_result.emplace(ResultType(in_place_index<I>, select_case.take_result()));
+      }
+    });
+  }
+
+ private:
+  static constexpr size_t kChannelCount = (size_t(0) + ... + size_t(SelectChannelCase<Cases>));
+
+  std::tuple<Cases...> cases;
+  SelectClaim local_claim;
+  std::shared_ptr<SelectClaim> shared_claim;
+  bool is_registered = false;
+
+  void on_ready() override {
+    this->resume_unsafe();
+  }
+
+  template<typename Function>
+  void apply_cases(Function &&function) {
+    [&]<size_t... I>(std::index_sequence<I...>) {
+      (function.template operator()<I>(std::get<I>(cases)), ...);
+    }(std::index_sequence_for<Cases...>{});
+  }
+
+  void lock_channels() {
+    std::array<std::mutex *, kChannelCount> mutexes{};
+    size_t count = 0;
+    apply_cases([&]<size_t I>(auto &select_case) {
+      if constexpr (SelectChannelCase<std::remove_reference_t<decltype(select_case)>>) {
+        mutexes[count++] = &select_case.mutex();
+      }
+    });
+    // a global order keeps two selects over the same channels from deadlocking.
+    std::sort(mutexes.begin(), mutexes.end());
+    auto end = std::unique(mutexes.begin(), mutexes.end());
+    std::for_each(mutexes.begin(), end, [](auto mutex) { mutex->lock(); });
+  }
+
+  void unlock_channels() {
+    // waiters on the other side are woken up once every lock is released, they may resume inline.
+    std::array<std::mutex *, kChannelCount> unlocked{};
+    size_t count = 0;
+    apply_cases([&]<size_t I>(auto &select_case) {
+      if constexpr (SelectChannelCase<std::remove_reference_t<decltype(select_case)>>) {
+        auto mutex = &select_case.mutex();
+        if (std::find(unlocked.begin(), unlocked.begin() + count, mutex) == unlocked.begin() + count) {
+          unlocked[count++] = mutex;
+          select_case.resumed.emplace(select_case.channel->take_resumed_locked());
+          mutex->unlock();
+        }
+      }
+    });
+    apply_cases([]<size_t I>(auto &select_case) {
+      if constexpr (SelectChannelCase<std::remove_reference_t<decltype(select_case)>>) {
+        if (select_case.resumed) {
+          select_case.resumed->wake();
+          select_case.resumed.reset();
+        }
+      }
+    });
+  }
+};
+
+template<typename ... Arguments>
+auto select(Arguments &&... arguments) {
+  static_assert(sizeof...(Arguments) > 0, "select needs at least one case.");
+  return SelectAwaiter<typename SelectCaseOf<std::remove_cvref_t<Arguments>>::type...>(
+      std::forward<Arguments>(arguments)...);
+}
+
+#endif //CPPCOROUTINES_TASKS_08_CHANNEL_SELECT_H_
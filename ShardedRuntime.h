@@ -0,0 +1,442 @@
+//
+// Created by benny on 2022/4/14.
+//
+
+#ifndef CPPCOROUTINES_TASKS_09_EXECUTOR_SHARDEDRUNTIME_H_
+#define CPPCOROUTINES_TASKS_09_EXECUTOR_SHARDEDRUNTIME_H_
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef COROUTINE_HAS_LIBNUMA
+#include <numa.h>
+#endif
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "Executor.h"
+#include "RingChannel.h"
+#include "Scheduler.h"
+#include "SleepAwaiter.h"
+
+class Shard;
+class ShardedRuntime;
+
+// the shard a thread of a ShardedRuntime works for, and its mailbox on every shard.
+struct ShardThread {
+  Shard *shard = nullptr;
+  size_t mailbox = 0;
+  bool is_timer = false;
+};
+
+/**
+ * One core of a ShardedRuntime: a work thread and a timer, both pinned to the same CPU. Sleeping
+ * coroutines of the shard use its timer.
+ *
+ * Each worker of the runtime, and the shard's own timer, writes to the shard through a mailbox
+ * of its own, a SpscRing allocated on first use, so shards never contend on a lock or on a shared
+ * tail. Other threads, and senders whose mailbox is full, go through an inbox behind a lock.
+ *
+ * Executables from one sender run in the order it sent them. A sender that found its mailbox full
+ * keeps going through the inbox until the work thread ran everything it put there, and before
+ * running the inbox the work thread empties the mailboxes of such senders.
+ */
+class Shard : public AbstractExecutor {
+ public:
+  Shard(ShardedRuntime &runtime, size_t index, size_t shard_count, int cpu)
+      : shard_runtime(runtime), shard_index(index), cpu(cpu),
+        mailbox_count(shard_count + 1), mailboxes(new std::atomic<Mailbox *>[shard_count + 1]),
+        spilled(new std::atomic<size_t>[shard_count + 1]) {
+    for (size_t i = 0; i < mailbox_count; ++i) {
+      mailboxes[i].store(nullptr, std::memory_order_relaxed);
+      spilled[i].store(0, std::memory_order_relaxed);
+    }
+    timer.execute([this]() { bind_thread(true); }, 0);
+    work_thread = std::thread(&Shard::run_loop, this);
+  }
+
+  ~Shard() {
+    shutdown();
+    join();
+    for (size_t i = 0; i < mailbox_count; ++i) {
+      delete mailboxes[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  void execute(Executable &&func) override {
+    if (!is_active.load(std::memory_order_relaxed)) {
+      return;
+    }
+    auto &current = current_thread();
+    auto sender = kNoMailbox;
+    if (current.shard && &current.shard->shard_runtime == &shard_runtime
+        && (!current.is_timer || current.shard == this)) {
+      sender = current.mailbox;
+      // pairs with the release in run_inbox: the executables we put in the inbox have run.
+      if (spilled[sender].load(std::memory_order_acquire) == 0 && mailbox(sender).try_push(func)) {
+        // the work thread finds it on its next turn.
+        if (current.shard != this || current.is_timer) {
+          wake_up();
+        }
+        return;
+      }
+      spilled[sender].fetch_add(1, std::memory_order_relaxed);
+    }
+    std::unique_lock lock(inbox_lock);
+    inbox.push_back({sender, std::move(func)});
+    has_inbox.store(true, std::memory_order_relaxed);
+    lock.unlock();
+    wake_up();
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    auto &current = current_thread();
+    return current.shard == this && !current.is_timer;
+  }
+
+  [[nodiscard]] bool joins_on_destruction() const override {
+    return true;
+  }
+
+  [[nodiscard]] size_t index() const {
+    return shard_index;
+  }
+
+  [[nodiscard]] ShardedRuntime &runtime() const {
+    return shard_runtime;
+  }
+
+  [[nodiscard]] Scheduler &scheduler() {
+    return timer;
+  }
+
+  // the shard of the calling thread, if it belongs to a runtime.
+  static ShardThread &current_thread() {
+    thread_local ShardThread current;
+    return current;
+  }
+
+  // executables still pending are dropped.
+  void shutdown() {
+    timer.shutdown(false);
+    is_active.store(false);
+    is_parked.store(false);
+    is_parked.notify_one();
+  }
+
+  void join() {
+    timer.join();
+    if (work_thread.joinable()) {
+      work_thread.join();
+    }
+  }
+
+ private:
+  using Mailbox = SpscRing<Executable>;
+
+  // the sender of an executable in the inbox, kNoMailbox for threads outside of the runtime.
+  struct InboxEntry {
+    size_t sender;
+    Executable func;
+  };
+
+  static constexpr size_t kNoMailbox = static_cast<size_t>(-1);
+
+  static constexpr size_t kMailboxCapacity = 256;
+  // executables taken from one mailbox in a row, so one busy sender cannot starve the others.
+  static constexpr size_t kBatchSize = 64;
+
+  ShardedRuntime &shard_runtime;
+  size_t shard_index;
+  int cpu;
+
+  // indexed by the sending shard, the last one belongs to the timer.
+  size_t mailbox_count;
+  std::unique_ptr<std::atomic<Mailbox *>[]> mailboxes;
+  // executables each sender put in the inbox that have not run yet.
+  std::unique_ptr<std::atomic<size_t>[]> spilled;
+
+  std::mutex inbox_lock;
+  std::vector<InboxEntry> inbox;
+  std::vector<InboxEntry> draining;
+  std::atomic<bool> has_inbox{false};
+
+  // true only while the work thread is blocked in wait().
+  alignas(64) std::atomic<bool> is_parked{false};
+  std::atomic<bool> is_active{true};
+
+  Scheduler timer;
+  std::thread work_thread;
+
+  // called by the only sender of the mailbox.
+  Mailbox &mailbox(size_t sender) {
+    auto ring = mailboxes[sender].load(std::memory_order_acquire);
+    if (!ring) {
+      ring = new Mailbox(kMailboxCapacity);
+      mailboxes[sender].store(ring, std::memory_order_release);
+    }
+    return *ring;
+  }
+
+  void wake_up() {
+    // pairs with the fence in run_loop: either the work thread sees the executable, or we see it parked.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (is_parked.load(std::memory_order_relaxed) && is_parked.exchange(false)) {
+      is_parked.notify_one();
+    }
+  }
+
+  void bind_thread(bool is_timer) {
+    current_thread() = {this, is_timer ? mailbox_count - 1 : shard_index, is_timer};
+    SleepAwaiter::local_scheduler() = &timer;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+      debug("cannot pin shard ", shard_index, " to cpu ", cpu);
+    }
+#ifdef COROUTINE_HAS_LIBNUMA
+    // frames and buffers allocated by the shard come from the node of its CPU.
+    if (numa_available() != -1) {
+      numa_set_localalloc();
+    }
+#endif
+  }
+
+  bool run_pending() {
+    bool has_run = false;
+    for (size_t i = 0; i < mailbox_count; ++i) {
+      auto ring = mailboxes[i].load(std::memory_order_acquire);
+      for (size_t n = 0; ring && n < kBatchSize; ++n) {
+        auto func = ring->try_pop();
+        if (!func) break;
+        (*func)();
+        has_run = true;
+      }
+    }
+    if (has_inbox.load(std::memory_order_relaxed)) {
+      run_inbox();
+      has_run = true;
+    }
+    return has_run;
+  }
+
+  void run_inbox() {
+    std::unique_lock lock(inbox_lock);
+    inbox.swap(draining);
+    has_inbox.store(false, std::memory_order_relaxed);
+    lock.unlock();
+
+    // a sender with executables in the inbox does not use its mailbox, what is left there was
+    // sent before them.
+    for (size_t i = 0; i < mailbox_count; ++i) {
+      auto ring = mailboxes[i].load(std::memory_order_acquire);
+      if (!ring || spilled[i].load(std::memory_order_relaxed) == 0) continue;
+      while (auto func = ring->try_pop()) {
+        (*func)();
+      }
+    }
+    for (auto &entry : draining) {
+      entry.func();
+      if (entry.sender != kNoMailbox) {
+        spilled[entry.sender].fetch_sub(1, std::memory_order_release);
+      }
+    }
+    draining.clear();
+  }
+
+  bool is_idle() {
+    for (size_t i = 0; i < mailbox_count; ++i) {
+      auto ring = mailboxes[i].load(std::memory_order_acquire);
+      if (ring && !ring->empty()) return false;
+    }
+    return !has_inbox.load(std::memory_order_relaxed);
+  }
+
+  void run_loop() {
+    is_loop_thread() = true;
+    bind_thread(false);
+    while (is_active.load(std::memory_order_relaxed)) {
+      if (run_pending()) continue;
+
+      is_parked.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (is_idle() && is_active.load()) {
+        is_parked.wait(true);
+      }
+      is_parked.store(false, std::memory_order_relaxed);
+    }
+    debug("run_loop exit.");
+  }
+};
+
+/**
+ * Thread-per-core runtime for shared-nothing designs: one Shard per CPU the process may run on,
+ * or as many as asked for. Tasks on ShardExecutor stay on their shard until they co_await
+ * on_shard(n), and a shard can be sent any executable with shard(n).execute(...).
+ *
+ * Build with libnuma to have every shard allocate from the memory node of its CPU.
+ */
+class ShardedRuntime {
+ public:
+  // 0 starts one shard per available CPU.
+  explicit ShardedRuntime(size_t shard_count = 0) {
+    auto cpus = available_cpus();
+    if (shard_count == 0) {
+      shard_count = cpus.size();
+    }
+    for (size_t i = 0; i < shard_count; ++i) {
+      shards.push_back(std::make_unique<Shard>(*this, i, shard_count, cpus[i % cpus.size()]));
+    }
+  }
+
+  ShardedRuntime(ShardedRuntime &) = delete;
+
+  ShardedRuntime &operator=(ShardedRuntime &) = delete;
+
+  ~ShardedRuntime() {
+    // no timer may fire into a shard that is already gone.
+    for (auto &shard : shards) {
+      shard->shutdown();
+    }
+    for (auto &shard : shards) {
+      shard->join();
+    }
+  }
+
+  [[nodiscard]] size_t shard_count() const {
+    return shards.size();
+  }
+
+  // wraps around, so a hash of the key can pick the shard.
+  Shard &shard(size_t index) {
+    return *shards[index % shards.size()];
+  }
+
+  // round-robin, for work coming from outside of the runtime.
+  Shard &next_shard() {
+    return shard(next_index.fetch_add(1, std::memory_order_relaxed));
+  }
+
+  // the shard the calling thread works for, nullptr outside of every runtime.
+  static Shard *current_shard() {
+    return Shard::current_thread().shard;
+  }
+
+  // call before the shared runtime is first used, 0 is one shard per available CPU.
+  static void set_shard_count(size_t shard_count) {
+    configured_shard_count().store(shard_count, std::memory_order_relaxed);
+  }
+
+  static ShardedRuntime &shared_runtime() {
+    static ShardedRuntime sharedRuntime(configured_shard_count().load(std::memory_order_relaxed));
+    return sharedRuntime;
+  }
+
+ private:
+  std::vector<std::unique_ptr<Shard>> shards;
+  std::atomic<size_t> next_index{0};
+
+  static std::atomic<size_t> &configured_shard_count() {
+    static std::atomic<size_t> shard_count{0};
+    return shard_count;
+  }
+
+  // the CPUs of the affinity mask, so the runtime respects taskset and cgroups.
+  static std::vector<int> available_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+      }
+    }
+    if (cpus.empty()) {
+      cpus.push_back(0);
+    }
+    return cpus;
+  }
+};
+
+/**
+ * Runs a task on one shard: the shard of the thread that creates it, otherwise the next shard of
+ * the shared runtime. on_shard moves the executor along with its task.
+ */
+class ShardExecutor : public AbstractExecutor {
+ public:
+  ShardExecutor() : shard(ShardedRuntime::current_shard()) {
+    if (!shard) {
+      shard = &ShardedRuntime::shared_runtime().next_shard();
+    }
+  }
+
+  void execute(Executable &&func) override {
+    shard->execute(std::move(func));
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return shard->is_executor_thread();
+  }
+
+  // only called by the task itself, while it is suspended on the way to the target.
+  void move_to(Shard *target) {
+    shard = target;
+  }
+
+ private:
+  Shard *shard;
+};
+
+/**
+ * Resumes the awaiting coroutine on another shard. A task on ShardExecutor stays there, tasks on
+ * other executors return to them with their next await.
+ */
+class ShardHopAwaiter : public Awaiter<void> {
+ public:
+  explicit ShardHopAwaiter(Shard *target) : target(target) {}
+
+  bool await_ready() {
+    if (!target->is_executor_thread()) {
+      return false;
+    }
+    move_executor();
+    _result = Result<void>();
+    return true;
+  }
+
+  void after_suspend() override {
+    move_executor();
+    install_executor(target);
+    resume();
+  }
+
+ private:
+  Shard *target;
+
+  void move_executor() {
+    if (auto executor = dynamic_cast<ShardExecutor *>(installed_executor())) {
+      executor->move_to(target);
+    }
+  }
+};
+
+inline ShardHopAwaiter on_shard(Shard &shard) {
+  return ShardHopAwaiter(&shard);
+}
+
+// a shard of the calling thread's runtime, or of the shared one.
+inline ShardHopAwaiter on_shard(size_t index) {
+  auto current = ShardedRuntime::current_shard();
+  auto &runtime = current ? current->runtime() : ShardedRuntime::shared_runtime();
+  return ShardHopAwaiter(&runtime.shard(index));
+}
+
+#endif //CPPCOROUTINES_TASKS_09_EXECUTOR_SHARDEDRUNTIME_H_
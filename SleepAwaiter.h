@@ -10,22 +10,56 @@
 #include "coroutine_common.h"
 #include "CommonAwaiter.h"
 
+/**
+ * Resumes the coroutine after a delay. An executor with timers of its own resumes it right on its
+ * thread, see AbstractExecutor::execute_after; otherwise the scheduler fires and the coroutine is
+ * dispatched to its executor from there.
+ */
 struct SleepAwaiter : Awaiter<void> {
 
+  // delay in milliseconds.
   explicit SleepAwaiter(long long duration) noexcept
-      : _duration(duration) {}
+      : _duration(std::chrono::milliseconds(duration)) {}
 
   template<typename _Rep, typename _Period>
   explicit SleepAwaiter(std::chrono::duration<_Rep, _Period> &&duration) noexcept
-      : _duration(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()) {}
+      : _duration(std::chrono::duration_cast<TimerClock::duration>(duration)) {}
 
-  void after_suspend() override {
+  // shared by all sleeping coroutines, e.g. to enable its metrics.
+  static Scheduler &scheduler() {
     static Scheduler scheduler;
-    scheduler.execute([this] { resume(); }, _duration);
+    return scheduler;
+  }
+
+  // set on the threads of a ShardedRuntime to the timer of their shard.
+  static Scheduler *&local_scheduler() {
+    thread_local Scheduler *scheduler = nullptr;
+    return scheduler;
+  }
+
+  // the timer of the calling thread's shard, or the shared one.
+  static Scheduler &current_scheduler() {
+    auto scheduler = local_scheduler();
+    return scheduler ? *scheduler : SleepAwaiter::scheduler();
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    if (auto executor = installed_executor()) {
+      // a sleep cannot fail, the result is set before the timer may fire.
+      _result = Result<void>();
+      if (executor->execute_after(AbstractExecutor::resumption_of(handle, installed_priority()), _duration)) {
+        return;
+      }
+    }
+    Awaiter<void>::await_suspend(handle);
+  }
+
+  void after_suspend() override {
+    current_scheduler().execute([this] { resume(); }, _duration);
   }
 
  private:
-  long long _duration;
+  TimerClock::duration _duration;
 };
 
 #endif //CPPCOROUTINES_TASKS_06_SLEEP_SLEEPAWAITER_H_
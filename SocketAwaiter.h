@@ -0,0 +1,197 @@
+//
+// Created by benny on 2022/4/2.
+//
+
+#ifndef CPPCOROUTINES_TASKS_10_IO_SOCKETAWAITER_H_
+#define CPPCOROUTINES_TASKS_10_IO_SOCKETAWAITER_H_
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "ReactorExecutor.h"
+
+/**
+ * Base of the socket awaiters. The syscall is tried once when awaited and the coroutine only
+ * suspends if it would block; the reactor then retries it whenever the fd becomes ready and
+ * resumes the coroutine through its installed executor. Failures are thrown as std::system_error.
+ */
+template<typename R>
+struct IoAwaiter : public Awaiter<R>, public IoOperation {
+  IoAwaiter(IoChannel *channel, IoChannel::Direction direction) : channel(channel), direction(direction) {}
+
+  bool await_ready() {
+    if (!attempt()) {
+      return false;
+    }
+    if (error) {
+      this->_result = Result<R>(make_exception());
+    } else if constexpr (std::is_void_v<R>) {
+      this->_result = Result<R>();
+    } else {
+      this->_result = Result<R>(std::move(value));
+    }
+    return true;
+  }
+
+  void fail(int error_code) override {
+    error = error_code;
+    complete();
+  }
+
+  void complete() override {
+    if (error) {
+      this->resume_exception(make_exception());
+    } else if constexpr (std::is_void_v<R>) {
+      this->resume();
+    } else {
+      this->resume(std::move(value));
+    }
+  }
+
+ protected:
+  IoChannel *channel;
+  IoChannel::Direction direction;
+  int error = 0;
+  std::conditional_t<std::is_void_v<R>, bool, R> value{};
+
+  void after_suspend() override {
+    channel->reactor->submit(channel, direction, this);
+  }
+
+  // records the outcome of a syscall, returns false if it would block.
+  bool check(long long result) requires (!std::is_void_v<R>) {
+    if (result >= 0) {
+      error = 0;
+      value = static_cast<R>(result);
+      return true;
+    }
+    return check_errno();
+  }
+
+  bool check_errno() {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return false;
+    }
+    error = errno;
+    return true;
+  }
+
+ private:
+  std::exception_ptr make_exception() const {
+    return std::make_exception_ptr(std::system_error(error, std::generic_category()));
+  }
+};
+
+struct AcceptAwaiter : public IoAwaiter<int> {
+  explicit AcceptAwaiter(IoChannel *channel) : IoAwaiter(channel, IoChannel::kRead) {}
+
+  bool attempt() override {
+    return check(accept4(channel->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+  }
+};
+
+struct ConnectAwaiter : public IoAwaiter<void> {
+  ConnectAwaiter(IoChannel *channel, const sockaddr *address, socklen_t length)
+      : IoAwaiter(channel, IoChannel::kWrite), address(address), length(length) {}
+
+  bool attempt() override {
+    // connecting again reports EALREADY while in progress and EISCONN once established.
+    if (connect(channel->fd, address, length) == 0 || errno == EISCONN) {
+      error = 0;
+      return true;
+    }
+    if (errno == EINPROGRESS || errno == EALREADY) {
+      return false;
+    }
+    return check_errno();
+  }
+
+ private:
+  const sockaddr *address;
+  socklen_t length;
+};
+
+struct ReadAwaiter : public IoAwaiter<size_t> {
+  ReadAwaiter(IoChannel *channel, void *buffer, size_t size)
+      : IoAwaiter(channel, IoChannel::kRead), buffer(buffer), size(size) {}
+
+  // 0 means end of stream.
+  bool attempt() override {
+    return check(read(channel->fd, buffer, size));
+  }
+
+ private:
+  void *buffer;
+  size_t size;
+};
+
+struct WriteAwaiter : public IoAwaiter<size_t> {
+  WriteAwaiter(IoChannel *channel, const void *buffer, size_t size)
+      : IoAwaiter(channel, IoChannel::kWrite), buffer(buffer), size(size) {}
+
+  bool attempt() override {
+    return check(send(channel->fd, buffer, size, MSG_NOSIGNAL));
+  }
+
+ private:
+  const void *buffer;
+  size_t size;
+};
+
+/**
+ * A non-blocking fd registered in a ReactorExecutor. At most one read-side (read_some, accept)
+ * and one write-side (write_some, connect) operation may be pending at a time, destroying the
+ * Socket fails them with ECANCELED.
+ */
+class Socket {
+ public:
+  Socket(ReactorExecutor &reactor, int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    channel = reactor.register_fd(fd);
+  }
+
+  Socket(Socket &&socket) noexcept: channel(std::exchange(socket.channel, nullptr)) {}
+
+  Socket(Socket &) = delete;
+
+  Socket &operator=(Socket &) = delete;
+
+  ~Socket() {
+    if (channel) channel->reactor->unregister_fd(channel);
+  }
+
+  [[nodiscard]] int fd() const {
+    return channel->fd;
+  }
+
+  // returns the accepted fd, wrap it in a Socket to await on it.
+  AcceptAwaiter accept() {
+    return AcceptAwaiter{channel};
+  }
+
+  // address must stay valid until the connection is established.
+  ConnectAwaiter connect(const sockaddr *address, socklen_t length) {
+    return ConnectAwaiter{channel, address, length};
+  }
+
+  ReadAwaiter read_some(void *buffer, size_t size) {
+    return ReadAwaiter{channel, buffer, size};
+  }
+
+  WriteAwaiter write_some(const void *buffer, size_t size) {
+    return WriteAwaiter{channel, buffer, size};
+  }
+
+ private:
+  IoChannel *channel;
+};
+
+#endif //CPPCOROUTINES_TASKS_10_IO_SOCKETAWAITER_H_
@@ -0,0 +1,76 @@
+//
+// Created by benny on 2022/4/16.
+//
+
+#ifndef CPPCOROUTINES_TASKS_09_EXECUTOR_SPAWNBLOCKINGAWAITER_H_
+#define CPPCOROUTINES_TASKS_09_EXECUTOR_SPAWNBLOCKINGAWAITER_H_
+
+#include <exception>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "Executor.h"
+
+/**
+ * Calls a function on a BlockingPoolExecutor and resumes the awaiting coroutine with its result,
+ * or its exception, on the coroutine's own executor.
+ */
+template<typename Function>
+class SpawnBlockingAwaiter : public Awaiter<std::invoke_result_t<Function &>> {
+ public:
+  using ResultType = std::invoke_result_t<Function &>;
+
+  SpawnBlockingAwaiter(BlockingPoolExecutor &pool, Function &&function)
+      : pool(&pool), function(std::move(function)) {}
+
+  SpawnBlockingAwaiter(SpawnBlockingAwaiter &&awaiter) noexcept
+      : Awaiter<ResultType>(std::move(awaiter)), pool(awaiter.pool), function(std::move(awaiter.function)) {}
+
+ protected:
+  // RejectedExecutionException is thrown by the co_await.
+  void after_suspend() override {
+    pool->execute([this]() { run(); });
+  }
+
+ private:
+  BlockingPoolExecutor *pool;
+  Function function;
+
+  void run() {
+    if constexpr (std::is_void_v<ResultType>) {
+      try {
+        function();
+      } catch (...) {
+        this->resume_exception(std::current_exception());
+        return;
+      }
+      this->resume();
+    } else {
+      std::optional<ResultType> value;
+      try {
+        value.emplace(function());
+      } catch (...) {
+        this->resume_exception(std::current_exception());
+        return;
+      }
+      this->resume(std::move(*value));
+    }
+  }
+};
+
+template<typename Function>
+SpawnBlockingAwaiter<std::decay_t<Function>> spawn_blocking(BlockingPoolExecutor &pool, Function &&function) {
+  return SpawnBlockingAwaiter<std::decay_t<Function>>(pool, std::decay_t<Function>(std::forward<Function>(function)));
+}
+
+// runs on the shared blocking pool.
+template<typename Function>
+SpawnBlockingAwaiter<std::decay_t<Function>> spawn_blocking(Function &&function) {
+  return spawn_blocking(SharedBlockingPoolExecutor::shared_executor(), std::forward<Function>(function));
+}
+
+#endif //CPPCOROUTINES_TASKS_09_EXECUTOR_SPAWNBLOCKINGAWAITER_H_
@@ -21,6 +21,11 @@ struct Task {
         return handle.promise().get_result();
     }
 
+    Task &finally(std::function<void()> &&func) {
+        handle.promise().on_completed([func](auto result) { func(); });
+        return *this;
+    }
+
     explicit Task(std::coroutine_handle<promise_type> handle) noexcept: handle(handle) {}
 
     Task(Task &&task) noexcept: handle(std::exchange(task.handle, {})) {}
@@ -35,6 +40,13 @@ struct Task {
 
 private:
     std::coroutine_handle<promise_type> handle;
+
+    template<typename, typename>
+    friend struct TaskAwaiter;
+
+    friend class TaskGroup;
+
+    friend struct TaskFrames;
 };
 
 template<typename Executor>
@@ -42,6 +54,19 @@ struct Task<void, Executor> {
 
     using promise_type = TaskPromise<void, Executor>;
 
+    auto as_awaiter() {
+        return TaskAwaiter<void, Executor>(std::move(*this));
+    }
+
+    void get_result() {
+        handle.promise().get_result();
+    }
+
+    Task &finally(std::function<void()> &&func) {
+        handle.promise().on_completed([func](auto result) { func(); });
+        return *this;
+    }
+
     explicit Task(std::coroutine_handle<promise_type> handle) noexcept: handle{handle} {}
 
     Task(const Task &) = delete;
@@ -58,6 +83,13 @@ struct Task<void, Executor> {
 
 private:
     std::coroutine_handle<promise_type> handle;
+
+    template<typename, typename>
+    friend struct TaskAwaiter;
+
+    friend class TaskGroup;
+
+    friend struct TaskFrames;
 };
 
 
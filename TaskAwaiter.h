@@ -12,31 +12,72 @@
 template<typename ResultType, typename Executor>
 struct Task;
 
+/**
+ * Waits for a task to complete. Waiters are pushed onto the completion state of the promise
+ * without a lock and live with whoever waits: in the awaiting frame, on the stack of a blocked
+ * thread or on the heap for callbacks.
+ */
+class TaskCompletionWaiter {
+ public:
+  TaskCompletionWaiter *next = nullptr;
+
+  // the task is completing and nobody can observe it yet, its frame is still alive.
+  virtual void on_completing() {}
+
+  // the task has completed, its frame may be destroyed concurrently. Returns the coroutine to
+  // transfer to from the final suspend point, if any.
+  virtual std::coroutine_handle<> on_completed() = 0;
+
+ protected:
+  ~TaskCompletionWaiter() = default;
+};
+
+// the coroutine awaiting a task, resumed on its own executor.
+class TaskContinuation final : public TaskCompletionWaiter {
+ public:
+  std::coroutine_handle<> handle;
+  AbstractExecutor *executor = nullptr;
+  TaskPriority priority = TaskPriority::kNormal;
+
+  std::coroutine_handle<> on_completed() override {
+    // transferred to inline only if it keeps running with its own priority.
+    if (!executor || (executor->is_executor_thread() && current_task_priority() == priority)) {
+      return handle;
+    }
+    executor->execute(handle, priority);
+    return nullptr;
+  }
+};
+
 template<typename R, typename Executor>
 struct TaskAwaiter : public Awaiter<R> {
   explicit TaskAwaiter(Task<R, Executor> &&task) noexcept
       : task(std::move(task)) {}
 
   TaskAwaiter(TaskAwaiter &&awaiter) noexcept
-      : Awaiter<R>(awaiter), task(std::move(awaiter.task)) {}
+      : Awaiter<R>(std::move(awaiter)), task(std::move(awaiter.task)) {}
 
   TaskAwaiter(TaskAwaiter &) = delete;
 
   TaskAwaiter &operator=(TaskAwaiter &) = delete;
 
- protected:
-  void after_suspend() override {
-    task.finally([this]() {
-      this->resume_unsafe();
-    });
+  // resumed by the final suspend point of the task, see TaskFinalAwaiter.
+  bool await_suspend(std::coroutine_handle<> handle) {
+    continuation.handle = handle;
+    continuation.executor = this->installed_executor();
+    continuation.priority = this->installed_priority();
+    return task.handle.promise().add_waiter(&continuation);
   }
 
+ protected:
+
   void before_resume() override {
-    this->_result = Result(task.get_result());
+    this->_result.emplace(task.handle.promise().take_result());
   }
 
  private:
   Task<R, Executor> task;
+  TaskContinuation continuation;
 };
 
 template<typename Executor>
@@ -51,19 +92,24 @@ struct TaskAwaiter<void, Executor> : public Awaiter<void> {
 
   TaskAwaiter &operator=(TaskAwaiter &) = delete;
 
- protected:
-  void after_suspend() override {
-    task.finally([this]() {
-      this->resume_unsafe();
-    });
+  // resumed by the final suspend point of the task, see TaskFinalAwaiter.
+  bool await_suspend(std::coroutine_handle<> handle) {
+    continuation.handle = handle;
+    continuation.executor = this->installed_executor();
+    continuation.priority = this->installed_priority();
+    return task.handle.promise().add_waiter(&continuation);
   }
 
+ protected:
+
   void before_resume() override {
     task.get_result();
+    this->_result = Result<void>();
   }
 
  private:
   Task<void, Executor> task;
+  TaskContinuation continuation;
 };
 
 #endif //CPPCOROUTINES_04_TASK_TASKAWAITER_H_
@@ -0,0 +1,437 @@
+//
+// Created by benny on 2022/4/12.
+//
+
+#ifndef CPPCOROUTINES_TASKS_04_TASK_TASKCOMBINATORS_H_
+#define CPPCOROUTINES_TASKS_04_TASK_TASKCOMBINATORS_H_
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "Task.h"
+
+// a void task contributes an empty value to the results of when_all and when_any.
+template<typename ResultType>
+using TaskValue = std::conditional_t<std::is_void_v<ResultType>, std::monostate, ResultType>;
+
+/**
+ * Access to the frames of tasks for when_all and when_any.
+ */
+struct TaskFrames {
+  template<typename ResultType, typename Executor>
+  static auto handle(Task<ResultType, Executor> &task) {
+    return task.handle;
+  }
+
+  template<typename ResultType, typename Executor>
+  static auto release(Task<ResultType, Executor> &task) {
+    return std::exchange(task.handle, nullptr);
+  }
+
+  // moves the result out of a completed task, throws its exception.
+  template<typename Promise>
+  static auto take_result(std::coroutine_handle<Promise> handle) {
+    if constexpr (std::is_same_v<decltype(handle.promise().get_result()), void>) {
+      handle.promise().get_result();
+      return std::monostate{};
+    } else {
+      return handle.promise().take_result();
+    }
+  }
+};
+
+/**
+ * Counts down the tasks of a when_all plus one for its own registration, whoever counts the last
+ * one resumes the awaiting coroutine. The frames stay with the Task objects of the awaiter.
+ */
+template<typename R>
+class WhenAllCountdown : public Awaiter<R>, public TaskFrameOwner {
+ public:
+  void on_task_completed(std::coroutine_handle<>, std::exception_ptr, bool) override {
+    count_down();
+  }
+
+ protected:
+  std::atomic<size_t> pending;
+
+  explicit WhenAllCountdown(size_t task_count) : pending(task_count + 1) {}
+
+  WhenAllCountdown(WhenAllCountdown &&other) noexcept
+      : Awaiter<R>(std::move(other)), pending(other.pending.load(std::memory_order_relaxed)) {}
+
+  template<typename ResultType, typename Executor>
+  void adopt(Task<ResultType, Executor> &task) {
+    // a task that completed already is counted right away.
+    if (!TaskFrames::handle(task).promise().set_owner(this)) {
+      count_down();
+    }
+  }
+
+  void count_down() {
+    if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->resume_unsafe();
+    }
+  }
+};
+
+template<typename ... Tasks>
+class WhenAllAwaiter;
+
+/**
+ * Resumes once every task has completed, with their results in argument order. Tasks start on
+ * their own executors when created, so they run concurrently from the start. The first exception
+ * in argument order is rethrown after all of them completed.
+ */
+template<typename ... ResultTypes, typename ... Executors>
+class WhenAllAwaiter<Task<ResultTypes, Executors>...>
+    : public WhenAllCountdown<std::tuple<TaskValue<ResultTypes>...>> {
+ public:
+  using ResultType = std::tuple<TaskValue<ResultTypes>...>;
+
+  explicit WhenAllAwaiter(Task<ResultTypes, Executors> &&... tasks)
+      : WhenAllCountdown<ResultType>(sizeof...(ResultTypes)), tasks(std::move(tasks)...) {}
+
+  WhenAllAwaiter(WhenAllAwaiter &&other) noexcept
+      : WhenAllCountdown<ResultType>(std::move(other)), tasks(std::move(other.tasks)) {}
+
+ protected:
+  void after_suspend() override {
+    std::apply([this](auto &... task) { (this->adopt(task), ...); }, tasks);
+    this->count_down();
+  }
+
+  void before_resume() override {
+    // braces take the results in argument order, the frames go with the awaiter.
+    this->_result.emplace(std::apply([](auto &... task) {
+      return ResultType{TaskFrames::take_result(TaskFrames::handle(task))...};
+    }, tasks));
+  }
+
+ private:
+  std::tuple<Task<ResultTypes, Executors>...> tasks;
+};
+
+/**
+ * when_all over any number of tasks of one type: a vector of the results, or nothing for void tasks.
+ */
+template<typename R, typename Executor>
+class WhenAllVectorAwaiter
+    : public WhenAllCountdown<std::conditional_t<std::is_void_v<R>, void, std::vector<R>>> {
+ public:
+  using ResultType = std::conditional_t<std::is_void_v<R>, void, std::vector<R>>;
+
+  explicit WhenAllVectorAwaiter(std::vector<Task<R, Executor>> &&tasks)
+      : WhenAllCountdown<ResultType>(tasks.size()), tasks(std::move(tasks)) {}
+
+  WhenAllVectorAwaiter(WhenAllVectorAwaiter &&other) noexcept
+      : WhenAllCountdown<ResultType>(std::move(other)), tasks(std::move(other.tasks)) {}
+
+ protected:
+  void after_suspend() override {
+    for (auto &task : tasks) {
+      this->adopt(task);
+    }
+    this->count_down();
+  }
+
+  void before_resume() override {
+    if constexpr (std::is_void_v<R>) {
+      for (auto &task : tasks) {
+        TaskFrames::take_result(TaskFrames::handle(task));
+      }
+      this->_result = Result<void>();
+    } else {
+      ResultType values;
+      values.reserve(tasks.size());
+      for (auto &task : tasks) {
+        values.push_back(TaskFrames::take_result(TaskFrames::handle(task)));
+      }
+      this->_result.emplace(std::move(values));
+    }
+  }
+
+ private:
+  std::vector<Task<R, Executor>> tasks;
+};
+
+class WhenAnyListener {
+ public:
+  virtual void on_first_completed() = 0;
+
+ protected:
+  ~WhenAnyListener() = default;
+};
+
+/**
+ * Owns the frames of a when_any's tasks, the ones that lose keep running after the awaiting
+ * coroutine resumed. The first task to complete wins and keeps its frame until the awaiter took
+ * its result, the others are destroyed as they complete. A frame that owns the executor it
+ * completed on cannot be destroyed there; it is kept in deferred_frames until the awaiter or the
+ * last release runs on another thread. Deletes itself once the awaiter and all of the tasks are
+ * done with it.
+ */
+class WhenAnyState final : public TaskFrameOwner {
+ public:
+  WhenAnyState(WhenAnyListener *listener, size_t task_count)
+      : listener(listener), references(task_count + 1) {}
+
+  void on_task_completed(std::coroutine_handle<> handle, std::exception_ptr, bool can_destroy) override {
+    void *expected = nullptr;
+    if (winner.compare_exchange_strong(expected, handle.address(), std::memory_order_acq_rel)) {
+      if (!can_destroy) {
+        winner_thread = std::this_thread::get_id();
+      }
+      // the awaiter holds a reference until it took the result.
+      auto first_listener = listener;
+      release();
+      first_listener->on_first_completed();
+      return;
+    }
+    if (can_destroy) {
+      handle.destroy();
+    } else {
+      defer(handle, std::this_thread::get_id());
+    }
+    release();
+  }
+
+  [[nodiscard]] void *winner_address() const {
+    return winner.load(std::memory_order_acquire);
+  }
+
+  // called by the awaiter once it took the result.
+  void release_winner() {
+    auto handle = std::coroutine_handle<>::from_address(winner_address());
+    if (winner_thread == std::thread::id()) {
+      handle.destroy();
+    } else {
+      defer(handle, winner_thread);
+    }
+    destroy_deferred_frames();
+    release();
+  }
+
+ private:
+  struct DeferredFrame {
+    std::coroutine_handle<> handle;
+    // the thread of the executor the frame owns.
+    std::thread::id thread;
+  };
+
+  WhenAnyListener *listener;
+  std::atomic<void *> winner{nullptr};
+  // set by a winner that cannot be destroyed on the thread it completed on.
+  std::thread::id winner_thread;
+  std::atomic<size_t> references;
+  std::mutex deferred_lock;
+  std::vector<DeferredFrame> deferred_frames;
+
+  void defer(std::coroutine_handle<> handle, std::thread::id thread) {
+    std::lock_guard lock(deferred_lock);
+    deferred_frames.push_back({handle, thread});
+  }
+
+  // destroys the deferred frames whose executors do not run on this thread.
+  void destroy_deferred_frames() {
+    std::vector<std::coroutine_handle<>> frames;
+    {
+      std::lock_guard lock(deferred_lock);
+      auto current = std::this_thread::get_id();
+      std::erase_if(deferred_frames, [&](const DeferredFrame &frame) {
+        if (frame.thread == current) return false;
+        frames.push_back(frame.handle);
+        return true;
+      });
+    }
+    for (auto handle : frames) {
+      handle.destroy();
+    }
+  }
+
+  void release() {
+    if (references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    destroy_deferred_frames();
+    if (!deferred_frames.empty()) {
+      // only frames owning the executor of this thread are left, their join needs another thread.
+      std::thread([this]() {
+        destroy_deferred_frames();
+        delete this;
+      }).detach();
+      return;
+    }
+    delete this;
+  }
+};
+
+/**
+ * Resumes the awaiting coroutine once, with the result of the first task to complete. The
+ * winner's exception is rethrown, the other tasks keep running and their results are discarded.
+ */
+template<typename R>
+class WhenAnyAwaiterBase : public Awaiter<R>, public WhenAnyListener {
+ public:
+  void on_first_completed() override {
+    report();
+  }
+
+ protected:
+  WhenAnyState *state = nullptr;
+
+  WhenAnyAwaiterBase() = default;
+
+  WhenAnyAwaiterBase(WhenAnyAwaiterBase &&other) noexcept: Awaiter<R>(std::move(other)) {}
+
+  template<typename ResultType, typename Executor>
+  auto adopt(Task<ResultType, Executor> &task) {
+    auto handle = TaskFrames::release(task);
+    if (!handle.promise().set_owner(state)) {
+      state->on_task_completed(handle, nullptr, true);
+    }
+    return handle;
+  }
+
+  // the first completion and the end of the registration, the second one resumes.
+  void report() {
+    if (pending_reports.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      this->resume_unsafe();
+    }
+  }
+
+ private:
+  std::atomic<int> pending_reports{2};
+};
+
+template<typename ... Tasks>
+class WhenAnyAwaiter;
+
+/**
+ * The result is a variant whose index() is the task that completed first.
+ */
+template<typename ... ResultTypes, typename ... Executors>
+class WhenAnyAwaiter<Task<ResultTypes, Executors>...>
+    : public WhenAnyAwaiterBase<std::variant<TaskValue<ResultTypes>...>> {
+ public:
+  using ResultType = std::variant<TaskValue<ResultTypes>...>;
+
+  explicit WhenAnyAwaiter(Task<ResultTypes, Executors> &&... tasks) : tasks(std::move(tasks)...) {}
+
+  WhenAnyAwaiter(WhenAnyAwaiter &&other) noexcept
+      : WhenAnyAwaiterBase<ResultType>(std::move(other)), tasks(std::move(other.tasks)) {}
+
+ protected:
+  void after_suspend() override {
+    this->state = new WhenAnyState(this, sizeof...(ResultTypes));
+    [this]<size_t... I>(std::index_sequence<I...>) {
+      ((std::get<I>(handles) = this->adopt(std::get<I>(tasks))), ...);
+    }(std::index_sequence_for<ResultTypes...>{});
+    this->report();
+  }
+
+  void before_resume() override {
+    auto winner = this->state->winner_address();
+    try {
+      [&]<size_t... I>(std::index_sequence<I...>) {
+        ((std::get<I>(handles).address() == winner
+            && (this->_result.emplace(ResultType(std::in_place_index<I>, TaskFrames::take_result(std::get<I>(handles)))), true))
+            || ...);
+      }(std::index_sequence_for<ResultTypes...>{});
+    } catch (...) {
+      this->state->release_winner();
+      throw;
+    }
+    this->state->release_winner();
+  }
+
+ private:
+  std::tuple<Task<ResultTypes, Executors>...> tasks;
+  std::tuple<std::coroutine_handle<TaskPromise<ResultTypes, Executors>>...> handles;
+};
+
+/**
+ * when_any over any number of tasks of one type: the index of the first task to complete and its
+ * result, or only the index for void tasks.
+ */
+template<typename R, typename Executor>
+class WhenAnyVectorAwaiter
+    : public WhenAnyAwaiterBase<std::conditional_t<std::is_void_v<R>, size_t, std::pair<size_t, TaskValue<R>>>> {
+ public:
+  using ResultType = std::conditional_t<std::is_void_v<R>, size_t, std::pair<size_t, TaskValue<R>>>;
+
+  explicit WhenAnyVectorAwaiter(std::vector<Task<R, Executor>> &&tasks) : tasks(std::move(tasks)) {}
+
+  WhenAnyVectorAwaiter(WhenAnyVectorAwaiter &&other) noexcept
+      : WhenAnyAwaiterBase<ResultType>(std::move(other)), tasks(std::move(other.tasks)) {}
+
+ protected:
+  void after_suspend() override {
+    this->state = new WhenAnyState(this, tasks.size());
+    handles.reserve(tasks.size());
+    for (auto &task : tasks) {
+      handles.push_back(this->adopt(task));
+    }
+    this->report();
+  }
+
+  void before_resume() override {
+    auto winner = this->state->winner_address();
+    size_t index = 0;
+    while (handles[index].address() != winner) {
+      ++index;
+    }
+    try {
+      auto value = TaskFrames::take_result(handles[index]);
+      if constexpr (std::is_void_v<R>) {
+        this->_result.emplace(index);
+      } else {
+        this->_result.emplace(ResultType(index, std::move(value)));
+      }
+    } catch (...) {
+      this->state->release_winner();
+      throw;
+    }
+    this->state->release_winner();
+  }
+
+ private:
+  std::vector<Task<R, Executor>> tasks;
+  std::vector<std::coroutine_handle<TaskPromise<R, Executor>>> handles;
+};
+
+template<typename ... ResultTypes, typename ... Executors>
+auto when_all(Task<ResultTypes, Executors> &&... tasks) {
+  return WhenAllAwaiter<Task<ResultTypes, Executors>...>(std::move(tasks)...);
+}
+
+template<typename ResultType, typename Executor>
+auto when_all(std::vector<Task<ResultType, Executor>> &&tasks) {
+  return WhenAllVectorAwaiter<ResultType, Executor>(std::move(tasks));
+}
+
+template<typename ... ResultTypes, typename ... Executors>
+auto when_any(Task<ResultTypes, Executors> &&... tasks) {
+  static_assert(sizeof...(ResultTypes) > 0, "when_any needs at least one task.");
+  return WhenAnyAwaiter<Task<ResultTypes, Executors>...>(std::move(tasks)...);
+}
+
+// throws std::invalid_argument for an empty vector, nothing could ever complete it.
+template<typename ResultType, typename Executor>
+auto when_any(std::vector<Task<ResultType, Executor>> &&tasks) {
+  if (tasks.empty()) {
+    throw std::invalid_argument("when_any needs at least one task.");
+  }
+  return WhenAnyVectorAwaiter<ResultType, Executor>(std::move(tasks));
+}
+
+#endif //CPPCOROUTINES_TASKS_04_TASK_TASKCOMBINATORS_H_
@@ -0,0 +1,229 @@
+//
+// Created by benny on 2022/4/10.
+//
+
+#ifndef CPPCOROUTINES_TASKS_04_TASK_TASKGROUP_H_
+#define CPPCOROUTINES_TASKS_04_TASK_TASKGROUP_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "coroutine_common.h"
+#include "CommonAwaiter.h"
+#include "FramePool.h"
+#include "Task.h"
+
+struct TaskGroupStatistics {
+  size_t live_tasks = 0;
+  size_t peak_live_tasks = 0;
+  uint64_t spawned_tasks = 0;
+  // frame sizes as requested by the compiler, the pool rounds them up to its size classes.
+  size_t live_frame_bytes = 0;
+  size_t peak_frame_bytes = 0;
+};
+
+class TaskGroup;
+
+struct TaskGroupJoinAwaiter : public Awaiter<void> {
+  explicit TaskGroupJoinAwaiter(TaskGroup *group) : group(group) {}
+
+  bool await_ready();
+
+  void after_suspend() override;
+
+  void before_resume() override;
+
+ private:
+  TaskGroup *group;
+};
+
+/**
+ * Owns the frames of the tasks spawned into it and destroys each one as soon as it completes,
+ * so a running task costs its frame and nothing else. Results are discarded. join() resumes once
+ * every task spawned so far has completed and throws the first exception any of them threw.
+ *
+ * The group must outlive its tasks, the destructor blocks until the remaining ones completed.
+ */
+class TaskGroup : public TaskFrameOwner {
+ public:
+  TaskGroup() = default;
+
+  TaskGroup(TaskGroup &) = delete;
+
+  TaskGroup &operator=(TaskGroup &) = delete;
+
+  ~TaskGroup() {
+    wait_for_tasks();
+    destroy_deferred_frames();
+  }
+
+  template<typename ResultType, typename Executor>
+  void spawn(Task<ResultType, Executor> &&task) {
+    auto handle = std::exchange(task.handle, nullptr);
+    add_task(FramePool::frame_size(handle.address()));
+    if (has_deferred_frames.load(std::memory_order_relaxed)) {
+      destroy_deferred_frames();
+    }
+    if (!handle.promise().set_owner(this)) {
+      on_task_completed(handle, handle.promise().exception(), true);
+    }
+  }
+
+  TaskGroupJoinAwaiter join() {
+    return TaskGroupJoinAwaiter{this};
+  }
+
+  // blocking version of join for callers outside of coroutines.
+  void wait() {
+    wait_for_tasks();
+    destroy_deferred_frames();
+    rethrow_exception();
+  }
+
+  [[nodiscard]] size_t live_count() const {
+    return live_tasks.load(std::memory_order_acquire);
+  }
+
+  [[nodiscard]] TaskGroupStatistics statistics() const {
+    TaskGroupStatistics result;
+    result.live_tasks = live_tasks.load(std::memory_order_relaxed);
+    result.peak_live_tasks = peak_live_tasks.load(std::memory_order_relaxed);
+    result.spawned_tasks = spawned_tasks.load(std::memory_order_relaxed);
+    result.live_frame_bytes = live_frame_bytes.load(std::memory_order_relaxed);
+    result.peak_frame_bytes = peak_frame_bytes.load(std::memory_order_relaxed);
+    return result;
+  }
+
+  void on_task_completed(std::coroutine_handle<> handle, std::exception_ptr exception, bool can_destroy) override {
+    if (exception) {
+      std::lock_guard lock(group_lock);
+      if (!first_exception) {
+        first_exception = std::move(exception);
+      }
+    }
+    if (can_destroy) {
+      destroy_frame(handle);
+    } else {
+      // destroyed by the next spawn, join or wait, on another thread.
+      std::lock_guard lock(group_lock);
+      deferred_frames.push_back(handle);
+      has_deferred_frames.store(true, std::memory_order_relaxed);
+    }
+    release_task();
+  }
+
+ private:
+  std::atomic<size_t> live_tasks{0};
+  std::atomic<size_t> peak_live_tasks{0};
+  std::atomic<uint64_t> spawned_tasks{0};
+  std::atomic<size_t> live_frame_bytes{0};
+  std::atomic<size_t> peak_frame_bytes{0};
+
+  std::mutex group_lock;
+  std::condition_variable group_condition;
+  std::exception_ptr first_exception;
+  std::vector<TaskGroupJoinAwaiter *> joiners;
+  std::vector<std::coroutine_handle<>> deferred_frames;
+  std::atomic<bool> has_deferred_frames{false};
+
+  friend struct TaskGroupJoinAwaiter;
+
+  static void raise_peak(std::atomic<size_t> &peak, size_t value) {
+    auto current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+  }
+
+  void add_task(size_t frame_size) {
+    spawned_tasks.fetch_add(1, std::memory_order_relaxed);
+    raise_peak(peak_live_tasks, live_tasks.fetch_add(1, std::memory_order_relaxed) + 1);
+    raise_peak(peak_frame_bytes, live_frame_bytes.fetch_add(frame_size, std::memory_order_relaxed) + frame_size);
+  }
+
+  void destroy_frame(std::coroutine_handle<> handle) {
+    auto frame_size = FramePool::frame_size(handle.address());
+    handle.destroy();
+    live_frame_bytes.fetch_sub(frame_size, std::memory_order_relaxed);
+  }
+
+  void release_task() {
+    // the last task is released under the lock: a waiter that sees no live tasks may destroy
+    // the group right away, so nothing but locals is touched after unlocking.
+    auto live = live_tasks.load(std::memory_order_relaxed);
+    while (live > 1) {
+      if (live_tasks.compare_exchange_weak(live, live - 1, std::memory_order_acq_rel)) {
+        return;
+      }
+    }
+    std::vector<TaskGroupJoinAwaiter *> resumed_joiners;
+    std::unique_lock lock(group_lock);
+    if (live_tasks.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      resumed_joiners = std::move(joiners);
+      group_condition.notify_all();
+    }
+    lock.unlock();
+
+    for (auto joiner : resumed_joiners) {
+      joiner->resume();
+    }
+  }
+
+  void add_joiner(TaskGroupJoinAwaiter *joiner) {
+    std::unique_lock lock(group_lock);
+    if (live_tasks.load(std::memory_order_acquire) == 0) {
+      lock.unlock();
+      joiner->resume();
+      return;
+    }
+    joiners.push_back(joiner);
+  }
+
+  void wait_for_tasks() {
+    std::unique_lock lock(group_lock);
+    group_condition.wait(lock, [this]() { return live_tasks.load(std::memory_order_acquire) == 0; });
+  }
+
+  void destroy_deferred_frames() {
+    std::unique_lock lock(group_lock);
+    auto frames = std::move(deferred_frames);
+    deferred_frames.clear();
+    has_deferred_frames.store(false, std::memory_order_relaxed);
+    lock.unlock();
+
+    for (auto handle : frames) {
+      destroy_frame(handle);
+    }
+  }
+
+  void rethrow_exception() {
+    std::unique_lock lock(group_lock);
+    auto exception = first_exception;
+    lock.unlock();
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+};
+
+inline bool TaskGroupJoinAwaiter::await_ready() {
+  if (group->live_count() == 0) {
+    _result = Result<void>();
+    return true;
+  }
+  return false;
+}
+
+inline void TaskGroupJoinAwaiter::after_suspend() {
+  group->add_joiner(this);
+}
+
+inline void TaskGroupJoinAwaiter::before_resume() {
+  group->destroy_deferred_frames();
+  group->rethrow_exception();
+}
+
+#endif //CPPCOROUTINES_TASKS_04_TASK_TASKGROUP_H_
@@ -0,0 +1,62 @@
+//
+// Created by benny on 2022/4/20.
+//
+
+#ifndef CPPCOROUTINES_TASKS_09_EXECUTOR_TASKPRIORITY_H_
+#define CPPCOROUTINES_TASKS_09_EXECUTOR_TASKPRIORITY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/**
+ * The lane a task's executables are queued in on executors with priority lanes, such as
+ * LooperExecutor. Executors without lanes treat every priority alike.
+ */
+enum class TaskPriority : uint8_t {
+  // latency-critical work: health checks, control plane.
+  kHigh = 0,
+  kNormal = 1,
+  // bulk and background work.
+  kLow = 2,
+};
+
+constexpr size_t kTaskPriorityCount = 3;
+
+constexpr size_t lane_of(TaskPriority priority) {
+  return static_cast<size_t>(priority);
+}
+
+// the priority of tasks created on this thread: the priority of the task running on it, or the
+// one of a TaskPriorityScope.
+inline TaskPriority &current_task_priority() {
+  thread_local TaskPriority priority = TaskPriority::kNormal;
+  return priority;
+}
+
+/**
+ * Tasks created while the scope is alive get its priority, along with every awaiter they
+ * install:
+ *   TaskPriorityScope scope(TaskPriority::kHigh);
+ *   auto task = HealthCheck();
+ * A task runs with its own priority set, so the tasks it creates inherit it without a scope. The
+ * scope belongs to the thread, it must not be held across a co_await.
+ */
+class TaskPriorityScope {
+ public:
+  explicit TaskPriorityScope(TaskPriority priority)
+      : previous(std::exchange(current_task_priority(), priority)) {}
+
+  TaskPriorityScope(TaskPriorityScope &) = delete;
+
+  TaskPriorityScope &operator=(TaskPriorityScope &) = delete;
+
+  ~TaskPriorityScope() {
+    current_task_priority() = previous;
+  }
+
+ private:
+  TaskPriority previous;
+};
+
+#endif //CPPCOROUTINES_TASKS_09_EXECUTOR_TASKPRIORITY_H_
@@ -5,48 +5,220 @@
 #ifndef CPPCOROUTINES_TASKS_04_TASK_TASKPROMISE_H_
 #define CPPCOROUTINES_TASKS_04_TASK_TASKPROMISE_H_
 
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
 #include <functional>
-#include <mutex>
-#include <list>
+#include <memory>
 #include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
 
 #include "coroutine_common.h"
 #include "Result.h"
-//#include "DispatchAwaiter.h"
+#include "DispatchAwaiter.h"
 #include "TaskAwaiter.h"
 #include "SleepAwaiter.h"
 #include "ChannelAwaiter.h"
 #include "CommonAwaiter.h"
+#include "FramePool.h"
+
+template<typename AwaiterImpl, typename R>
+concept AwaiterImplRestriction = std::is_base_of_v<Awaiter<R>, AwaiterImpl>;
+
+template<typename ResultType, typename Executor>
+class Task;
+
+/**
+ * The executor of a task. Executors without state of their own, such as the shared ones, live in
+ * the frame; the others are allocated separately and keep their size and alignment off it.
+ */
+template<typename Executor, bool kIsStateless = sizeof(Executor) == sizeof(AbstractExecutor)>
+class TaskExecutor {
+ public:
+  AbstractExecutor *get() { return &executor; }
+
+ private:
+  Executor executor;
+};
 
-struct DispatchAwaiter {
-    explicit DispatchAwaiter(std::shared_ptr<AbstractExecutor> executor) noexcept
-            : executor_(std::move(executor)) {}
+template<typename Executor>
+class TaskExecutor<Executor, false> {
+ public:
+  AbstractExecutor *get() { return executor.get(); }
+
+ private:
+  std::unique_ptr<Executor> executor = std::make_unique<Executor>();
+};
 
-    bool await_ready() const { return false; }
+/**
+ * Takes over the frame of a task in place of a Task object, see TaskGroup.
+ */
+class TaskFrameOwner {
+ public:
+  // the frame is suspended at its final point. It must not be destroyed on the calling thread
+  // unless can_destroy is set, the frame owns an executor that would join this thread.
+  virtual void on_task_completed(std::coroutine_handle<> handle, std::exception_ptr exception, bool can_destroy) = 0;
+
+ protected:
+  ~TaskFrameOwner() = default;
+};
 
-    void await_suspend(std::coroutine_handle<> handle) const {
-        executor_->execute([handle]() {
-            handle.resume();
-        });
+/**
+ * The completion state of a task in one word: running with a stack of waiters, completing or
+ * completed, plus whether a TaskFrameOwner has taken over the frame. Nothing is locked and a task
+ * nobody waits for completes with one exchange; only get_result blocks, on a waiter of its own.
+ */
+class TaskCompletion {
+ public:
+  // returns false if the task has completed already, the waiter is not called then.
+  bool add_waiter(TaskCompletionWaiter *waiter) {
+    auto current = state.load(std::memory_order_acquire);
+    while (true) {
+      if (current & (kCompleting | kCompleted)) {
+        wait_completed(current);
+        return false;
+      }
+      waiter->next = waiters_of(current);
+      if (state.compare_exchange_weak(current, reinterpret_cast<uintptr_t>(waiter) | (current & kOwned),
+                                      std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return true;
+      }
     }
+  }
 
-    void await_resume() {}
+  // returns false if the task has completed already, the caller owns the frame then.
+  bool set_owner(TaskFrameOwner *frame_owner) {
+    // only read once the flag is published.
+    owner = frame_owner;
+    auto current = state.load(std::memory_order_acquire);
+    while (true) {
+      if (current & (kCompleting | kCompleted)) {
+        wait_completed(current);
+        return false;
+      }
+      if (state.compare_exchange_weak(current, current | kOwned,
+                                      std::memory_order_acq_rel, std::memory_order_acquire)) {
+        return true;
+      }
+    }
+  }
+
+  // blocks the calling thread until the task has completed.
+  void wait() {
+    BlockingWaiter waiter;
+    if (add_waiter(&waiter)) {
+      waiter.wait();
+    }
+  }
 
-private:
-    std::shared_ptr<AbstractExecutor> executor_;
+  // called at the final suspend point, before anyone can observe the completion. Returns the
+  // waiters in the order they were added in, after giving each a chance to read the frame.
+  TaskCompletionWaiter *begin_completion(TaskFrameOwner *&frame_owner) {
+    auto current = state.exchange(kCompleting, std::memory_order_acq_rel);
+    frame_owner = current & kOwned ? owner : nullptr;
+    TaskCompletionWaiter *waiters = nullptr;
+    auto waiter = waiters_of(current);
+    while (waiter) {
+      auto next = waiter->next;
+      waiter->next = waiters;
+      waiters = waiter;
+      waiter = next;
+    }
+    for (waiter = waiters; waiter; waiter = waiter->next) {
+      waiter->on_completing();
+    }
+    return waiters;
+  }
+
+  // publishes the completion. The frame may be destroyed from here, so only the waiters are
+  // touched. Returns the coroutine to transfer to, if a waiter has one.
+  std::coroutine_handle<> complete(TaskCompletionWaiter *waiters) {
+    state.store(kCompleted, std::memory_order_release);
+    std::coroutine_handle<> transfer = nullptr;
+    while (waiters) {
+      auto next = waiters->next;
+      if (auto handle = waiters->on_completed()) {
+        if (transfer) {
+          handle.resume();
+        } else {
+          transfer = handle;
+        }
+      }
+      waiters = next;
+    }
+    return transfer;
+  }
+
+ private:
+  // waiters are at least 8 bytes aligned, which leaves the low bits for the flags.
+  static constexpr uintptr_t kCompleting = 1;
+  static constexpr uintptr_t kCompleted = 2;
+  static constexpr uintptr_t kOwned = 4;
+  static constexpr uintptr_t kFlags = 7;
+
+  std::atomic<uintptr_t> state{0};
+  TaskFrameOwner *owner = nullptr;
+
+  class BlockingWaiter final : public TaskCompletionWaiter {
+   public:
+    std::coroutine_handle<> on_completed() override {
+      auto address = reinterpret_cast<uint32_t *>(&is_completed);
+      is_completed.store(1, std::memory_order_release);
+      // the waiter may have returned and left its stack frame by now, the futex wake only uses
+      // the address and at worst wakes a later waiter there spuriously.
+      syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+      return nullptr;
+    }
+
+    void wait() {
+      while (!is_completed.load(std::memory_order_acquire)) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&is_completed), FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0);
+      }
+    }
+
+   private:
+    std::atomic<uint32_t> is_completed{0};
+  };
+
+  static TaskCompletionWaiter *waiters_of(uintptr_t value) {
+    return reinterpret_cast<TaskCompletionWaiter *>(value & ~kFlags);
+  }
+
+  void wait_completed(uintptr_t current) {
+    // completing takes a few loads and stores, the frame must stay alive until it is done.
+    while (!(current & kCompleted)) {
+      std::this_thread::yield();
+      current = state.load(std::memory_order_acquire);
+    }
+  }
 };
 
-template<typename AwaiterImpl, typename R>
-concept AwaiterImplRestriction = std::is_base_of_v<Awaiter<R>, AwaiterImpl>;
+/**
+ * Publishes completion once the task is suspended at its final point, so the frame may be
+ * destroyed by whoever observes it, and hands control to the awaiting coroutine: by symmetric
+ * transfer when it may run on this thread, otherwise through its executor.
+ */
+struct TaskFinalAwaiter {
+  bool await_ready() const noexcept { return false; }
+
+  template<typename Promise>
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+    return handle.promise().on_final_suspend();
+  }
 
-template<typename ResultType, typename Executor>
-class Task;
+  void await_resume() noexcept {}
+};
 
 template<typename ResultType, typename Executor>
-struct TaskPromise {
-  DispatchAwaiter initial_suspend() { return DispatchAwaiter{executor}; }
+struct TaskPromise : public PooledFramePromise {
+  DispatchAwaiter initial_suspend() { return DispatchAwaiter{executor.get(), priority}; }
 
-  std::suspend_always final_suspend() noexcept { return {}; }
+  TaskFinalAwaiter final_suspend() noexcept { return {}; }
 
   Task<ResultType, Executor> get_return_object() {
     return Task{std::coroutine_handle<TaskPromise>::from_promise(*this)};
@@ -59,75 +231,121 @@ struct TaskPromise {
 
   template<typename _Rep, typename _Period>
   auto await_transform(std::chrono::duration<_Rep, _Period> &&duration) {
-    return await_transform(SleepAwaiter(duration));
+    return await_transform(SleepAwaiter(std::move(duration)));
   }
 
+  // forwards the awaiter, it is moved at most once more into the coroutine frame.
   template<typename AwaiterImpl>
-  requires AwaiterImplRestriction<AwaiterImpl, typename AwaiterImpl::ResultType>
-  AwaiterImpl await_transform(AwaiterImpl awaiter) {
-    awaiter.install_executor(executor);
-    return awaiter;
+  requires AwaiterImplRestriction<std::remove_cvref_t<AwaiterImpl>, typename std::remove_cvref_t<AwaiterImpl>::ResultType>
+  AwaiterImpl &&await_transform(AwaiterImpl &&awaiter) {
+    awaiter.install_executor(executor.get(), priority);
+    return std::forward<AwaiterImpl>(awaiter);
   }
 
+  // the result is published by the completion at the final suspend point.
   void unhandled_exception() {
-    std::lock_guard lock(completion_lock);
     result = Result<ResultType>(std::current_exception());
-    completion.notify_all();
-    notify_callbacks();
   }
 
   void return_value(ResultType value) {
-    std::lock_guard lock(completion_lock);
-    result = Result<ResultType>(std::move(value));
-    completion.notify_all();
-    notify_callbacks();
+    result.emplace(std::move(value));
   }
 
   ResultType get_result() {
     // blocking for result or throw on exception
-    std::unique_lock lock(completion_lock);
-    if (!result.has_value()) {
-      completion.wait(lock);
+    completion.wait();
+    if constexpr (std::is_copy_constructible_v<ResultType>) {
+      return result->get_or_throw();
+    } else {
+      // a move-only result can only be taken once.
+      return std::move(*result).get_or_throw();
     }
-    return result->get_or_throw();
   }
 
+  // moves the result out, for the awaiter that owns the task.
+  ResultType take_result() {
+    completion.wait();
+    return std::move(*result).get_or_throw();
+  }
+
+  // callbacks get copies, on_completed is not available for move-only results.
   void on_completed(std::function<void(Result<ResultType>)> &&func) {
-    std::unique_lock lock(completion_lock);
-    if (result.has_value()) {
-      auto value = result.value();
-      lock.unlock();
-      func(value);
+    auto callback = std::make_unique<CompletionCallback>(this, std::move(func));
+    if (completion.add_waiter(callback.get())) {
+      callback.release();
     } else {
-      completion_callbacks.push_back(func);
+      callback->func(*result);
     }
   }
 
- private:
-  std::optional<Result<ResultType>> result;
-
-  std::mutex completion_lock;
-  std::condition_variable completion;
+  // returns false if the task has already completed and the awaiting coroutine should not suspend.
+  bool add_waiter(TaskCompletionWaiter *waiter) {
+    return completion.add_waiter(waiter);
+  }
 
-  std::list<std::function<void(Result<ResultType>)>> completion_callbacks;
+  // returns false if the task has already completed, the caller owns the frame then.
+  bool set_owner(TaskFrameOwner *frame_owner) {
+    return completion.set_owner(frame_owner);
+  }
 
-    std::shared_ptr<AbstractExecutor>  executor;
+  // only valid once the task has completed.
+  [[nodiscard]] std::exception_ptr exception() {
+    return result ? result->exception() : nullptr;
+  }
 
-  void notify_callbacks() {
-    auto value = result.value();
-    for (auto &callback : completion_callbacks) {
-      callback(value);
+  std::coroutine_handle<> on_final_suspend() noexcept {
+    TaskFrameOwner *frame_owner;
+    auto waiters = completion.begin_completion(frame_owner);
+    auto self = std::coroutine_handle<TaskPromise>::from_promise(*this);
+    std::exception_ptr task_exception = frame_owner && result ? result->exception() : nullptr;
+    bool can_destroy = !frame_owner
+        || !executor.get()->joins_on_destruction()
+        || !executor.get()->is_executor_thread();
+
+    // the frame may already be destroyed by get_result, only touch locals from here.
+    auto handle = completion.complete(waiters);
+    if (frame_owner) {
+      frame_owner->on_task_completed(self, std::move(task_exception), can_destroy);
     }
-    completion_callbacks.clear();
+    return handle ? handle : std::noop_coroutine();
   }
 
+ private:
+  struct CompletionCallback final : public TaskCompletionWaiter {
+    TaskPromise *promise;
+    std::function<void(Result<ResultType>)> func;
+    std::optional<Result<ResultType>> value;
+
+    CompletionCallback(TaskPromise *promise, std::function<void(Result<ResultType>)> &&func)
+        : promise(promise), func(std::move(func)) {}
+
+    void on_completing() override {
+      value = promise->result;
+    }
+
+    std::coroutine_handle<> on_completed() override {
+      func(std::move(*value));
+      delete this;
+      return nullptr;
+    }
+  };
+
+  std::optional<Result<ResultType>> result;
+
+  TaskCompletion completion;
+
+  TaskExecutor<Executor> executor;
+
+  // the lane the task and everything it awaits run in, inherited from the creating task or scope.
+  TaskPriority priority = current_task_priority();
+
 };
 
 template<typename Executor>
-struct TaskPromise<void, Executor> {
-  DispatchAwaiter initial_suspend() { return DispatchAwaiter{executor}; }
+struct TaskPromise<void, Executor> : public PooledFramePromise {
+  DispatchAwaiter initial_suspend() { return DispatchAwaiter{executor.get(), priority}; }
 
-  std::suspend_always final_suspend() noexcept { return {}; }
+  TaskFinalAwaiter final_suspend() noexcept { return {}; }
 
   Task<void, Executor> get_return_object() {
     return Task{std::coroutine_handle<TaskPromise>::from_promise(*this)};
@@ -140,68 +358,102 @@ struct TaskPromise<void, Executor> {
 
   template<typename _Rep, typename _Period>
   SleepAwaiter await_transform(std::chrono::duration<_Rep, _Period> &&duration) {
-    return await_transform(SleepAwaiter(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()));
+    return await_transform(SleepAwaiter(std::move(duration)));
   }
 
+  // forwards the awaiter, it is moved at most once more into the coroutine frame.
   template<typename AwaiterImpl>
-  requires AwaiterImplRestriction<AwaiterImpl, typename AwaiterImpl::ResultType>
-  AwaiterImpl await_transform(AwaiterImpl &&awaiter) {
-    awaiter.install_executor(executor);
-    return awaiter;
+  requires AwaiterImplRestriction<std::remove_cvref_t<AwaiterImpl>, typename std::remove_cvref_t<AwaiterImpl>::ResultType>
+  AwaiterImpl &&await_transform(AwaiterImpl &&awaiter) {
+    awaiter.install_executor(executor.get(), priority);
+    return std::forward<AwaiterImpl>(awaiter);
   }
 
   void get_result() {
     // blocking for result or throw on exception
-    std::unique_lock lock(completion_lock);
-    if (!result.has_value()) {
-      completion.wait(lock);
-    }
+    completion.wait();
     result->get_or_throw();
   }
 
+  // the result is published by the completion at the final suspend point.
   void unhandled_exception() {
-    std::lock_guard lock(completion_lock);
     result = Result<void>(std::current_exception());
-    completion.notify_all();
-    notify_callbacks();
   }
 
   void return_void() {
-    std::lock_guard lock(completion_lock);
     result = Result<void>();
-    completion.notify_all();
-    notify_callbacks();
   }
 
   void on_completed(std::function<void(Result<void>)> &&func) {
-    std::unique_lock lock(completion_lock);
-    if (result.has_value()) {
-      auto value = result.value();
-      lock.unlock();
-      func(value);
+    auto callback = std::make_unique<CompletionCallback>(this, std::move(func));
+    if (completion.add_waiter(callback.get())) {
+      callback.release();
     } else {
-      completion_callbacks.push_back(func);
+      callback->func(*result);
     }
   }
 
- private:
-  std::optional<Result<void>> result;
-
-  std::mutex completion_lock;
-  std::condition_variable completion;
+  // returns false if the task has already completed and the awaiting coroutine should not suspend.
+  bool add_waiter(TaskCompletionWaiter *waiter) {
+    return completion.add_waiter(waiter);
+  }
 
-  std::list<std::function<void(Result<void>)>> completion_callbacks;
+  // returns false if the task has already completed, the caller owns the frame then.
+  bool set_owner(TaskFrameOwner *frame_owner) {
+    return completion.set_owner(frame_owner);
+  }
 
-    std::shared_ptr<AbstractExecutor>  executor;
+  // only valid once the task has completed.
+  [[nodiscard]] std::exception_ptr exception() {
+    return result ? result->exception() : nullptr;
+  }
 
-  void notify_callbacks() {
-    auto value = result.value();
-    for (auto &callback : completion_callbacks) {
-      callback(value);
+  std::coroutine_handle<> on_final_suspend() noexcept {
+    TaskFrameOwner *frame_owner;
+    auto waiters = completion.begin_completion(frame_owner);
+    auto self = std::coroutine_handle<TaskPromise>::from_promise(*this);
+    std::exception_ptr task_exception = frame_owner && result ? result->exception() : nullptr;
+    bool can_destroy = !frame_owner
+        || !executor.get()->joins_on_destruction()
+        || !executor.get()->is_executor_thread();
+
+    // the frame may already be destroyed by get_result, only touch locals from here.
+    auto handle = completion.complete(waiters);
+    if (frame_owner) {
+      frame_owner->on_task_completed(self, std::move(task_exception), can_destroy);
     }
-    completion_callbacks.clear();
+    return handle ? handle : std::noop_coroutine();
   }
 
+ private:
+  struct CompletionCallback final : public TaskCompletionWaiter {
+    TaskPromise *promise;
+    std::function<void(Result<void>)> func;
+    std::optional<Result<void>> value;
+
+    CompletionCallback(TaskPromise *promise, std::function<void(Result<void>)> &&func)
+        : promise(promise), func(std::move(func)) {}
+
+    void on_completing() override {
+      value = promise->result;
+    }
+
+    std::coroutine_handle<> on_completed() override {
+      func(std::move(*value));
+      delete this;
+      return nullptr;
+    }
+  };
+
+  std::optional<Result<void>> result;
+
+  TaskCompletion completion;
+
+  TaskExecutor<Executor> executor;
+
+  // the lane the task and everything it awaits run in, inherited from the creating task or scope.
+  TaskPriority priority = current_task_priority();
+
 };
 
 #endif //CPPCOROUTINES_TASKS_04_TASK_TASKPROMISE_H_
@@ -0,0 +1,281 @@
+//
+// Created by benny on 2022/3/29.
+//
+
+#ifndef CPPCOROUTINES_TASKS_04_TASK_TIMERQUEUE_H_
+#define CPPCOROUTINES_TASKS_04_TASK_TIMERQUEUE_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "Executable.h"
+
+/**
+ * Timer queues used by BasicScheduler. They are not thread safe, the scheduler guards them.
+ *
+ * Both provide:
+ *   bool empty() const;
+ *   void push(Executable &&func, time_point scheduled_time);
+ *   time_point next_deadline() const;  // no executable is due before, valid if not empty
+ *   // scheduled_times, if given, receives the scheduled time of each expired executable.
+ *   void pop_expired(time_point now, std::vector<Executable> &expired,
+ *                    std::vector<time_point> *scheduled_times = nullptr);
+ *   void clear();
+ */
+using TimerClock = std::chrono::steady_clock;
+
+class DelayedExecutable {
+ public:
+  DelayedExecutable(Executable &&func, TimerClock::time_point scheduled_time)
+      : scheduled_time(scheduled_time), func(std::move(func)) {}
+
+  [[nodiscard]] TimerClock::time_point get_scheduled_time() const {
+    return scheduled_time;
+  }
+
+  Executable &&release() {
+    return std::move(func);
+  }
+
+ private:
+  TimerClock::time_point scheduled_time;
+  Executable func;
+};
+
+class DelayedExecutableCompare {
+ public:
+  bool operator()(const DelayedExecutable &left, const DelayedExecutable &right) const {
+    return left.get_scheduled_time() > right.get_scheduled_time();
+  }
+};
+
+/**
+ * Binary heap, O(log n) insert and expiry, exact deadlines.
+ */
+class HeapTimerQueue {
+ public:
+  [[nodiscard]] bool empty() const {
+    return executable_queue.empty();
+  }
+
+  [[nodiscard]] size_t size() const {
+    return executable_queue.size();
+  }
+
+  void push(Executable &&func, TimerClock::time_point scheduled_time) {
+    executable_queue.emplace_back(std::move(func), scheduled_time);
+    std::push_heap(executable_queue.begin(), executable_queue.end(), DelayedExecutableCompare());
+  }
+
+  [[nodiscard]] TimerClock::time_point next_deadline() const {
+    return executable_queue.front().get_scheduled_time();
+  }
+
+  void pop_expired(TimerClock::time_point now, std::vector<Executable> &expired,
+                   std::vector<TimerClock::time_point> *scheduled_times = nullptr) {
+    while (!executable_queue.empty() && executable_queue.front().get_scheduled_time() <= now) {
+      std::pop_heap(executable_queue.begin(), executable_queue.end(), DelayedExecutableCompare());
+      if (scheduled_times) scheduled_times->push_back(executable_queue.back().get_scheduled_time());
+      expired.push_back(executable_queue.back().release());
+      executable_queue.pop_back();
+    }
+  }
+
+  void clear() {
+    decltype(executable_queue) empty_queue;
+    std::swap(executable_queue, empty_queue);
+  }
+
+ private:
+  std::vector<DelayedExecutable> executable_queue;
+};
+
+/**
+ * Hierarchical timing wheel with 1ms ticks: 4 levels of 256 slots cover 2^32 ms, longer delays
+ * are parked in the last level and re-inserted when reached. Insert and expiry are O(1), an
+ * executable never fires early and at most one tick late.
+ */
+class TimingWheelTimerQueue {
+ public:
+  using Tick = uint64_t;
+  static constexpr auto kTickDuration = std::chrono::milliseconds(1);
+
+  explicit TimingWheelTimerQueue(TimerClock::time_point origin = TimerClock::now()) : origin(origin) {
+    for (auto &level : wheel) {
+      level.fill(kNil);
+    }
+  }
+
+  [[nodiscard]] bool empty() const {
+    return count == 0;
+  }
+
+  [[nodiscard]] size_t size() const {
+    return count;
+  }
+
+  void push(Executable &&func, TimerClock::time_point scheduled_time) {
+    auto index = allocate_node();
+    auto &node = nodes[index];
+    node.func = std::move(func);
+    node.scheduled_time = scheduled_time;
+    node.expire_tick = ceil_tick(scheduled_time);
+    ++count;
+    insert(index);
+  }
+
+  [[nodiscard]] TimerClock::time_point next_deadline() const {
+    if (expired_head != kNil) {
+      return time_of(current_tick);
+    }
+    // level 0 holds everything due before the next cascade.
+    for (Tick tick = current_tick + 1; ; ++tick) {
+      if (wheel[0][tick & kSlotMask] != kNil || (tick & kSlotMask) == 0) {
+        return time_of(tick);
+      }
+    }
+  }
+
+  void pop_expired(TimerClock::time_point now, std::vector<Executable> &expired,
+                   std::vector<TimerClock::time_point> *scheduled_times = nullptr) {
+    advance(floor_tick(now));
+    while (expired_head != kNil) {
+      auto index = expired_head;
+      expired_head = nodes[index].next;
+      if (scheduled_times) scheduled_times->push_back(nodes[index].scheduled_time);
+      expired.push_back(std::move(nodes[index].func));
+      release_node(index);
+      --count;
+    }
+  }
+
+  void clear() {
+    nodes.clear();
+    free_head = kNil;
+    expired_head = kNil;
+    for (auto &level : wheel) {
+      level.fill(kNil);
+    }
+    count = 0;
+  }
+
+ private:
+  static constexpr uint32_t kNil = UINT32_MAX;
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr Tick kSlotMask = (1u << kSlotBits) - 1;
+
+  struct Node {
+    Executable func;
+    TimerClock::time_point scheduled_time;
+    Tick expire_tick = 0;
+    uint32_t next = kNil;
+  };
+
+  TimerClock::time_point origin;
+  Tick current_tick = 0;
+  size_t count = 0;
+
+  std::vector<Node> nodes;
+  uint32_t free_head = kNil;
+  uint32_t expired_head = kNil;
+  std::array<std::array<uint32_t, 1u << kSlotBits>, kLevels> wheel{};
+
+  [[nodiscard]] Tick floor_tick(TimerClock::time_point time) const {
+    if (time <= origin) return 0;
+    return static_cast<Tick>((time - origin) / kTickDuration);
+  }
+
+  [[nodiscard]] Tick ceil_tick(TimerClock::time_point time) const {
+    if (time <= origin) return 0;
+    auto elapsed = time - origin;
+    auto tick = static_cast<Tick>(elapsed / kTickDuration);
+    return elapsed % kTickDuration == TimerClock::duration::zero() ? tick : tick + 1;
+  }
+
+  [[nodiscard]] TimerClock::time_point time_of(Tick tick) const {
+    return origin + tick * kTickDuration;
+  }
+
+  uint32_t allocate_node() {
+    if (free_head != kNil) {
+      return std::exchange(free_head, nodes[free_head].next);
+    }
+    nodes.emplace_back();
+    return static_cast<uint32_t>(nodes.size() - 1);
+  }
+
+  void release_node(uint32_t index) {
+    nodes[index].func = nullptr;
+    nodes[index].next = free_head;
+    free_head = index;
+  }
+
+  void link(uint32_t &head, uint32_t index) {
+    nodes[index].next = head;
+    head = index;
+  }
+
+  void insert(uint32_t index) {
+    auto expire_tick = nodes[index].expire_tick;
+    if (expire_tick <= current_tick) {
+      link(expired_head, index);
+      return;
+    }
+
+    auto delta = expire_tick - current_tick;
+    int level = 0;
+    while (level < kLevels - 1 && delta >= (Tick(1) << (kSlotBits * (level + 1)))) {
+      ++level;
+    }
+    // beyond the last level: wait in the farthest slot and get re-inserted from there.
+    if (delta >= (Tick(1) << (kSlotBits * kLevels))) {
+      expire_tick = current_tick + (Tick(1) << (kSlotBits * kLevels)) - 1;
+    }
+    auto slot = (expire_tick >> (kSlotBits * level)) & kSlotMask;
+    link(wheel[level][slot], index);
+  }
+
+  void cascade(int level, Tick tick) {
+    auto slot = (tick >> (kSlotBits * level)) & kSlotMask;
+    auto index = std::exchange(wheel[level][slot], kNil);
+    while (index != kNil) {
+      auto next = nodes[index].next;
+      insert(index);
+      index = next;
+    }
+  }
+
+  void advance(Tick target_tick) {
+    while (current_tick < target_tick) {
+      if (count == 0) {
+        current_tick = target_tick;
+        return;
+      }
+
+      auto tick = ++current_tick;
+      if ((tick & kSlotMask) == 0) {
+        // cascade from the outermost level that wrapped, so entries can fall through.
+        int top = 1;
+        while (top < kLevels - 1 && ((tick >> (kSlotBits * top)) & kSlotMask) == 0) {
+          ++top;
+        }
+        for (int level = top; level >= 1; --level) {
+          cascade(level, tick);
+        }
+      }
+
+      auto index = std::exchange(wheel[0][tick & kSlotMask], kNil);
+      while (index != kNil) {
+        auto next = nodes[index].next;
+        link(expired_head, index);
+        index = next;
+      }
+    }
+  }
+};
+
+#endif //CPPCOROUTINES_TASKS_04_TASK_TIMERQUEUE_H_
@@ -0,0 +1,297 @@
+//
+// Created by benny on 2022/3/27.
+//
+
+#ifndef CPPCOROUTINES_TASKS_09_EXECUTOR_WORKSTEALINGEXECUTOR_H_
+#define CPPCOROUTINES_TASKS_09_EXECUTOR_WORKSTEALINGEXECUTOR_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Executor.h"
+
+/**
+ * Runs executables on a fixed set of worker threads.
+ *
+ * Each worker owns a deque. Executables submitted from a worker go to its own deque,
+ * executables submitted from other threads are spread over the workers round-robin.
+ * An idle worker steals half of the executables of a busy one before it parks.
+ */
+class WorkStealingExecutor : public AbstractExecutor {
+ private:
+  struct QueuedExecutable {
+    Executable func;
+    // set while metrics are enabled.
+    MetricsClock::time_point enqueued_at;
+  };
+
+  struct Worker {
+    std::mutex lock;
+    std::deque<QueuedExecutable> executable_queue;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t> next_worker{0};
+  // executables pushed but not yet popped by any worker.
+  std::atomic<size_t> pending_count{0};
+
+  std::mutex park_lock;
+  std::condition_variable park_condition;
+  std::atomic<size_t> idle_count{0};
+
+  std::atomic<bool> is_active;
+
+  ExecutorMetricsSlot metrics;
+
+  struct CurrentWorker {
+    WorkStealingExecutor *executor = nullptr;
+    size_t index = 0;
+  };
+
+  static CurrentWorker &current_worker() {
+    thread_local CurrentWorker current;
+    return current;
+  }
+
+  bool pop_local(size_t index, QueuedExecutable &func) {
+    auto &worker = *workers[index];
+    std::lock_guard lock(worker.lock);
+    if (worker.executable_queue.empty()) {
+      return false;
+    }
+    func = std::move(worker.executable_queue.front());
+    worker.executable_queue.pop_front();
+    return true;
+  }
+
+  bool steal(size_t index, QueuedExecutable &func) {
+    auto count = workers.size();
+    for (size_t i = 1; i < count; ++i) {
+      auto &victim = *workers[(index + i) % count];
+      std::unique_lock victim_lock(victim.lock);
+      auto size = victim.executable_queue.size();
+      if (size == 0) {
+        continue;
+      }
+
+      // take the newest half, the victim keeps on working from the front.
+      std::deque<QueuedExecutable> stolen;
+      for (size_t n = (size + 1) / 2; n > 0; --n) {
+        stolen.push_front(std::move(victim.executable_queue.back()));
+        victim.executable_queue.pop_back();
+      }
+      victim_lock.unlock();
+
+      func = std::move(stolen.front());
+      stolen.pop_front();
+      if (!stolen.empty()) {
+        auto &self = *workers[index];
+        std::lock_guard lock(self.lock);
+        for (auto &executable : stolen) {
+          self.executable_queue.push_back(std::move(executable));
+        }
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void run_loop(size_t index) {
+    current_worker() = {this, index};
+    is_loop_thread() = true;
+    QueuedExecutable queued;
+    while (true) {
+      if (pop_local(index, queued) || steal(index, queued)) {
+        pending_count.fetch_sub(1);
+        if (queued.enqueued_at != MetricsClock::time_point()) {
+          run_measured(index, queued);
+        } else {
+          queued.func();
+        }
+        queued.func = nullptr;
+        continue;
+      }
+
+      std::unique_lock lock(park_lock);
+      if (pending_count.load() > 0) {
+        // someone is about to push or another worker holds it, try again.
+        lock.unlock();
+        std::this_thread::yield();
+        continue;
+      }
+      if (!is_active.load(std::memory_order_relaxed)) {
+        break;
+      }
+      idle_count.fetch_add(1);
+      park_condition.wait(lock, [this]() {
+        return pending_count.load() > 0 || !is_active.load(std::memory_order_relaxed);
+      });
+      idle_count.fetch_sub(1);
+    }
+    current_worker() = {};
+    debug("run_loop exit.");
+  }
+
+  void run_measured(size_t index, QueuedExecutable &queued) {
+    auto current_metrics = metrics.get();
+    current_metrics->on_dequeue();
+    auto &histograms = current_metrics->thread(index);
+    auto start = MetricsClock::now();
+    histograms.schedule_delay.record(start - queued.enqueued_at);
+    queued.func();
+    histograms.run_time.record(MetricsClock::now() - start);
+  }
+
+  void push(size_t index, Executable &&func) {
+    MetricsClock::time_point enqueued_at;
+    if (auto current_metrics = metrics.get()) {
+      enqueued_at = MetricsClock::now();
+      current_metrics->on_enqueue();
+    }
+    auto &worker = *workers[index];
+    std::lock_guard lock(worker.lock);
+    worker.executable_queue.push_back({std::move(func), enqueued_at});
+  }
+
+ public:
+
+  explicit WorkStealingExecutor(size_t worker_count = std::thread::hardware_concurrency()) {
+    if (worker_count == 0) {
+      worker_count = 1;
+    }
+    is_active.store(true, std::memory_order_relaxed);
+    for (size_t i = 0; i < worker_count; ++i) {
+      workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+      workers[i]->thread = std::thread(&WorkStealingExecutor::run_loop, this, i);
+    }
+  }
+
+  ~WorkStealingExecutor() {
+    shutdown(false);
+    join();
+  }
+
+  void execute(Executable &&func) override {
+    if (!is_active.load(std::memory_order_relaxed)) {
+      return;
+    }
+
+    auto &current = current_worker();
+    size_t index;
+    if (current.executor == this) {
+      index = current.index;
+    } else {
+      index = next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    }
+
+    pending_count.fetch_add(1);
+    push(index, std::move(func));
+
+    // pairs with idle_count.fetch_add in run_loop: either we see the idle worker,
+    // or it sees our pending executable before it parks.
+    if (idle_count.load() > 0) {
+      std::unique_lock lock(park_lock);
+      lock.unlock();
+      park_condition.notify_one();
+    }
+  }
+
+  void shutdown(bool wait_for_complete = true) {
+    is_active.store(false, std::memory_order_relaxed);
+    if (!wait_for_complete) {
+      // clear queues.
+      for (auto &worker : workers) {
+        std::unique_lock lock(worker->lock);
+        decltype(worker->executable_queue) empty_queue;
+        std::swap(worker->executable_queue, empty_queue);
+        pending_count.fetch_sub(empty_queue.size());
+        lock.unlock();
+        if (auto current_metrics = metrics.get()) {
+          for (auto &queued : empty_queue) {
+            if (queued.enqueued_at != MetricsClock::time_point()) current_metrics->on_dequeue();
+          }
+        }
+      }
+    }
+
+    std::unique_lock lock(park_lock);
+    lock.unlock();
+    park_condition.notify_all();
+  }
+
+  void join() {
+    for (auto &worker : workers) {
+      if (worker->thread.joinable() && worker->thread.get_id() != std::this_thread::get_id()) {
+        worker->thread.join();
+      }
+    }
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return current_worker().executor == this;
+  }
+
+  [[nodiscard]] bool joins_on_destruction() const override {
+    return true;
+  }
+
+  [[nodiscard]] size_t worker_count() const {
+    return workers.size();
+  }
+
+  void enable_metrics() override {
+    metrics.enable(workers.size());
+  }
+
+  [[nodiscard]] std::optional<ExecutorMetricsSnapshot> metrics_snapshot() override {
+    return metrics.snapshot();
+  }
+};
+
+/**
+ * Tasks own their executor, so Task<R, SharedWorkStealingExecutor> is the way to run
+ * many tasks on one pool. Call set_worker_count before the first task is created.
+ */
+class SharedWorkStealingExecutor : public AbstractExecutor {
+ public:
+  static void set_worker_count(size_t worker_count) {
+    configured_worker_count().store(worker_count, std::memory_order_relaxed);
+  }
+
+  static WorkStealingExecutor &shared_executor() {
+    static WorkStealingExecutor sharedWorkStealingExecutor(configured_worker_count().load(std::memory_order_relaxed));
+    return sharedWorkStealingExecutor;
+  }
+
+  void execute(Executable &&func) override {
+    shared_executor().execute(std::move(func));
+  }
+
+  [[nodiscard]] bool is_executor_thread() const override {
+    return shared_executor().is_executor_thread();
+  }
+
+  void enable_metrics() override {
+    shared_executor().enable_metrics();
+  }
+
+  [[nodiscard]] std::optional<ExecutorMetricsSnapshot> metrics_snapshot() override {
+    return shared_executor().metrics_snapshot();
+  }
+
+ private:
+  static std::atomic<size_t> &configured_worker_count() {
+    static std::atomic<size_t> worker_count{std::thread::hardware_concurrency()};
+    return worker_count;
+  }
+};
+
+#endif //CPPCOROUTINES_TASKS_09_EXECUTOR_WORKSTEALINGEXECUTOR_H_
@@ -0,0 +1,94 @@
+//
+// Created by benny on 2022/3/28.
+//
+// Counts heap allocations per Channel round trip between two tasks on their own LooperExecutors.
+// Resuming a coroutine should not allocate once the executors have warmed up.
+//
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+#include "Channel.h"
+#include "Executor.h"
+#include "Task.h"
+
+static std::atomic<long long> allocation_count{0};
+
+void *operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+  operator delete(p);
+}
+
+constexpr int kWarmUp = 1000;
+constexpr int kRoundTrips = 100000;
+
+std::atomic<long long> allocations_before{0};
+std::atomic<long long> allocations_after{0};
+
+Task<void, LooperExecutor> Pinger(Channel<int> &ping, Channel<int> &pong) {
+  for (int i = 0; i < kWarmUp + kRoundTrips; ++i) {
+    if (i == kWarmUp) allocations_before = allocation_count.load();
+    co_await ping.write(i);
+    co_await pong.read();
+  }
+  allocations_after = allocation_count.load();
+}
+
+Task<void, LooperExecutor> Ponger(Channel<int> &ping, Channel<int> &pong) {
+  for (int i = 0; i < kWarmUp + kRoundTrips; ++i) {
+    auto value = co_await ping.read();
+    co_await pong.write(value);
+  }
+}
+
+void channel_round_trip(int capacity) {
+  Channel<int> ping(capacity);
+  Channel<int> pong(capacity);
+  auto ponger = Ponger(ping, pong);
+  auto pinger = Pinger(ping, pong);
+  pinger.get_result();
+  ponger.get_result();
+
+  auto allocations = allocations_after.load() - allocations_before.load();
+  std::cout << "channel capacity=" << capacity
+            << " round_trips=" << kRoundTrips
+            << " allocations=" << allocations
+            << " allocations/round_trip=" << static_cast<double>(allocations) / kRoundTrips << std::endl;
+}
+
+void looper_execute() {
+  LooperExecutor executor;
+  std::atomic<int> done{0};
+  // the first burst fills the node pool up to the peak queue depth.
+  for (int i = 0; i < kRoundTrips; ++i) {
+    executor.execute([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+  }
+  while (done.load() < kRoundTrips) std::this_thread::yield();
+
+  auto before = allocation_count.load();
+  for (int i = 0; i < kRoundTrips; ++i) {
+    executor.execute([&done]() { done.fetch_add(1, std::memory_order_relaxed); });
+  }
+  while (done.load() < 2 * kRoundTrips) std::this_thread::yield();
+  auto allocations = allocation_count.load() - before;
+  std::cout << "looper execute=" << kRoundTrips
+            << " allocations=" << allocations
+            << " allocations/execute=" << static_cast<double>(allocations) / kRoundTrips << std::endl;
+}
+
+int main() {
+  channel_round_trip(0);
+  channel_round_trip(1);
+  looper_execute();
+  return 0;
+}
@@ -0,0 +1,109 @@
+//
+// Created by benny on 2022/4/19.
+//
+// One writer sends kMessages payloads of kPayloadSize bytes to K subscribers, all tasks on
+// SharedLooperExecutor:
+//   fan_out:   one RingChannel per subscriber, every payload is copied into each of them.
+//   broadcast: one BroadcastChannel, every payload is stored once and shared.
+// Reports writes and deliveries per second.
+//
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "BroadcastChannel.h"
+#include "Executor.h"
+#include "RingChannel.h"
+#include "Task.h"
+
+constexpr int kMessages = 100000;
+constexpr size_t kPayloadSize = 256;
+constexpr size_t kCapacity = 256;
+
+using Payload = std::vector<char>;
+using BenchClock = std::chrono::steady_clock;
+
+Task<void, SharedLooperExecutor> FanOutWriter(std::vector<std::unique_ptr<RingChannel<Payload>>> &channels) {
+  Payload payload(kPayloadSize, 'x');
+  for (int i = 0; i < kMessages; ++i) {
+    for (auto &channel : channels) {
+      co_await channel->write(payload);
+    }
+  }
+}
+
+Task<long, SharedLooperExecutor> FanOutReader(RingChannel<Payload> &channel) {
+  long bytes = 0;
+  for (int i = 0; i < kMessages; ++i) {
+    bytes += static_cast<long>((co_await channel.read()).size());
+  }
+  co_return bytes;
+}
+
+Task<void, SharedLooperExecutor> BroadcastWriter(BroadcastChannel<Payload> &channel) {
+  Payload payload(kPayloadSize, 'x');
+  for (int i = 0; i < kMessages; ++i) {
+    co_await channel.write(payload);
+  }
+}
+
+Task<long, SharedLooperExecutor> BroadcastReader(BroadcastSubscriber<Payload> subscriber) {
+  long bytes = 0;
+  for (int i = 0; i < kMessages; ++i) {
+    bytes += static_cast<long>((co_await subscriber.read())->size());
+  }
+  co_return bytes;
+}
+
+void report(const char *name, int subscribers, BenchClock::time_point start, long bytes) {
+  auto seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+  std::cout << name
+            << " subscribers=" << subscribers
+            << " writes/s=" << static_cast<long long>(kMessages / seconds)
+            << " deliveries/s=" << static_cast<long long>(static_cast<double>(kMessages) * subscribers / seconds)
+            << " bytes=" << bytes << std::endl;
+}
+
+void fan_out(int subscribers) {
+  std::vector<std::unique_ptr<RingChannel<Payload>>> channels;
+  for (int i = 0; i < subscribers; ++i) {
+    channels.push_back(std::make_unique<RingChannel<Payload>>(kCapacity));
+  }
+  auto start = BenchClock::now();
+  std::vector<Task<long, SharedLooperExecutor>> readers;
+  for (auto &channel : channels) {
+    readers.push_back(FanOutReader(*channel));
+  }
+  FanOutWriter(channels).get_result();
+  long bytes = 0;
+  for (auto &reader : readers) {
+    bytes += reader.get_result();
+  }
+  report("fan_out", subscribers, start, bytes);
+}
+
+void broadcast(int subscribers) {
+  BroadcastChannel<Payload> channel(kCapacity);
+  auto start = BenchClock::now();
+  std::vector<Task<long, SharedLooperExecutor>> readers;
+  for (int i = 0; i < subscribers; ++i) {
+    readers.push_back(BroadcastReader(channel.subscribe()));
+  }
+  BroadcastWriter(channel).get_result();
+  long bytes = 0;
+  for (auto &reader : readers) {
+    bytes += reader.get_result();
+  }
+  report("broadcast", subscribers, start, bytes);
+}
+
+int main() {
+  Logger::set_level(LogLevel::kOff);
+  SharedLooperExecutor::shared_executor();
+  for (int subscribers : {1, 4, 16, 64}) {
+    fan_out(subscribers);
+    broadcast(subscribers);
+  }
+  return 0;
+}
@@ -0,0 +1,545 @@
+//
+// Created by benny on 2022/4/7.
+//
+// Microbenchmarks of the runtime, printed as one JSON document on stdout:
+//   coro-bench [name-filter]
+// Latencies are in nanoseconds. Each case carries perf_event_open counters per operation; they
+// cover the calling thread and the threads it started that exited during the case, not shared
+// executors started earlier, and are null where the kernel does not allow them. debug() output is discarded while running.
+//
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AsyncGenerator.h"
+#include "Channel.h"
+#include "Executor.h"
+#include "Select.h"
+#include "ShardedRuntime.h"
+#include "SleepAwaiter.h"
+#include "SpawnBlockingAwaiter.h"
+#include "Task.h"
+#include "TaskCombinators.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+static long long elapsed_ns(BenchClock::time_point start, BenchClock::time_point end = BenchClock::now()) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+class PerfCounters {
+ public:
+  struct Event {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+  };
+
+  ~PerfCounters() {
+    close_all();
+  }
+
+  // counters are opened per case, so that threads of earlier cases do not report into it.
+  void start() {
+    close_all();
+    for (auto &event : kEvents) {
+      perf_event_attr attr{};
+      attr.size = sizeof(attr);
+      attr.type = event.type;
+      attr.config = event.config;
+      attr.inherit = 1;
+      attr.exclude_hv = 1;
+      fds.push_back(static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC)));
+    }
+  }
+
+  // counts per operation as a JSON object member list, null for unavailable counters.
+  std::string stop(double operations) {
+    std::string json;
+    for (size_t i = 0; i < fds.size(); ++i) {
+      if (i > 0) json += ", ";
+      json += std::string("\"") + kEvents[i].name + "\": ";
+      uint64_t value;
+      if (fds[i] >= 0 && ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0) == 0
+          && read(fds[i], &value, sizeof(value)) == sizeof(value)) {
+        json += format_number(static_cast<double>(value) / operations);
+      } else {
+        json += "null";
+      }
+    }
+    return json;
+  }
+
+  static std::string format_number(double value) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", value);
+    return buffer;
+  }
+
+ private:
+  static constexpr Event kEvents[] = {
+      {"context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+      {"cpu_migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+      {"cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+      {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  };
+
+  std::vector<int> fds;
+
+  void close_all() {
+    for (auto fd : fds) {
+      if (fd >= 0) close(fd);
+    }
+    fds.clear();
+  }
+};
+
+class Report {
+ public:
+  explicit Report(std::string filter) : filter(std::move(filter)) {}
+
+  bool is_selected(const std::string &name) const {
+    return name.find(filter) != std::string::npos;
+  }
+
+  // runs body, which returns one latency sample per operation in ns.
+  template<typename Body>
+  void run(const std::string &name, Body &&body) {
+    if (!is_selected(name)) return;
+    counters.start();
+    auto start = BenchClock::now();
+    std::vector<long long> samples = body();
+    auto total = elapsed_ns(start);
+    auto counter_json = counters.stop(static_cast<double>(samples.size()));
+    add(name, samples, total, counter_json);
+  }
+
+  // runs body, which performs operations and returns how many.
+  template<typename Body>
+  void run_throughput(const std::string &name, Body &&body) {
+    if (!is_selected(name)) return;
+    counters.start();
+    auto start = BenchClock::now();
+    long long operations = body();
+    auto total = elapsed_ns(start);
+    auto counter_json = counters.stop(static_cast<double>(operations));
+    std::string json = "    {\"name\": \"" + name + "\", \"operations\": " + std::to_string(operations)
+        + ", \"total_ns\": " + std::to_string(total)
+        + ", \"ops_per_s\": " + PerfCounters::format_number(operations * 1e9 / static_cast<double>(total))
+        + ", \"counters\": {" + counter_json + "}}";
+    results.push_back(json);
+    std::cerr << name << " done" << std::endl;
+  }
+
+  void print() const {
+    std::string json = "{\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+      json += results[i];
+      json += i + 1 < results.size() ? ",\n" : "\n";
+    }
+    json += "  ]\n}\n";
+    fwrite(json.data(), 1, json.size(), stdout);
+    fflush(stdout);
+  }
+
+ private:
+  std::string filter;
+  PerfCounters counters;
+  std::vector<std::string> results;
+
+  void add(const std::string &name, std::vector<long long> &samples, long long total, const std::string &counter_json) {
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double p) {
+      auto index = static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5);
+      return std::to_string(samples[index]);
+    };
+    long double sum = 0;
+    for (auto sample : samples) sum += sample;
+
+    std::string json = "    {\"name\": \"" + name + "\", \"operations\": " + std::to_string(samples.size())
+        + ", \"total_ns\": " + std::to_string(total)
+        + ", \"ops_per_s\": " + PerfCounters::format_number(samples.size() * 1e9 / static_cast<double>(total))
+        + ", \"latency_ns\": {\"mean\": " + PerfCounters::format_number(static_cast<double>(sum / samples.size()))
+        + ", \"min\": " + std::to_string(samples.front())
+        + ", \"p50\": " + percentile(0.5)
+        + ", \"p90\": " + percentile(0.9)
+        + ", \"p99\": " + percentile(0.99)
+        + ", \"p999\": " + percentile(0.999)
+        + ", \"max\": " + std::to_string(samples.back())
+        + "}, \"counters\": {" + counter_json + "}}";
+    results.push_back(json);
+    std::cerr << name << " done" << std::endl;
+  }
+};
+
+// Task spawn + complete
+
+Task<int, NoopExecutor> InlineTask(int value) {
+  co_return value;
+}
+
+Task<int, SharedLooperExecutor> LooperTask(int value) {
+  co_return value;
+}
+
+template<typename TaskFactory>
+std::vector<long long> spawn_complete(int count, TaskFactory &&factory) {
+  std::vector<long long> samples;
+  samples.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    factory(i).get_result();
+    samples.push_back(elapsed_ns(start));
+  }
+  return samples;
+}
+
+// nested co_await
+
+Task<int, SharedLooperExecutor> Nested(int depth) {
+  if (depth == 0) co_return 0;
+  co_return 1 + co_await Nested(depth - 1);
+}
+
+std::vector<long long> nested_await(int depth, int count) {
+  std::vector<long long> samples;
+  samples.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    Nested(depth).get_result();
+    samples.push_back(elapsed_ns(start));
+  }
+  return samples;
+}
+
+// hops between two shards of the shared runtime, each one through a cross-shard mailbox.
+
+Task<void, ShardExecutor> ShardHopper(int count, std::vector<long long> &samples) {
+  co_await on_shard(0);
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    co_await on_shard(1);
+    co_await on_shard(0);
+    samples.push_back(elapsed_ns(start));
+  }
+}
+
+std::vector<long long> shard_hop(int count) {
+  std::vector<long long> samples;
+  samples.reserve(count);
+  ShardHopper(count, samples).get_result();
+  return samples;
+}
+
+// Channel ping-pong and streaming
+
+Task<void, LooperExecutor> Pinger(Channel<int> &ping, Channel<int> &pong, int count, std::vector<long long> &samples) {
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    co_await ping.write(i);
+    co_await pong.read();
+    samples.push_back(elapsed_ns(start));
+  }
+}
+
+Task<void, LooperExecutor> Ponger(Channel<int> &ping, Channel<int> &pong, int count) {
+  for (int i = 0; i < count; ++i) {
+    auto value = co_await ping.read();
+    co_await pong.write(value);
+  }
+}
+
+std::vector<long long> channel_ping_pong(int capacity, int count) {
+  Channel<int> ping(capacity);
+  Channel<int> pong(capacity);
+  std::vector<long long> samples;
+  samples.reserve(count);
+  auto ponger = Ponger(ping, pong, count);
+  auto pinger = Pinger(ping, pong, count, samples);
+  pinger.get_result();
+  ponger.get_result();
+  return samples;
+}
+
+template<typename ValueType, typename Factory>
+Task<void, LooperExecutor> Producer(Channel<ValueType> &channel, int count, Factory make_value) {
+  for (int i = 0; i < count; ++i) {
+    co_await channel.write(make_value(i));
+  }
+}
+
+template<typename ValueType>
+Task<void, LooperExecutor> Consumer(Channel<ValueType> &channel, int count) {
+  for (int i = 0; i < count; ++i) {
+    co_await channel.read();
+  }
+}
+
+template<typename ValueType = int, typename Factory>
+long long channel_stream(int capacity, int count, Factory make_value) {
+  Channel<ValueType> channel(capacity);
+  auto consumer = Consumer(channel, count);
+  auto producer = Producer(channel, count, make_value);
+  producer.get_result();
+  consumer.get_result();
+  return count;
+}
+
+long long channel_stream(int capacity, int count) {
+  return channel_stream(capacity, count, [](int i) { return i; });
+}
+
+// the same stream pulled from an AsyncGenerator, without a channel in between.
+
+AsyncGenerator<int> Generate(int count) {
+  for (int i = 0; i < count; ++i) {
+    co_yield i;
+  }
+}
+
+Task<void, LooperExecutor> GeneratorConsumer(int count) {
+  auto generator = Generate(count);
+  while (co_await generator.next()) {}
+}
+
+long long generator_stream(int count) {
+  GeneratorConsumer(count).get_result();
+  return count;
+}
+
+// one consumer selecting over two channels, each fed by its own producer.
+
+Task<void, LooperExecutor> Selector(Channel<int> &first, Channel<int> &second, int count) {
+  for (int i = 0; i < count; ++i) {
+    co_await select(first.read(), second.read());
+  }
+}
+
+long long channel_select(int capacity, int count) {
+  Channel<int> first(capacity);
+  Channel<int> second(capacity);
+  auto selector = Selector(first, second, count * 2);
+  auto first_producer = Producer(first, count, [](int i) { return i; });
+  auto second_producer = Producer(second, count, [](int i) { return i; });
+  first_producer.get_result();
+  second_producer.get_result();
+  selector.get_result();
+  return count * 2;
+}
+
+// fan-in of subtasks on the shared looper, awaited one by one or with a single when_all.
+
+Task<int, SharedLooperExecutor> Subtask(int i) {
+  co_return i;
+}
+
+Task<void, SharedLooperExecutor> SequentialFanIn(int width, int rounds) {
+  for (int round = 0; round < rounds; ++round) {
+    std::vector<Task<int, SharedLooperExecutor>> tasks;
+    tasks.reserve(width);
+    for (int i = 0; i < width; ++i) {
+      tasks.push_back(Subtask(i));
+    }
+    for (auto &task : tasks) {
+      co_await std::move(task);
+    }
+  }
+}
+
+Task<void, SharedLooperExecutor> WhenAllFanIn(int width, int rounds) {
+  for (int round = 0; round < rounds; ++round) {
+    std::vector<Task<int, SharedLooperExecutor>> tasks;
+    tasks.reserve(width);
+    for (int i = 0; i < width; ++i) {
+      tasks.push_back(Subtask(i));
+    }
+    co_await when_all(std::move(tasks));
+  }
+}
+
+// SleepAwaiter, samples are the lateness past the requested duration. The shared looper fires
+// its own timers; the scheduler cases take the former path through the shared Scheduler thread,
+// which rounds down to milliseconds and dispatches back to the looper.
+
+struct SchedulerSleepAwaiter : Awaiter<void> {
+  explicit SchedulerSleepAwaiter(std::chrono::microseconds duration)
+      : duration(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()) {}
+
+  void after_suspend() override {
+    SleepAwaiter::scheduler().execute([this] { resume(); }, duration);
+  }
+
+ private:
+  long long duration;
+};
+
+Task<void, SharedLooperExecutor> Sleeper(long long us, bool via_scheduler, int count, std::vector<long long> &samples) {
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    if (via_scheduler) {
+      co_await SchedulerSleepAwaiter(std::chrono::microseconds(us));
+    } else {
+      co_await std::chrono::microseconds(us);
+    }
+    samples.push_back(elapsed_ns(start) - us * 1000);
+  }
+}
+
+std::vector<long long> sleep_lateness(long long us, bool via_scheduler, int count) {
+  std::vector<long long> samples;
+  samples.reserve(count);
+  Sleeper(us, via_scheduler, count, samples).get_result();
+  return samples;
+}
+
+// a blocking call from a coroutine on the shared looper and back.
+
+Task<void, SharedLooperExecutor> BlockingCaller(int count, std::vector<long long> &samples) {
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    co_await spawn_blocking([]() {});
+    samples.push_back(elapsed_ns(start));
+  }
+}
+
+std::vector<long long> spawn_blocking_round_trip(int count) {
+  std::vector<long long> samples;
+  samples.reserve(count);
+  BlockingCaller(count, samples).get_result();
+  return samples;
+}
+
+// execute(), samples are the time from the call until the executable starts running.
+
+// one executor per type for all cases, never destroyed, so no case pays for starting its threads.
+template<typename Executor>
+Executor &leaked_executor() {
+  static auto executor = new Executor();
+  return *executor;
+}
+
+struct MeasuredLooperExecutor : public LooperExecutor {
+  MeasuredLooperExecutor() {
+    enable_metrics();
+  }
+};
+
+template<typename Executor>
+std::vector<long long> execute_latency(int count) {
+  auto &executor = leaked_executor<Executor>();
+  std::vector<long long> samples(count);
+  std::atomic<int> done{0};
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    executor.execute([&samples, &done, start, i]() {
+      samples[i] = elapsed_ns(start);
+      done.fetch_add(1, std::memory_order_release);
+    });
+    // one at a time, so that the latency does not include queueing behind earlier executables.
+    while (done.load(std::memory_order_acquire) <= i) std::this_thread::yield();
+  }
+  return samples;
+}
+
+template<typename Executor>
+std::vector<long long> execute_call(int count) {
+  auto &executor = leaked_executor<Executor>();
+  std::vector<long long> samples;
+  samples.reserve(count);
+  std::atomic<int> done{0};
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    executor.execute([&done]() { done.fetch_add(1, std::memory_order_release); });
+    samples.push_back(elapsed_ns(start));
+  }
+  while (done.load(std::memory_order_acquire) < count) std::this_thread::yield();
+  return samples;
+}
+
+// cost of a debug() call on the calling thread, formatting and writing happen on the flusher.
+std::vector<long long> log_call(int count) {
+  std::vector<long long> samples;
+  samples.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    auto start = BenchClock::now();
+    debug("log_call", i, "of", count);
+    samples.push_back(elapsed_ns(start));
+  }
+  Logger::flush();
+  return samples;
+}
+
+int main(int argc, char **argv) {
+  // debug() writes to std::cout, the report goes to stdout directly.
+  std::cout.rdbuf(nullptr);
+  std::cout.setstate(std::ios::badbit);
+
+  Report report(argc > 1 ? argv[1] : "");
+  ShardedRuntime::set_shard_count(2);
+
+  report.run("task_spawn/noop", [] { return spawn_complete(100000, InlineTask); });
+  report.run("task_spawn/shared_looper", [] { return spawn_complete(20000, LooperTask); });
+
+  for (int depth : {1, 16, 256}) {
+    report.run("nested_await/depth_" + std::to_string(depth), [depth] { return nested_await(depth, 2000); });
+  }
+
+  for (int capacity : {0, 1, 1000}) {
+    auto suffix = "capacity_" + std::to_string(capacity);
+    report.run("channel_ping_pong/" + suffix, [capacity] { return channel_ping_pong(capacity, 20000); });
+    report.run_throughput("channel_stream/" + suffix, [capacity] { return channel_stream(capacity, 200000); });
+  }
+  // values are moved from writer to reader, a copy would double the allocations.
+  report.run_throughput("channel_stream/string_1k", [] {
+    return channel_stream<std::string>(1000, 200000, [](int) { return std::string(1024, 'x'); });
+  });
+  report.run_throughput("channel_stream/unique_ptr", [] {
+    return channel_stream<std::unique_ptr<int>>(1000, 200000, [](int i) { return std::make_unique<int>(i); });
+  });
+
+  report.run("shard_hop/round_trip", [] { return shard_hop(20000); });
+
+  report.run_throughput("generator_stream", [] { return generator_stream(200000); });
+
+  report.run_throughput("channel_select/unbuffered", [] { return channel_select(0, 100000); });
+  report.run_throughput("channel_select/buffered", [] { return channel_select(1000, 100000); });
+
+  report.run_throughput("fan_in/sequential", [] {
+    SequentialFanIn(100, 2000).get_result();
+    return 100 * 2000;
+  });
+  report.run_throughput("fan_in/when_all", [] {
+    WhenAllFanIn(100, 2000).get_result();
+    return 100 * 2000;
+  });
+
+  for (bool via_scheduler : {false, true}) {
+    std::string prefix = via_scheduler ? "sleep_lateness/scheduler_" : "sleep_lateness/";
+    report.run(prefix + "0ms", [via_scheduler] { return sleep_lateness(0, via_scheduler, 2000); });
+    report.run(prefix + "250us", [via_scheduler] { return sleep_lateness(250, via_scheduler, 1000); });
+    report.run(prefix + "1ms", [via_scheduler] { return sleep_lateness(1000, via_scheduler, 200); });
+    report.run(prefix + "10ms", [via_scheduler] { return sleep_lateness(10000, via_scheduler, 50); });
+  }
+
+  report.run("execute_call/looper", [] { return execute_call<LooperExecutor>(100000); });
+  report.run("execute_call/looper_with_metrics", [] { return execute_call<MeasuredLooperExecutor>(100000); });
+  report.run("execute_call/blocking_pool", [] { return execute_call<BlockingPoolExecutor>(100000); });
+  report.run("execute_latency/looper", [] { return execute_latency<LooperExecutor>(20000); });
+  report.run("execute_latency/looper_with_metrics", [] { return execute_latency<MeasuredLooperExecutor>(20000); });
+  report.run("execute_latency/blocking_pool", [] { return execute_latency<BlockingPoolExecutor>(20000); });
+  report.run("spawn_blocking/round_trip", [] { return spawn_blocking_round_trip(20000); });
+
+  report.run("log_call/debug", [] { return log_call(100000); });
+
+  report.print();
+  return 0;
+}
@@ -0,0 +1,129 @@
+//
+// Created by benny on 2022/4/2.
+//
+// Loopback echo server and clients on SharedReactorExecutor, reports requests/s and latency percentiles.
+//
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "SocketAwaiter.h"
+#include "Task.h"
+
+constexpr int kClients = 32;
+constexpr int kRequestsPerClient = 5000;
+constexpr size_t kMessageSize = 64;
+
+using ReactorTask = Task<void, SharedReactorExecutor>;
+
+ReactorTask Echo(int fd) {
+  Socket socket(SharedReactorExecutor::shared_executor(), fd);
+  char buffer[4096];
+  while (true) {
+    auto size = co_await socket.read_some(buffer, sizeof(buffer));
+    if (size == 0) break;
+    size_t written = 0;
+    while (written < size) {
+      written += co_await socket.write_some(buffer + written, size - written);
+    }
+  }
+}
+
+ReactorTask Server(Socket &listener, std::vector<ReactorTask> &connections) {
+  for (int i = 0; i < kClients; ++i) {
+    auto fd = co_await listener.accept();
+    connections.push_back(Echo(fd));
+  }
+}
+
+ReactorTask Client(const sockaddr_in &address, std::vector<long long> &latencies_ns) {
+  using namespace std::chrono;
+  Socket socket(SharedReactorExecutor::shared_executor(), ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  int one = 1;
+  setsockopt(socket.fd(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  co_await socket.connect(reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+
+  char request[kMessageSize] = {};
+  char response[kMessageSize];
+  for (int i = 0; i < kRequestsPerClient; ++i) {
+    auto start = steady_clock::now();
+    size_t written = 0;
+    while (written < kMessageSize) {
+      written += co_await socket.write_some(request + written, kMessageSize - written);
+    }
+    size_t received = 0;
+    while (received < kMessageSize) {
+      auto size = co_await socket.read_some(response + received, kMessageSize - received);
+      if (size == 0) co_return;
+      received += size;
+    }
+    latencies_ns.push_back(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+  }
+}
+
+int main() {
+  using namespace std::chrono;
+  auto &reactor = SharedReactorExecutor::shared_executor();
+
+  int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  socklen_t length = sizeof(address);
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+      || listen(listen_fd, 128) != 0
+      || getsockname(listen_fd, reinterpret_cast<sockaddr *>(&address), &length) != 0) {
+    perror("listen");
+    return 1;
+  }
+
+  {
+    Socket listener(reactor, listen_fd);
+    std::vector<ReactorTask> connections;
+    auto server = Server(listener, connections);
+
+    std::vector<std::vector<long long>> latencies(kClients);
+    std::vector<ReactorTask> clients;
+    auto start = steady_clock::now();
+    for (int i = 0; i < kClients; ++i) {
+      latencies[i].reserve(kRequestsPerClient);
+      clients.push_back(Client(address, latencies[i]));
+    }
+    for (auto &client : clients) {
+      client.get_result();
+    }
+    auto elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+    std::vector<long long> all;
+    for (auto &client_latencies : latencies) {
+      all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+    }
+    std::sort(all.begin(), all.end());
+    auto percentile = [&all](double p) {
+      return all.empty() ? 0 : all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+    };
+    std::cout << "clients=" << kClients
+              << " requests=" << all.size()
+              << " requests/s=" << static_cast<long long>(all.size() / elapsed)
+              << " p50_us=" << percentile(0.50) / 1000.0
+              << " p99_us=" << percentile(0.99) / 1000.0
+              << " max_us=" << percentile(1.0) / 1000.0 << std::endl;
+
+    server.get_result();
+    clients.clear();
+    for (auto &connection : connections) {
+      connection.get_result();
+    }
+  }
+  reactor.shutdown();
+  reactor.join();
+  return 0;
+}
@@ -0,0 +1,141 @@
+//
+// Created by benny on 2022/4/5.
+//
+// Spawn/complete rate of short-lived tasks with FramePool enabled, disabled, and with frames
+// taken from a caller supplied arena.
+//
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "Executor.h"
+#include "FramePool.h"
+#include "Task.h"
+
+constexpr int kTasks = 1000000;
+constexpr int kBatch = 1000;
+
+// hands out frames from one buffer, everything is released at once by reset.
+class MonotonicArena : public FrameArena {
+ public:
+  explicit MonotonicArena(size_t capacity) : buffer(new std::byte[capacity]), capacity(capacity) {}
+
+  void *allocate(size_t size) override {
+    size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    if (offset + size > capacity) throw std::bad_alloc();
+    auto p = buffer.get() + offset;
+    offset += size;
+    return p;
+  }
+
+  void deallocate(void *, size_t) override {}
+
+  void reset() {
+    offset = 0;
+  }
+
+ private:
+  std::unique_ptr<std::byte[]> buffer;
+  size_t capacity;
+  size_t offset = 0;
+};
+
+Task<int, NoopExecutor> InlineChild(int i) {
+  co_return i;
+}
+
+Task<int, NoopExecutor> ArenaChild(std::allocator_arg_t, FrameArena &, int i) {
+  co_return i;
+}
+
+Task<int, SharedLooperExecutor> LooperChild(int i) {
+  co_return i;
+}
+
+Task<long long, SharedLooperExecutor> LooperParent() {
+  long long sum = 0;
+  for (int i = 0; i < kTasks; ++i) {
+    sum += co_await LooperChild(i);
+  }
+  co_return sum;
+}
+
+template<typename Body>
+void run(const char *name, Body &&body) {
+  auto before = FramePool::statistics();
+  auto start = std::chrono::steady_clock::now();
+  long long sum = body();
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  auto after = FramePool::statistics();
+
+  std::cout << name
+            << " pool=" << (FramePool::enabled() ? "on" : "off")
+            << " tasks/s=" << static_cast<long long>(kTasks / elapsed)
+            << " ns/task=" << elapsed * 1e9 / kTasks
+            << " hits=" << after.hits - before.hits
+            << " misses=" << after.misses - before.misses
+            << " bypassed=" << after.bypassed - before.bypassed
+            << " arena=" << after.arena_allocations - before.arena_allocations
+            << " checksum=" << sum << std::endl;
+}
+
+long long spawn_inline() {
+  long long sum = 0;
+  for (int i = 0; i < kTasks; ++i) {
+    sum += InlineChild(i).get_result();
+  }
+  return sum;
+}
+
+// keeps kBatch frames alive at a time, more than the allocator's per-thread caches hold.
+long long spawn_batched() {
+  long long sum = 0;
+  std::vector<Task<int, NoopExecutor>> tasks;
+  tasks.reserve(kBatch);
+  for (int i = 0; i < kTasks; i += kBatch) {
+    for (int j = 0; j < kBatch; ++j) {
+      tasks.push_back(InlineChild(i + j));
+    }
+    for (auto &task : tasks) {
+      sum += task.get_result();
+    }
+    tasks.clear();
+  }
+  return sum;
+}
+
+long long spawn_in_arena() {
+  MonotonicArena arena(kBatch * 1024);
+  long long sum = 0;
+  std::vector<Task<int, NoopExecutor>> tasks;
+  tasks.reserve(kBatch);
+  for (int i = 0; i < kTasks; i += kBatch) {
+    for (int j = 0; j < kBatch; ++j) {
+      tasks.push_back(ArenaChild(std::allocator_arg, arena, i + j));
+    }
+    for (auto &task : tasks) {
+      sum += task.get_result();
+    }
+    tasks.clear();
+    arena.reset();
+  }
+  return sum;
+}
+
+long long spawn_nested() {
+  return LooperParent().get_result();
+}
+
+int main() {
+  // start the looper thread first, malloc and shared_ptr take faster paths while single threaded.
+  SharedLooperExecutor::shared_executor();
+  for (bool enabled : {false, true}) {
+    FramePool::set_enabled(enabled);
+    run("inline", spawn_inline);
+    run("batched", spawn_batched);
+    run("nested", spawn_nested);
+  }
+  run("arena", spawn_in_arena);
+  return 0;
+}
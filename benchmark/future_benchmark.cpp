@@ -0,0 +1,137 @@
+//
+// Created by benny on 2022/4/15.
+//
+// Rounds of 1000 tasks on SharedLooperExecutor, each awaiting one future that the main thread
+// completes once all of them are suspended:
+//   thread_per_await: the former FutureAwaiter, a detached thread blocks on every future.
+//   future_bridge:    FutureAwaiter, std::futures polled by the shared FutureBridge.
+//   async_promise:    AsyncPromise/AsyncFuture, the promise resumes the awaiter directly.
+// Reports awaits per second and the peak number of threads in the process.
+//
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncPromise.h"
+#include "Executor.h"
+#include "FutureAwaiter.h"
+#include "Task.h"
+
+constexpr int kTasksPerRound = 1000;
+constexpr int kRounds = 20;
+
+template<typename R>
+struct ThreadPerAwaitFutureAwaiter : public Awaiter<R> {
+  explicit ThreadPerAwaitFutureAwaiter(std::future<R> &&future) noexcept
+      : _future(std::move(future)) {}
+
+  ThreadPerAwaitFutureAwaiter(ThreadPerAwaitFutureAwaiter &&awaiter) noexcept
+      : Awaiter<R>(std::move(awaiter)), _future(std::move(awaiter._future)) {}
+
+ protected:
+  void after_suspend() override {
+    std::thread([this]() {
+      this->resume(this->_future.get());
+    }).detach();
+  }
+
+ private:
+  std::future<R> _future;
+};
+
+static int thread_count() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("Threads:", 0) == 0) {
+      return std::stoi(line.substr(8));
+    }
+  }
+  return 0;
+}
+
+// samples the thread count until stopped.
+class ThreadSampler {
+ public:
+  ThreadSampler() : sampler([this]() {
+    while (!is_stopped.load()) {
+      auto count = thread_count();
+      if (count > peak) peak = count;
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+  }) {}
+
+  int stop() {
+    is_stopped.store(true);
+    sampler.join();
+    return peak;
+  }
+
+ private:
+  std::atomic<bool> is_stopped{false};
+  int peak = 0;
+  std::thread sampler;
+};
+
+Task<int, SharedLooperExecutor> ThreadPerAwait(std::future<int> future, std::atomic<int> &suspended) {
+  suspended.fetch_add(1);
+  co_return co_await ThreadPerAwaitFutureAwaiter<int>(std::move(future));
+}
+
+Task<int, SharedLooperExecutor> Bridged(std::future<int> future, std::atomic<int> &suspended) {
+  suspended.fetch_add(1);
+  co_return co_await FutureAwaiter<int>(std::move(future));
+}
+
+Task<int, SharedLooperExecutor> Promised(AsyncFuture<int> future, std::atomic<int> &suspended) {
+  suspended.fetch_add(1);
+  co_return co_await future.get();
+}
+
+template<typename Promise, typename Awaiting>
+void run(const char *name, Awaiting awaiting) {
+  ThreadSampler sampler;
+  long long sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < kRounds; ++round) {
+    std::atomic<int> suspended{0};
+    std::vector<Promise> promises(kTasksPerRound);
+    std::vector<Task<int, SharedLooperExecutor>> tasks;
+    tasks.reserve(kTasksPerRound);
+    for (auto &promise : promises) {
+      tasks.push_back(awaiting(promise.get_future(), suspended));
+    }
+    while (suspended.load() < kTasksPerRound) {
+      std::this_thread::yield();
+    }
+    for (int i = 0; i < kTasksPerRound; ++i) {
+      promises[i].set_value(i);
+    }
+    for (auto &task : tasks) {
+      sum += task.get_result();
+    }
+  }
+  auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  auto awaits = kTasksPerRound * kRounds;
+  std::cout << name
+            << " awaits=" << awaits
+            << " awaits/s=" << static_cast<long long>(awaits / seconds)
+            << " peak_threads=" << sampler.stop()
+            << " sum=" << sum << std::endl;
+}
+
+int main() {
+  Logger::set_level(LogLevel::kOff);
+  SharedLooperExecutor::shared_executor();
+  FutureBridge::shared_bridge();
+
+  run<std::promise<int>>("thread_per_await", ThreadPerAwait);
+  run<std::promise<int>>("future_bridge", Bridged);
+  run<AsyncPromise<int>>("async_promise", Promised);
+  return 0;
+}
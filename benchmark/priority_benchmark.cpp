@@ -0,0 +1,136 @@
+//
+// Created by benny on 2022/4/20.
+//
+// kBulkTasks normal and kLowTasks low priority tasks keep SharedLooperExecutor saturated, each
+// spinning for kBulkWork between yields. A probe task awaits a ping from the main thread every
+// kPingInterval and is created either in the normal lane, behind the bulk work, or in the high
+// one. Reports how long the probe takes to run after its ping and how many executables each
+// lane ran, the low lane keeps progressing although higher lanes always have work.
+//
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Executor.h"
+#include "Task.h"
+#include "TaskPriority.h"
+
+constexpr int kBulkTasks = 32;
+constexpr int kLowTasks = 4;
+constexpr int kProbes = 2000;
+constexpr auto kBulkWork = std::chrono::microseconds(5);
+constexpr auto kPingInterval = std::chrono::microseconds(200);
+
+using BenchClock = std::chrono::steady_clock;
+
+// queues the coroutine again in its own lane.
+struct YieldAwaiter : public Awaiter<void> {
+ protected:
+  void after_suspend() override {
+    resume();
+  }
+};
+
+struct PingAwaiter;
+
+// the probe waiting for its ping and when the main thread resumed it.
+struct Ping {
+  std::atomic<PingAwaiter *> pending{nullptr};
+  BenchClock::time_point pinged_at;
+};
+
+struct PingAwaiter : public Awaiter<void> {
+  explicit PingAwaiter(Ping &ping) : ping(&ping) {}
+
+ protected:
+  void after_suspend() override {
+    ping->pending.store(this, std::memory_order_release);
+  }
+
+ private:
+  Ping *ping;
+};
+
+Task<void, SharedLooperExecutor> Bulk(std::atomic<bool> &running) {
+  while (running.load(std::memory_order_relaxed)) {
+    auto until = BenchClock::now() + kBulkWork;
+    while (BenchClock::now() < until) {}
+    co_await YieldAwaiter();
+  }
+}
+
+Task<void, SharedLooperExecutor> Probe(Ping &ping, std::vector<long> &latencies) {
+  for (int i = 0; i < kProbes; ++i) {
+    co_await PingAwaiter(ping);
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - ping.pinged_at).count());
+  }
+}
+
+uint64_t lane_count(const ExecutorMetricsSnapshot &snapshot, TaskPriority priority) {
+  return snapshot.lane_schedule_delay[lane_of(priority)].count;
+}
+
+void run(const char *name, TaskPriority probe_priority) {
+  auto &executor = SharedLooperExecutor::shared_executor();
+  auto before = *executor.metrics_snapshot();
+
+  std::atomic<bool> running{true};
+  std::vector<Task<void, SharedLooperExecutor>> bulk;
+  for (int i = 0; i < kBulkTasks; ++i) {
+    bulk.push_back(Bulk(running));
+  }
+  {
+    TaskPriorityScope scope(TaskPriority::kLow);
+    for (int i = 0; i < kLowTasks; ++i) {
+      bulk.push_back(Bulk(running));
+    }
+  }
+
+  Ping ping;
+  std::vector<long> latencies;
+  latencies.reserve(kProbes);
+  auto probe = [&] {
+    TaskPriorityScope scope(probe_priority);
+    return Probe(ping, latencies);
+  }();
+  for (int i = 0; i < kProbes; ++i) {
+    PingAwaiter *awaiter;
+    while (!(awaiter = ping.pending.exchange(nullptr, std::memory_order_acquire))) {
+      std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(kPingInterval);
+    ping.pinged_at = BenchClock::now();
+    awaiter->resume();
+  }
+  probe.get_result();
+  running.store(false, std::memory_order_relaxed);
+  for (auto &task : bulk) {
+    task.get_result();
+  }
+
+  auto after = *executor.metrics_snapshot();
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[static_cast<size_t>(p * static_cast<double>(latencies.size() - 1))] / 1000.0;
+  };
+  std::cout << name
+            << " p50=" << percentile(0.5) << "us"
+            << " p99=" << percentile(0.99) << "us"
+            << " p999=" << percentile(0.999) << "us"
+            << " max=" << latencies.back() / 1000.0 << "us"
+            << " high=" << lane_count(after, TaskPriority::kHigh) - lane_count(before, TaskPriority::kHigh)
+            << " normal=" << lane_count(after, TaskPriority::kNormal) - lane_count(before, TaskPriority::kNormal)
+            << " low=" << lane_count(after, TaskPriority::kLow) - lane_count(before, TaskPriority::kLow)
+            << std::endl;
+}
+
+int main() {
+  Logger::set_level(LogLevel::kOff);
+  SharedLooperExecutor::shared_executor().enable_metrics();
+  run("probe_normal", TaskPriority::kNormal);
+  run("probe_high", TaskPriority::kHigh);
+  return 0;
+}
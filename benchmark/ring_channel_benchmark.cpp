@@ -0,0 +1,79 @@
+//
+// Created by benny on 2022/4/6.
+//
+// Channel vs RingChannel throughput with N producers and N consumers sharing one channel on
+// SharedWorkStealingExecutor, SpscChannel added for 1P1C.
+//
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "Channel.h"
+#include "RingChannel.h"
+#include "Task.h"
+#include "WorkStealingExecutor.h"
+
+constexpr int kMessages = 1 << 20;
+constexpr int kChannelCapacity = 1024;
+
+template<typename ChannelType>
+Task<void, SharedWorkStealingExecutor> Producer(ChannelType &channel, int count) {
+  for (int i = 0; i < count; ++i) {
+    co_await channel.write(i);
+  }
+}
+
+template<typename ChannelType>
+Task<long long, SharedWorkStealingExecutor> Consumer(ChannelType &channel, int count) {
+  long long sum = 0;
+  for (int i = 0; i < count; ++i) {
+    sum += co_await channel.read();
+  }
+  co_return sum;
+}
+
+template<typename ChannelType>
+void run(const char *name, int pairs) {
+  using namespace std::chrono;
+  ChannelType channel(kChannelCapacity);
+  auto count = kMessages / pairs;
+
+  auto start = steady_clock::now();
+  std::vector<Task<long long, SharedWorkStealingExecutor>> consumers;
+  std::vector<Task<void, SharedWorkStealingExecutor>> producers;
+  for (int i = 0; i < pairs; ++i) {
+    consumers.push_back(Consumer(channel, count));
+    producers.push_back(Producer(channel, count));
+  }
+  long long sum = 0;
+  for (auto &consumer : consumers) {
+    sum += consumer.get_result();
+  }
+  for (auto &producer : producers) {
+    producer.get_result();
+  }
+  auto elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+  auto messages = static_cast<double>(count) * pairs;
+  std::cout << name
+            << " producers=" << pairs
+            << " consumers=" << pairs
+            << " messages=" << static_cast<long long>(messages)
+            << " ops/s=" << static_cast<long long>(messages / elapsed)
+            << " checksum=" << sum << std::endl;
+}
+
+int main() {
+  for (int pairs : {1, 4, 16}) {
+    run<Channel<int>>("Channel", pairs);
+    run<RingChannel<int>>("RingChannel", pairs);
+    if (pairs == 1) {
+      run<SpscChannel<int>>("SpscChannel", pairs);
+    }
+  }
+
+  // let the workers leave the finished frames before exit destroys them.
+  SharedWorkStealingExecutor::shared_executor().shutdown();
+  SharedWorkStealingExecutor::shared_executor().join();
+  return 0;
+}
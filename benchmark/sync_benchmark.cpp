@@ -0,0 +1,119 @@
+//
+// Created by benny on 2022/4/18.
+//
+// kTasks tasks on SharedWorkStealingExecutor, each taking a lock kLocksPerTask times around a
+// short critical section:
+//   std_mutex:    std::mutex, a waiting task blocks its worker thread.
+//   channel_lock: a Channel of capacity 1, written to lock and read to unlock.
+//   async_mutex:  AsyncMutex, a waiting task is suspended and the worker runs other tasks.
+// Reports locks per second. Without arguments the benchmark re-runs itself once per worker
+// count, from 1 up to the number of cores.
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncMutex.h"
+#include "Channel.h"
+#include "Task.h"
+#include "WorkStealingExecutor.h"
+
+constexpr int kTasks = 64;
+constexpr int kLocksPerTask = 20000;
+
+// the critical section, long enough for the lock to be contended.
+static void critical_section(long &counter) {
+  for (int i = 0; i < 20; ++i) {
+    counter += i;
+    asm volatile("" : : "r"(counter) : "memory");
+  }
+}
+
+Task<void, SharedWorkStealingExecutor> StdMutexTask(std::mutex &mutex, long &counter) {
+  for (int i = 0; i < kLocksPerTask; ++i) {
+    std::lock_guard lock(mutex);
+    critical_section(counter);
+  }
+  co_return;
+}
+
+Task<void, SharedWorkStealingExecutor> ChannelLockTask(Channel<int> &lock, long &counter) {
+  for (int i = 0; i < kLocksPerTask; ++i) {
+    co_await lock.write(0);
+    critical_section(counter);
+    co_await lock.read();
+  }
+}
+
+Task<void, SharedWorkStealingExecutor> AsyncMutexTask(AsyncMutex &mutex, long &counter) {
+  for (int i = 0; i < kLocksPerTask; ++i) {
+    auto guard = co_await mutex.scoped_lock();
+    critical_section(counter);
+  }
+}
+
+template<typename Lock, typename Locking>
+void run(size_t worker_count, const char *name, Locking locking) {
+  using namespace std::chrono;
+  Lock lock;
+  long counter = 0;
+  auto start = steady_clock::now();
+  std::vector<Task<void, SharedWorkStealingExecutor>> tasks;
+  for (int i = 0; i < kTasks; ++i) {
+    tasks.push_back(locking(lock, counter));
+  }
+  for (auto &task : tasks) {
+    task.get_result();
+  }
+  auto seconds = duration_cast<duration<double>>(steady_clock::now() - start).count();
+  auto locks = static_cast<double>(kTasks) * kLocksPerTask;
+  std::cout << "workers=" << worker_count
+            << " " << name
+            << " locks=" << static_cast<long long>(locks)
+            << " seconds=" << seconds
+            << " locks/s=" << static_cast<long long>(locks / seconds)
+            << " counter=" << counter << std::endl;
+}
+
+// a capacity 1 channel holding a value is a locked lock.
+struct ChannelLock : Channel<int> {
+  ChannelLock() : Channel<int>(1) {}
+};
+
+void run(size_t worker_count) {
+  SharedWorkStealingExecutor::set_worker_count(worker_count);
+  SharedWorkStealingExecutor::shared_executor();
+
+  run<std::mutex>(worker_count, "std_mutex", StdMutexTask);
+  run<ChannelLock>(worker_count, "channel_lock", [](ChannelLock &lock, long &counter) {
+    return ChannelLockTask(lock, counter);
+  });
+  run<AsyncMutex>(worker_count, "async_mutex", AsyncMutexTask);
+
+  // let the workers leave the finished frames before the tasks destroy them.
+  SharedWorkStealingExecutor::shared_executor().shutdown();
+  SharedWorkStealingExecutor::shared_executor().join();
+}
+
+int main(int argc, char **argv) {
+  Logger::set_level(LogLevel::kOff);
+  if (argc > 1) {
+    run(std::stoul(argv[1]));
+    return 0;
+  }
+
+  auto cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned workers = 1; ; workers *= 2) {
+    if (workers > cores) workers = cores;
+    auto command = std::string(argv[0]) + " " + std::to_string(workers);
+    if (std::system(command.c_str()) != 0) {
+      return 1;
+    }
+    if (workers == cores) break;
+  }
+  return 0;
+}
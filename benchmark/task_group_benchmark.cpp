@@ -0,0 +1,90 @@
+//
+// Created by benny on 2022/4/10.
+//
+// TaskGroup with a million tasks on SharedLooperExecutor:
+//   suspended: every task waits on a rendezvous channel until all of them are live, then a writer
+//              feeds one value per task. Reports peak frame memory per task and the peak RSS.
+//   spawn:     tasks that complete right away, spawned and joined in a loop.
+//
+#include <sys/resource.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "Channel.h"
+#include "Executor.h"
+#include "Task.h"
+#include "TaskGroup.h"
+
+constexpr int kTaskCount = 1000000;
+
+Task<void, SharedLooperExecutor> Handler(Channel<int> &channel) {
+  co_await channel.read();
+}
+
+Task<void, SharedLooperExecutor> Feeder(Channel<int> &channel, TaskGroup &group, int count) {
+  // the handlers start on the looper, wait until every one of them is parked on the channel.
+  while (group.live_count() < static_cast<size_t>(count) + 1) {
+    co_await std::chrono::milliseconds(1);
+  }
+  for (int i = 0; i < count; ++i) {
+    co_await channel.write(i);
+  }
+}
+
+Task<void, SharedLooperExecutor> Noop() {
+  co_return;
+}
+
+Task<void, SharedLooperExecutor> Spawner(TaskGroup &group, int count) {
+  for (int i = 0; i < count; ++i) {
+    group.spawn(Noop());
+  }
+  co_await group.join();
+}
+
+static long peak_rss_kb() {
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void print(const char *name, const TaskGroup &group, double seconds, int count) {
+  auto statistics = group.statistics();
+  std::cout << name
+            << " tasks=" << statistics.spawned_tasks
+            << " peak_live=" << statistics.peak_live_tasks
+            << " peak_frame_bytes=" << statistics.peak_frame_bytes
+            << " frame_bytes/task=" << statistics.peak_frame_bytes / std::max<size_t>(statistics.peak_live_tasks, 1)
+            << " live_after_join=" << statistics.live_tasks
+            << " tasks/s=" << static_cast<long long>(count / seconds)
+            << " peak_rss_kb=" << peak_rss_kb() << std::endl;
+}
+
+int main() {
+  using namespace std::chrono;
+  Logger::set_level(LogLevel::kOff);
+  SharedLooperExecutor::shared_executor();
+
+  {
+    Channel<int> channel;
+    TaskGroup group;
+    auto start = steady_clock::now();
+    for (int i = 0; i < kTaskCount; ++i) {
+      group.spawn(Handler(channel));
+    }
+    group.spawn(Feeder(channel, group, kTaskCount));
+    group.wait();
+    print("suspended", group, duration_cast<duration<double>>(steady_clock::now() - start).count(), kTaskCount);
+  }
+
+  {
+    TaskGroup group;
+    TaskGroup outer;
+    auto start = steady_clock::now();
+    outer.spawn(Spawner(group, kTaskCount));
+    outer.wait();
+    print("spawn", group, duration_cast<duration<double>>(steady_clock::now() - start).count(), kTaskCount);
+  }
+  return 0;
+}
@@ -0,0 +1,62 @@
+//
+// Created by benny on 2022/3/29.
+//
+// Compares HeapTimerQueue and TimingWheelTimerQueue at 1k/100k/1M pending timers.
+// Time is simulated: every timer is pushed up front with a delay spread over 10 seconds,
+// then the clock advances in 1ms steps until all of them expired.
+//
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "TimerQueue.h"
+
+template<typename Queue>
+void run(const std::string &name, size_t timer_count) {
+  using namespace std::chrono;
+  auto origin = TimerClock::now();
+  Queue queue{};
+
+  std::mt19937_64 random(42);
+  std::uniform_int_distribution<long long> delay_us(0, 10'000'000);
+  std::vector<TimerClock::time_point> times;
+  times.reserve(timer_count);
+  for (size_t i = 0; i < timer_count; ++i) {
+    times.push_back(origin + microseconds(delay_us(random)));
+  }
+
+  long long fired = 0;
+  auto insert_start = steady_clock::now();
+  for (auto time : times) {
+    queue.push([&fired]() { ++fired; }, time);
+  }
+  auto insert_ns = duration_cast<nanoseconds>(steady_clock::now() - insert_start).count();
+
+  std::vector<Executable> expired;
+  expired.reserve(timer_count);
+  auto expire_start = steady_clock::now();
+  for (auto now = origin; !queue.empty(); now += milliseconds(1)) {
+    queue.pop_expired(now, expired);
+    for (auto &executable : expired) {
+      executable();
+    }
+    expired.clear();
+  }
+  auto expire_ns = duration_cast<nanoseconds>(steady_clock::now() - expire_start).count();
+
+  std::cout << name
+            << " timers=" << timer_count
+            << " insert_ns/op=" << static_cast<double>(insert_ns) / timer_count
+            << " expire_ns/op=" << static_cast<double>(expire_ns) / timer_count
+            << " fired=" << fired << std::endl;
+}
+
+int main() {
+  for (size_t timer_count : {1'000, 100'000, 1'000'000}) {
+    run<HeapTimerQueue>("heap", timer_count);
+    run<TimingWheelTimerQueue>("timing_wheel", timer_count);
+  }
+  return 0;
+}
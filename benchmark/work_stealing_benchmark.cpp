@@ -0,0 +1,84 @@
+//
+// Created by benny on 2022/3/27.
+//
+// Channel producer/consumer throughput on SharedWorkStealingExecutor.
+// Without arguments the benchmark re-runs itself once per worker count, from 1 up to the number of cores.
+//
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Channel.h"
+#include "Task.h"
+#include "WorkStealingExecutor.h"
+
+constexpr int kPairs = 64;
+constexpr int kMessagesPerPair = 20000;
+constexpr int kChannelCapacity = 16;
+
+Task<void, SharedWorkStealingExecutor> Producer(Channel<int> &channel) {
+  for (int i = 0; i < kMessagesPerPair; ++i) {
+    co_await channel.write(i);
+  }
+}
+
+Task<void, SharedWorkStealingExecutor> Consumer(Channel<int> &channel) {
+  for (int i = 0; i < kMessagesPerPair; ++i) {
+    co_await channel.read();
+  }
+}
+
+void run(size_t worker_count) {
+  using namespace std::chrono;
+  SharedWorkStealingExecutor::set_worker_count(worker_count);
+  SharedWorkStealingExecutor::shared_executor();
+
+  std::vector<std::unique_ptr<Channel<int>>> channels;
+  for (int i = 0; i < kPairs; ++i) {
+    channels.push_back(std::make_unique<Channel<int>>(kChannelCapacity));
+  }
+
+  auto start = steady_clock::now();
+  std::vector<Task<void, SharedWorkStealingExecutor>> tasks;
+  for (auto &channel : channels) {
+    tasks.push_back(Producer(*channel));
+    tasks.push_back(Consumer(*channel));
+  }
+  for (auto &task : tasks) {
+    task.get_result();
+  }
+  auto elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+
+  // let the workers leave the finished frames before the tasks destroy them.
+  SharedWorkStealingExecutor::shared_executor().shutdown();
+  SharedWorkStealingExecutor::shared_executor().join();
+
+  auto messages = static_cast<double>(kPairs) * kMessagesPerPair;
+  std::cout << "workers=" << worker_count
+            << " pairs=" << kPairs
+            << " messages=" << static_cast<long long>(messages)
+            << " seconds=" << elapsed
+            << " msgs/s=" << static_cast<long long>(messages / elapsed) << std::endl;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    run(std::stoul(argv[1]));
+    return 0;
+  }
+
+  auto cores = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned workers = 1; ; workers *= 2) {
+    if (workers > cores) workers = cores;
+    auto command = std::string(argv[0]) + " " + std::to_string(workers);
+    if (std::system(command.c_str()) != 0) {
+      return 1;
+    }
+    if (workers == cores) break;
+  }
+  return 0;
+}
@@ -0,0 +1,114 @@
+//
+// Created by benny on 2022/4/21.
+//
+// Drives subscribers of a BroadcastChannel at different speeds and checks what each one reads:
+// fan-out to every subscriber, kLag skipping a subscriber over overwritten values, and a
+// kBackpressure writer released when the subscriber holding it back unsubscribes.
+//
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "BroadcastChannel.h"
+#include "demo_utils.h"
+
+// reads until the channel is closed.
+Demo Collect(BroadcastSubscriber<int> &subscriber, std::vector<int> &values) {
+  try {
+    while (true) {
+      values.push_back(*co_await subscriber.read());
+    }
+  } catch (BroadcastChannel<int>::ChannelClosedException &) {}
+}
+
+Demo Write(BroadcastChannel<int> &channel, int count, int &written) {
+  for (int i = 0; i < count; ++i) {
+    co_await channel.write(i);
+    ++written;
+  }
+}
+
+std::vector<int> sequence(int from, int to) {
+  std::vector<int> values;
+  for (int i = from; i < to; ++i) values.push_back(i);
+  return values;
+}
+
+// every subscriber reads every value, in order, then learns that the channel is closed.
+Demo fan_out() {
+  // channels go on the heap, coroutine frames are not aligned for their cache line members.
+  auto owned_channel = std::make_unique<BroadcastChannel<int>>(4);
+  auto &channel = *owned_channel;
+  std::vector<BroadcastSubscriber<int>> subscribers;
+  for (int i = 0; i < 3; ++i) {
+    subscribers.push_back(channel.subscribe());
+  }
+  std::vector<std::vector<int>> values(subscribers.size());
+  std::vector<Demo> readers;
+  for (size_t i = 0; i < subscribers.size(); ++i) {
+    readers.push_back(Collect(subscribers[i], values[i]));
+  }
+  int written = 0;
+  co_await Write(channel, 20, written);
+  channel.close();
+  for (auto &reader : readers) {
+    co_await std::move(reader);
+  }
+  bool all_read = true;
+  for (auto &read : values) {
+    all_read = all_read && read == sequence(0, 20);
+  }
+  check(all_read, "every subscriber reads all 20 values in order");
+}
+
+// with kLag a writer never waits, a subscriber a whole ring behind skips to the oldest value left.
+Demo lag_skips() {
+  auto owned_channel = std::make_unique<BroadcastChannel<int>>(4, BroadcastOverflow::kLag);
+  auto &channel = *owned_channel;
+  auto subscriber = channel.subscribe();
+  int written = 0;
+  co_await Write(channel, 10, written);
+  check(written == 10, "writers do not wait for a subscriber that does not read");
+  std::vector<int> values;
+  auto reader = Collect(subscriber, values);
+  co_await settle();
+  check(values == sequence(6, 10), "the subscriber reads the 4 values the ring still holds");
+  check(subscriber.skipped() == 6, "skipped() counts the 6 overwritten values");
+  co_await Write(channel, 2, written);
+  co_await settle();
+  check(subscriber.skipped() == 6 && values.size() == 6, "a subscriber keeping up skips nothing");
+  channel.close();
+  co_await std::move(reader);
+}
+
+// with kBackpressure the slowest subscriber holds writers back, until it unsubscribes.
+Demo backpressure_unsubscribe() {
+  auto owned_channel = std::make_unique<BroadcastChannel<int>>(2);
+  auto &channel = *owned_channel;
+  auto fast = channel.subscribe();
+  auto slow = std::make_optional(channel.subscribe());
+  std::vector<int> values;
+  auto reader = Collect(fast, values);
+  int written = 0;
+  auto writer = Write(channel, 5, written);
+  co_await settle();
+  check(written == 2, "the writer waits once the ring is full of values the slow subscriber has not read");
+  check(values == sequence(0, 2), "the fast subscriber reads what was written");
+  slow.reset();
+  co_await std::move(writer);
+  co_await settle();
+  check(written == 5, "unsubscribing the slow subscriber releases the writer");
+  check(values == sequence(0, 5), "the fast subscriber reads the rest");
+  channel.close();
+  co_await std::move(reader);
+}
+
+Demo run_all() {
+  co_await fan_out();
+  co_await lag_skips();
+  co_await backpressure_unsubscribe();
+}
+
+int main() {
+  return run_demo("broadcast demo", run_all());
+}
@@ -0,0 +1,63 @@
+//
+// Created by benny on 2022/4/21.
+//
+
+#ifndef CPPCOROUTINES_TASKS_04_TASK_DEMO_UTILS_H_
+#define CPPCOROUTINES_TASKS_04_TASK_DEMO_UTILS_H_
+
+#include <iostream>
+
+#include "CommonAwaiter.h"
+#include "Executor.h"
+#include "Task.h"
+#include "io_utils.h"
+
+// demo tasks share the single thread of SharedLooperExecutor, they interleave only where they wait.
+using Demo = Task<void, SharedLooperExecutor>;
+
+inline int &demo_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+// failures go to stderr, they must show up whatever COROUTINE_LOG_LEVEL compiled out.
+inline void check(bool condition, const char *what) {
+  if (condition) {
+    debug("ok: ", what);
+    return;
+  }
+  ++demo_failures();
+  std::cerr << "FAILED: " << what << std::endl;
+}
+
+// queues the coroutine again behind everything already queued.
+struct YieldAwaiter : public Awaiter<void> {
+ protected:
+  void after_suspend() override {
+    resume();
+  }
+};
+
+// each yield lets every queued task take one step, none of the demos needs more steps than this
+// before all of its tasks wait again.
+constexpr int kSettleYields = 16;
+
+// lets the tasks queued so far run until they wait again.
+inline Demo settle() {
+  for (int i = 0; i < kSettleYields; ++i) {
+    co_await YieldAwaiter();
+  }
+}
+
+// runs the demo to completion, the exit status of the program.
+inline int run_demo(const char *name, Demo &&demo) {
+  demo.get_result();
+  if (demo_failures()) {
+    std::cerr << name << " FAILED, failed checks: " << demo_failures() << std::endl;
+    return 1;
+  }
+  std::cout << name << " passed" << std::endl;
+  return 0;
+}
+
+#endif //CPPCOROUTINES_TASKS_04_TASK_DEMO_UTILS_H_
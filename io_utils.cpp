@@ -1,12 +1,24 @@
 //
 // Created by benny on 2022/3/10.
 //
-#include <iostream>
+#include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <ctime>
 #include <iomanip>
-#include <thread>
+#include <iostream>
 #include <sstream>
+#include <thread>
+
+#include "io_utils.h"
+
+using namespace std::chrono_literals;
+
+// how long the flusher lets calls pile up before writing them, and how long it sleeps when idle.
+constexpr auto kFlushInterval = 5ms;
+constexpr auto kIdleInterval = 100ms;
 
 inline char separator() {
 #ifdef _WIN32
@@ -26,24 +38,221 @@ const char *file_name(const char *path) {
   return file;
 }
 
-std::stringstream &PrintTime(std::stringstream &ss) {
-  using namespace std;
-  using namespace std::chrono;
+static std::string current_thread_name() {
+  std::ostringstream name;
+  name << " [Thread-" << std::setw(5) << std::this_thread::get_id() << "] ";
+  return name.str();
+}
+
+static const char *level_name(LogLevel level) {
+  switch (level) {
+    case LogLevel::kTrace: return "T ";
+    case LogLevel::kDebug: return "D ";
+    case LogLevel::kInfo: return "I ";
+    case LogLevel::kWarn: return "W ";
+    case LogLevel::kError: return "E ";
+    default: return "";
+  }
+}
+
+Logger::ThreadRing::ThreadRing() : thread_name(current_thread_name()) {}
+
+Logger::RingOwner::RingOwner() {
+  auto &logger = instance();
+  std::lock_guard lock(logger.ring_lock);
+  logger.rings.push_back(ring);
+}
+
+Logger::RingOwner::~RingOwner() {
+  local_ring_pointer = nullptr;
+  is_ring_released = true;
+  ring->is_retired.store(true, std::memory_order_release);
+}
+
+Logger::Logger() : flusher(&Logger::run_loop, this) {
+  // static destructors registered before the first call still log, synchronously from here on.
+  std::atexit([] {
+    auto &logger = instance();
+    logger.is_exiting.store(true, std::memory_order_relaxed);
+    logger.flush_rings();
+  });
+}
+
+void Logger::request_flush() {
+  if (!is_pending.exchange(true, std::memory_order_relaxed)) {
+    std::lock_guard lock(flusher_lock);
+    flusher_condition.notify_one();
+  }
+}
+
+void Logger::run_loop() {
+  // never exits, the logger lives until the process ends.
+  while (true) {
+    {
+      std::unique_lock lock(flusher_lock);
+      flusher_condition.wait_for(lock, kIdleInterval, [this]() {
+        return is_pending.load(std::memory_order_relaxed);
+      });
+    }
+    // lets a burst of calls pile up into one write.
+    std::this_thread::sleep_for(kFlushInterval);
+    is_pending.store(false, std::memory_order_relaxed);
+    flush_rings();
+  }
+}
+
+void Logger::flush_rings() {
+  std::lock_guard output(output_lock);
+  {
+    std::lock_guard lock(ring_lock);
+    std::erase_if(rings, [](auto &ring) {
+      return ring->is_retired.load(std::memory_order_acquire)
+          && ring->head.load(std::memory_order_relaxed) == ring->tail.load(std::memory_order_acquire);
+    });
+    draining_rings = rings;
+  }
+
+  drained_tails.clear();
+  batch.clear();
+  for (auto &ring : draining_rings) {
+    auto head = ring->head.load(std::memory_order_relaxed);
+    auto tail = ring->tail.load(std::memory_order_acquire);
+    for (auto position = head; position != tail; ++position) {
+      batch.emplace_back(&ring->records[position & (ThreadRing::kCapacity - 1)], ring.get());
+    }
+    drained_tails.push_back(tail);
+  }
+  // each ring is in order already, the stable sort interleaves the threads.
+  std::stable_sort(batch.begin(), batch.end(), [](auto &left, auto &right) {
+    return left.first->timestamp_ns < right.first->timestamp_ns;
+  });
 
-  auto now = system_clock::now();
-  auto in_time_t = system_clock::to_time_t(now);
+  output_buffer.clear();
+  for (auto &[record, ring] : batch) {
+    format(*record, ring->thread_name);
+  }
+  write_output();
 
-  // get number of milliseconds for the current second
-  // (remainder after division into seconds)
-  auto ms = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
+  for (size_t i = 0; i < draining_rings.size(); ++i) {
+    draining_rings[i]->head.store(drained_tails[i], std::memory_order_release);
+  }
+  draining_rings.clear();
+}
 
-  ss << std::put_time(std::localtime(&in_time_t), "%R")
-     << '.' << std::setfill('0') << std::setw(3) << ms.count();
-  return ss;
+void Logger::write_unbuffered(const LogRecord &record) {
+  flush_rings();
+  std::lock_guard output(output_lock);
+  output_buffer.clear();
+  format(record, current_thread_name());
+  write_output();
 }
 
-std::stringstream &PrintThread(std::stringstream &ss) {
-  using namespace std;
-  ss << " [Thread-" << setw(5) << this_thread::get_id() << "] ";
-  return ss;
-}
\ No newline at end of file
+void Logger::write_output() {
+  if (output_buffer.empty()) {
+    return;
+  }
+  std::cout.write(output_buffer.data(), static_cast<std::streamsize>(output_buffer.size()));
+  std::cout.flush();
+}
+
+void Logger::format(const LogRecord &record, std::string_view thread_name) {
+  append_time(record.timestamp_ns);
+  output_buffer += thread_name;
+  output_buffer += level_name(record.level);
+  output_buffer += '(';
+  output_buffer += file_name(record.file);
+  output_buffer += ':';
+  output_buffer += std::to_string(record.line);
+  output_buffer += ") ";
+  output_buffer += record.function;
+  output_buffer += ':';
+  append_args(record);
+  if (record.is_truncated) {
+    output_buffer += "...";
+  }
+  output_buffer += '\n';
+}
+
+void Logger::append_time(int64_t timestamp_ns) {
+  auto second = timestamp_ns / 1000000000;
+  // localtime_r is only called when the second changes.
+  if (second != cached_second) {
+    auto time = static_cast<time_t>(second);
+    tm parts{};
+    localtime_r(&time, &parts);
+    std::strftime(cached_time, sizeof(cached_time), "%T", &parts);
+    cached_second = second;
+  }
+  char millis[8];
+  std::snprintf(millis, sizeof(millis), ".%03d", static_cast<int>(timestamp_ns / 1000000 % 1000));
+  output_buffer += cached_time;
+  output_buffer += millis;
+}
+
+void Logger::append_args(const LogRecord &record) {
+  using ArgType = LogRecord::ArgType;
+  char number[32];
+  auto append_number = [this, &number](auto value, int base = 10) {
+    auto result = std::to_chars(number, number + sizeof(number), value, base);
+    output_buffer.append(number, result.ptr);
+  };
+
+  size_t position = 0;
+  while (position < record.size) {
+    auto type = static_cast<ArgType>(record.payload[position++]);
+    auto data = record.payload + position;
+    output_buffer += ' ';
+    switch (type) {
+      case ArgType::kBool: {
+        bool value;
+        std::memcpy(&value, data, sizeof(value));
+        output_buffer += value ? '1' : '0';
+        position += sizeof(value);
+        break;
+      }
+      case ArgType::kChar: {
+        output_buffer += *data;
+        position += sizeof(char);
+        break;
+      }
+      case ArgType::kSigned: {
+        int64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        append_number(value);
+        position += sizeof(value);
+        break;
+      }
+      case ArgType::kUnsigned: {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        append_number(value);
+        position += sizeof(value);
+        break;
+      }
+      case ArgType::kDouble: {
+        double value;
+        std::memcpy(&value, data, sizeof(value));
+        // same as the default std::ostream formatting.
+        auto length = std::snprintf(number, sizeof(number), "%g", value);
+        output_buffer.append(number, std::min<size_t>(length, sizeof(number) - 1));
+        position += sizeof(value);
+        break;
+      }
+      case ArgType::kPointer: {
+        uintptr_t value;
+        std::memcpy(&value, data, sizeof(value));
+        output_buffer += "0x";
+        append_number(value, 16);
+        position += sizeof(value);
+        break;
+      }
+      case ArgType::kString: {
+        uint16_t length;
+        std::memcpy(&length, data, sizeof(length));
+        output_buffer.append(data + sizeof(length), length);
+        position += sizeof(length) + length;
+        break;
+      }
+    }
+  }
+}
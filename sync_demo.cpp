@@ -0,0 +1,179 @@
+//
+// Created by benny on 2022/4/21.
+//
+// Each scenario parks coroutines on one primitive, releases it step by step and checks who got
+// through, and in which order, after every step: FIFO handoff of AsyncMutex, writer preference
+// of AsyncSharedMutex, permits of AsyncSemaphore, AsyncLatch counted past zero, the phases of
+// AsyncBarrier and the wakeups of AsyncConditionVariable.
+//
+#include <string>
+#include <vector>
+
+#include "AsyncMutex.h"
+#include "AsyncSemaphore.h"
+#include "demo_utils.h"
+
+Demo Locker(AsyncMutex &mutex, std::vector<int> &order, int id) {
+  co_await mutex.lock();
+  order.push_back(id);
+  mutex.unlock();
+}
+
+// waiting coroutines get the mutex in the order they came.
+Demo fifo_handoff() {
+  AsyncMutex mutex;
+  std::vector<int> order;
+  co_await mutex.lock();
+  std::vector<Demo> lockers;
+  for (int id = 0; id < 5; ++id) {
+    lockers.push_back(Locker(mutex, order, id));
+  }
+  co_await settle();
+  check(order.empty(), "waiters stay suspended while the mutex is held");
+  mutex.unlock();
+  for (auto &locker : lockers) {
+    co_await std::move(locker);
+  }
+  check(order == std::vector<int>{0, 1, 2, 3, 4}, "the mutex is handed over in FIFO order");
+  check(mutex.try_lock(), "the mutex is free after the last unlock");
+  mutex.unlock();
+}
+
+Demo Reader(AsyncSharedMutex &mutex, std::vector<std::string> &events, const char *name) {
+  co_await mutex.lock_shared();
+  events.push_back(name);
+  mutex.unlock_shared();
+}
+
+Demo Writer(AsyncSharedMutex &mutex, std::vector<std::string> &events) {
+  co_await mutex.lock();
+  events.push_back("writer");
+  mutex.unlock();
+}
+
+// a reader arriving after a waiting writer queues behind it instead of joining the readers.
+Demo writer_not_starved() {
+  AsyncSharedMutex mutex;
+  std::vector<std::string> events;
+  co_await mutex.lock_shared();
+  auto writer = Writer(mutex, events);
+  co_await settle();
+  auto late_reader = Reader(mutex, events, "late reader");
+  co_await settle();
+  check(events.empty(), "the late reader waits behind the writer");
+  mutex.unlock_shared();
+  co_await std::move(writer);
+  co_await std::move(late_reader);
+  check(events == std::vector<std::string>{"writer", "late reader"}, "the writer goes before the late reader");
+}
+
+Demo Acquirer(AsyncSemaphore &semaphore, int &acquired) {
+  co_await semaphore.acquire();
+  ++acquired;
+}
+
+Demo semaphore_permits() {
+  AsyncSemaphore semaphore(2);
+  int acquired = 0;
+  std::vector<Demo> acquirers;
+  for (int i = 0; i < 4; ++i) {
+    acquirers.push_back(Acquirer(semaphore, acquired));
+  }
+  co_await settle();
+  check(acquired == 2, "two permits let two coroutines through");
+  semaphore.release();
+  co_await settle();
+  check(acquired == 3, "a release lets one more through");
+  semaphore.release();
+  for (auto &acquirer : acquirers) {
+    co_await std::move(acquirer);
+  }
+  check(acquired == 4 && semaphore.available() == 0, "every permit is taken");
+}
+
+Demo LatchWaiter(AsyncLatch &latch, int &passed) {
+  co_await latch.wait();
+  ++passed;
+}
+
+Demo latch_count_down() {
+  AsyncLatch latch(3);
+  int passed = 0;
+  auto first = LatchWaiter(latch, passed);
+  auto second = LatchWaiter(latch, passed);
+  co_await settle();
+  latch.count_down();
+  co_await settle();
+  check(passed == 0, "the latch stays closed until counted down to zero");
+  // from 2 to -3, past zero.
+  latch.count_down(5);
+  co_await std::move(first);
+  co_await std::move(second);
+  check(passed == 2 && latch.try_wait(), "counting down past zero opens the latch");
+}
+
+Demo BarrierTask(AsyncBarrier &barrier, std::vector<int> &arrived, bool &early, int rounds) {
+  for (int round = 0; round < rounds; ++round) {
+    ++arrived[round];
+    co_await barrier.arrive_and_wait();
+    if (arrived[round] != 3) early = true;
+  }
+}
+
+Demo barrier_phases() {
+  constexpr int kRounds = 4;
+  AsyncBarrier barrier(3);
+  std::vector<int> arrived(kRounds);
+  bool early = false;
+  std::vector<Demo> tasks;
+  for (int i = 0; i < 3; ++i) {
+    tasks.push_back(BarrierTask(barrier, arrived, early, kRounds));
+  }
+  for (auto &task : tasks) {
+    co_await std::move(task);
+  }
+  check(!early, "no coroutine leaves a phase before all have arrived");
+  check(arrived == std::vector<int>(kRounds, 3), "every phase has all three arrivals");
+}
+
+Demo Consumer(AsyncMutex &mutex, AsyncConditionVariable &condition, bool &ready, int &woken) {
+  co_await mutex.lock();
+  while (!ready) {
+    co_await condition.wait(mutex);
+  }
+  ++woken;
+  mutex.unlock();
+}
+
+Demo condition_notify() {
+  AsyncMutex mutex;
+  AsyncConditionVariable condition;
+  bool ready = false;
+  int woken = 0;
+  auto first = Consumer(mutex, condition, ready, woken);
+  auto second = Consumer(mutex, condition, ready, woken);
+  co_await settle();
+  co_await mutex.lock();
+  ready = true;
+  condition.notify_one();
+  mutex.unlock();
+  co_await settle();
+  check(woken == 1, "notify_one wakes one waiter");
+  condition.notify_all();
+  co_await std::move(first);
+  co_await std::move(second);
+  check(woken == 2, "notify_all wakes the rest");
+}
+
+Demo run_all() {
+  co_await fifo_handoff();
+  co_await writer_not_starved();
+  co_await semaphore_permits();
+  co_await latch_count_down();
+  co_await barrier_phases();
+  co_await condition_notify();
+}
+
+int main() {
+  return run_demo("sync demo", run_all());
+}